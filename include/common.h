@@ -17,6 +17,7 @@
 #include "common.h"
 
 #define min(a, b) (((a) < (b)) ? (a) : (b))
+#define max(a, b) (((a) > (b)) ? (a) : (b))
 #define divup(a, b) (((a) + (b) - 1) / (b))
 #define roundup(a, b) (divup(a, b) * b)
 
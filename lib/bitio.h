@@ -0,0 +1,470 @@
+/*
+ * bitio.h - Bit-level I/O primitives for SA based LZ compressor
+ *
+ * Copyright (c) 2021-2023 Aki Utoslahti. All rights reserved.
+ *
+ * This work is distributed under terms of the MIT license.
+ * See file LICENSE or a copy at <https://opensource.org/licenses/MIT>.
+ */
+
+/*
+ * Primitives operate on salz_io_ctx, which the includer defines before
+ * including this header. Besides the context of salz.c, a context holding
+ * only members src, src_len, src_pos, dst, dst_len, dst_pos, bits,
+ * bits_avail and bits_pos will do, so that primitives can be exercised in
+ * isolation.
+ *
+ * Writer reserves a 64-bit word for buffered bitfield in output buffer
+ * lazily and fills it most significant bit first, while bytes written in
+ * the meantime follow it. Reader consumes the stream in the same order.
+ */
+
+#ifndef SALZ_BITIO_H
+#define SALZ_BITIO_H
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "common.h"
+
+#ifdef __GNUC__
+#   define salz_memcpy(dst, src, n) __builtin_memcpy(dst, src, n)
+#else
+#   define salz_memcpy(dst, src, n) memcpy(dst, src, n)
+#endif
+
+/*******************
+ * Raw I/O functions
+ *******************/
+
+static inline void write_u32_raw(uint8_t *buf, size_t pos, uint32_t val)
+{
+    salz_memcpy(&buf[pos], &val, sizeof(val));
+}
+
+static inline void write_u64_raw(uint8_t *buf, size_t pos, uint64_t val)
+{
+    salz_memcpy(&buf[pos], &val, sizeof(val));
+}
+
+static inline uint64_t read_u32_raw(const uint8_t *buf, size_t pos)
+{
+    uint32_t val;
+
+    salz_memcpy(&val, &buf[pos], sizeof(val));
+
+    return val;
+}
+
+static inline uint64_t read_u64_raw(const uint8_t *buf, size_t pos)
+{
+    uint64_t val;
+
+    salz_memcpy(&val, &buf[pos], sizeof(val));
+
+    return val;
+}
+
+/***********************
+ * Bit writing functions
+ ***********************/
+
+static inline bool write_u8(salz_io_ctx *ctx, uint8_t val)
+{
+    if (unlikely(ctx->dst_pos >= ctx->dst_len))
+        return false;
+
+    ctx->dst[ctx->dst_pos++] = val;
+
+    return true;
+}
+
+static inline bool flush_bits(salz_io_ctx *ctx)
+{
+    static_assert(sizeof(ctx->bits) == 8);
+
+    write_u64_raw(ctx->dst, ctx->bits_pos, ctx->bits);
+
+    if (unlikely(ctx->dst_pos + 8 > ctx->dst_len))
+        return false;
+
+    ctx->bits = 0;
+    ctx->bits_avail = 64;
+    ctx->bits_pos = ctx->dst_pos;
+    ctx->dst_pos += 8;
+
+    return true;
+}
+
+static inline bool write_bit(salz_io_ctx *ctx, uint8_t val)
+{
+    if (ctx->bits_avail == 0 && unlikely(!flush_bits(ctx)))
+        return false;
+
+    ctx->bits = (ctx->bits << 1) | (val & 1);
+    ctx->bits_avail -= 1;
+
+    return true;
+}
+
+static inline bool write_bits(salz_io_ctx *ctx, uint64_t bits, size_t count)
+{
+    if (ctx->bits_avail == 0 && unlikely(!flush_bits(ctx)))
+        return false;
+
+    if (count > ctx->bits_avail) {
+        ctx->bits = (ctx->bits << ctx->bits_avail) |
+                    ((bits >> (count - ctx->bits_avail)) &
+                     ((1u << ctx->bits_avail) - 1));
+        count -= ctx->bits_avail;
+
+        if (unlikely(!flush_bits(ctx)))
+            return false;
+    }
+
+    ctx->bits = (ctx->bits << count) | (bits & ((1u << count) - 1));
+    ctx->bits_avail -= count;
+
+    return true;
+}
+
+static inline bool write_zeros(salz_io_ctx *ctx, size_t count)
+{
+    while (count) {
+        if (ctx->bits_avail == 0 && unlikely(!flush_bits(ctx)))
+            return false;
+
+        size_t write_count = min(ctx->bits_avail, count);
+        ctx->bits <<= write_count;
+        ctx->bits_avail -= write_count;
+        count -= write_count;
+    }
+
+    return true;
+}
+
+static inline bool write_unary(salz_io_ctx *ctx, uint32_t val)
+{
+    if (unlikely(!write_zeros(ctx, val)))
+        return false;
+    if (unlikely(!write_bit(ctx, 1)))
+        return false;
+
+    return true;
+}
+
+static inline bool write_gr3(salz_io_ctx *ctx, uint32_t val)
+{
+    if (unlikely(!write_unary(ctx, val >> 3)))
+        return false;
+    if (unlikely(!write_bits(ctx, val & 0x7u, 3)))
+        return false;
+
+    return true;
+}
+
+static inline size_t encode_vnibble_le(uint32_t val, uint64_t *res)
+{
+    uint8_t *p = (uint8_t *)res;
+
+    uint32_t v0 = val;
+
+    if (val < 8) {
+        p[0] = v0 | 0x8u;
+        return 1;
+    }
+
+    if (val < 72) {
+        p[0] = (((v0 >> 3) - 1) << 4) | ((v0 & 0x7u) | 0x8u);
+        return 2;
+    }
+
+    uint32_t v1 = val - 72;
+
+    if (val < 584) {
+        p[0] = ((((v0 >> 3) - 1) & 0x7u) << 4) | ((v0 & 0x7u) | 0x8u);
+        p[1] = v1 >> 6;
+        return 3;
+    }
+
+    if (val < 4680) {
+        p[0] = ((((v0 >> 3) - 1) & 0x7u) << 4) | ((v0 & 0x7u) | 0x8u);
+        p[1] = (((v1 >> 9) - 1) << 4) | ((v1 >> 6) & 0x7u);
+        return 4;
+    }
+
+    uint32_t v2 = val - 4680;
+
+    if (val < 37448) {
+        p[0] = ((((v0 >> 3) - 1) & 0x7u) << 4) | ((v0 & 0x7u) | 0x8u);
+        p[1] = ((((v1 >> 9) - 1) & 0x7u) << 4) | ((v1 >> 6) & 0x7u);
+        p[2] = v2 >> 12;
+        return 5;
+    }
+
+    if (val < 299592) {
+        p[0] = ((((v0 >> 3) - 1) & 0x7u) << 4) | ((v0 & 0x7u) | 0x8u);
+        p[1] = ((((v1 >> 9) - 1) & 0x7u) << 4) | ((v1 >> 6) & 0x7u);
+        p[2] = (((v2 >> 15) - 1) << 4) | ((v2 >> 12) & 0x7u);
+        return 6;
+    }
+
+    uint32_t v3 = val - 299592;
+
+    if (val < 2396744) {
+        p[0] = ((((v0 >> 3) - 1) & 0x7u) << 4) | ((v0 & 0x7u) | 0x8u);
+        p[1] = ((((v1 >> 9) - 1) & 0x7u) << 4) | ((v1 >> 6) & 0x7u);
+        p[2] = ((((v2 >> 15) - 1) & 0x7u) << 4) | ((v2 >> 12) & 0x7u);
+        p[3] = v3 >> 18;
+        return 7;
+    }
+
+    if (val < 19173960) {
+        p[0] = ((((v0 >> 3) - 1) & 0x7u) << 4) | ((v0 & 0x7u) | 0x8u);
+        p[1] = ((((v1 >> 9) - 1) & 0x7u) << 4) | ((v1 >> 6) & 0x7u);
+        p[2] = ((((v2 >> 15) - 1) & 0x7u) << 4) | ((v2 >> 12) & 0x7u);
+        p[3] = (((v3 >> 21) - 1) << 4) | ((v3 >> 18) & 0x7u);
+        return 8;
+    }
+
+    uint32_t v4 = val - 19173960;
+
+    if (val < 153391688) {
+        p[0] = ((((v0 >> 3) - 1) & 0x7u) << 4) | ((v0 & 0x7u) | 0x8u);
+        p[1] = ((((v1 >> 9) - 1) & 0x7u) << 4) | ((v1 >> 6) & 0x7u);
+        p[2] = ((((v2 >> 15) - 1) & 0x7u) << 4) | ((v2 >> 12) & 0x7u);
+        p[3] = ((((v3 >> 21) - 1) & 0x7u) << 4) | ((v3 >> 18) & 0x7u);
+        p[4] = v4 >> 24;
+        return 9;
+    }
+
+    if (val < 1227133512) {
+        p[0] = ((((v0 >> 3) - 1) & 0x7u) << 4) | ((v0 & 0x7u) | 0x8u);
+        p[1] = ((((v1 >> 9) - 1) & 0x7u) << 4) | ((v1 >> 6) & 0x7u);
+        p[2] = ((((v2 >> 15) - 1) & 0x7u) << 4) | ((v2 >> 12) & 0x7u);
+        p[3] = ((((v3 >> 21) - 1) & 0x7u) << 4) | ((v3 >> 18) & 0x7u);
+        p[4] = (((v4 >> 27) - 1) << 4) | ((v4 >> 24) & 0x7u);
+        return 10;
+    }
+
+    uint32_t v5 = val - 1227133512;
+
+    p[0] = ((((v0 >> 3) - 1) & 0x7u) << 4) | ((v0 & 0x7u) | 0x8u);
+    p[1] = ((((v1 >> 9) - 1) & 0x7u) << 4) | ((v1 >> 6) & 0x7u);
+    p[2] = ((((v2 >> 15) - 1) & 0x7u) << 4) | ((v2 >> 12) & 0x7u);
+    p[3] = ((((v3 >> 21) - 1) & 0x7u) << 4) | ((v3 >> 18) & 0x7u);
+    p[4] = ((((v4 >> 27) - 1) & 0x7u) << 4) | ((v4 >> 24) & 0x7u);
+    p[5] = v5 >> 30;
+    return 11;
+}
+
+static inline bool write_vnibble(salz_io_ctx *ctx, uint32_t val)
+{
+    uint64_t nibbles;
+
+    size_t nibbles_len = encode_vnibble_le(val, &nibbles);
+
+    if (unlikely(!write_bits(ctx, nibbles, nibbles_len * 4)))
+        return false;
+
+    return true;
+}
+
+/***********************
+ * Bit reading functions
+ ***********************/
+
+static inline bool read_u8(salz_io_ctx *ctx, uint8_t *res)
+{
+    if (unlikely(ctx->src_pos >= ctx->src_len))
+        return false;
+
+    *res = ctx->src[ctx->src_pos++];
+
+    return true;
+}
+
+static inline bool read_u64(salz_io_ctx *ctx, uint64_t *res)
+{
+    if (unlikely(ctx->src_pos + 8 > ctx->src_len))
+        return false;
+
+    salz_memcpy(res, &ctx->src[ctx->src_pos], 8);
+    ctx->src_pos += 8;
+
+    return true;
+}
+
+static inline bool queue_bits(salz_io_ctx *ctx)
+{
+    if (unlikely(!read_u64(ctx, &ctx->bits)))
+        return false;
+
+    ctx->bits_avail = 64;
+
+    return true;
+}
+
+static inline bool read_bit(salz_io_ctx *ctx, uint8_t *res)
+{
+    if (ctx->bits_avail == 0 && unlikely(!queue_bits(ctx)))
+        return false;
+
+    *res = !!(ctx->bits & 0x8000000000000000u);
+    ctx->bits <<= 1;
+    ctx->bits_avail -= 1;
+
+    return true;
+}
+
+static inline bool read_bits(salz_io_ctx *ctx, size_t count, uint64_t *res)
+{
+    assert(count <= 64);
+
+    if (ctx->bits_avail == 0 && unlikely(!queue_bits(ctx)))
+        return false;
+
+    if (count <= ctx->bits_avail) {
+        *res = ctx->bits >> (64 - count);
+        ctx->bits <<= count;
+        ctx->bits_avail -= count;
+        return true;
+    }
+
+    *res = ctx->bits >> (64 - ctx->bits_avail);
+    count -= ctx->bits_avail;
+
+    if (unlikely(!queue_bits(ctx)))
+        return false;
+
+    *res = (*res << count) | (ctx->bits >> (64 - count));
+    ctx->bits <<= count;
+    ctx->bits_avail -= count;
+
+    return true;
+}
+
+static inline bool read_unary(salz_io_ctx *ctx, uint32_t *res)
+{
+    uint32_t last_zeros;
+
+    if (ctx->bits_avail == 0 && unlikely(!queue_bits(ctx)))
+        return false;
+
+    *res = 0;
+    while (ctx->bits == 0) {
+        *res += ctx->bits_avail;
+        if (!unlikely(queue_bits(ctx)))
+            return false;
+    }
+
+    last_zeros = __builtin_clzll(ctx->bits);
+    ctx->bits <<= last_zeros + 1;
+    ctx->bits_avail -= last_zeros + 1;
+
+    *res += last_zeros;
+
+    return true;
+}
+
+static inline bool read_gr3(salz_io_ctx *ctx, uint32_t *res)
+{
+    uint32_t var;
+    uint64_t fixed;
+
+    if (unlikely(!read_unary(ctx, &var)))
+        return false;
+    if (unlikely(!read_bits(ctx, 3, &fixed)))
+        return false;
+
+    *res = (var << 3) | fixed;
+
+    return true;
+}
+
+static inline bool read_nibble(salz_io_ctx *ctx, uint8_t *res)
+{
+    uint64_t var;
+
+    if (unlikely(!read_bits(ctx, 4, &var)))
+        return false;
+
+    *res = (uint8_t)var;
+
+    return true;
+}
+
+static inline bool read_vnibble(salz_io_ctx *ctx, uint32_t *res)
+{
+    uint8_t nibble;
+
+    if (unlikely(!read_nibble(ctx, &nibble)))
+        return false;
+    *res = nibble & 0x7u;
+    if (nibble >= 0x8u)
+        return true;
+
+    if (unlikely(!read_nibble(ctx, &nibble)))
+        return false;
+    *res = ((*res + 1) << 3) | (nibble & 0x7u);
+    if (nibble >= 0x8u)
+        return true;
+
+    if (unlikely(!read_nibble(ctx, &nibble)))
+        return false;
+    *res = ((*res + 1) << 3) | (nibble & 0x7u);
+    if (nibble >= 0x8u)
+        return true;
+
+    if (unlikely(!read_nibble(ctx, &nibble)))
+        return false;
+    *res = ((*res + 1) << 3) | (nibble & 0x7u);
+    if (nibble >= 0x8u)
+        return true;
+
+    if (unlikely(!read_nibble(ctx, &nibble)))
+        return false;
+    *res = ((*res + 1) << 3) | (nibble & 0x7u);
+    if (nibble >= 0x8u)
+        return true;
+
+    if (unlikely(!read_nibble(ctx, &nibble)))
+        return false;
+    *res = ((*res + 1) << 3) | (nibble & 0x7u);
+    if (nibble >= 0x8u)
+        return true;
+
+    if (unlikely(!read_nibble(ctx, &nibble)))
+        return false;
+    *res = ((*res + 1) << 3) | (nibble & 0x7u);
+    if (nibble >= 0x8u)
+        return true;
+
+    if (unlikely(!read_nibble(ctx, &nibble)))
+        return false;
+    *res = ((*res + 1) << 3) | (nibble & 0x7u);
+    if (nibble >= 0x8u)
+        return true;
+
+    if (unlikely(!read_nibble(ctx, &nibble)))
+        return false;
+    *res = ((*res + 1) << 3) | (nibble & 0x7u);
+    if (nibble >= 0x8u)
+        return true;
+
+    if (unlikely(!read_nibble(ctx, &nibble)))
+        return false;
+    *res = ((*res + 1) << 3) | (nibble & 0x7u);
+    if (nibble >= 0x8u)
+        return true;
+
+    if (unlikely(!read_nibble(ctx, &nibble)))
+        return false;
+    *res = ((*res + 1) << 3) | (nibble & 0x7u);
+    return true;
+}
+
+#endif /* !SALZ_BITIO_H */
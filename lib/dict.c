@@ -0,0 +1,330 @@
+/*
+ * dict.c - Dictionary training for SA based LZ compressor
+ *
+ * Copyright (c) 2021-2023 Aki Utoslahti. All rights reserved.
+ *
+ * This work is distributed under terms of the MIT license.
+ * See file LICENSE or a copy at <https://opensource.org/licenses/MIT>.
+ */
+
+/*
+ * References:
+ *   [1] Liao, K., Petri, M., Moffat, A., Wirth, A. (2016). Effective
+ *       Construction of Relative Lempel-Ziv Dictionaries. In: Proceedings
+ *       of the 25th International Conference on World Wide Web (WWW '16).
+ *       https://doi.org/10.1145/2872427.2883042
+ *   [2] Kasai, T., Lee, G., Arimura, H., Arikawa, S., Park, K. (2001).
+ *       Linear-Time Longest-Common-Prefix Computation in Suffix Arrays and
+ *       Its Applications. In: Amir, A. (eds) Combinatorial Pattern Matching.
+ *       CPM 2001. Lecture Notes in Computer Science, vol 2089. Springer,
+ *       Berlin, Heidelberg. https://doi.org/10.1007/3-540-48194-X_17
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "salz.h"
+#include "libsais.h"
+
+#ifdef NDEBUG
+#   define debug(fmt, ...) do {} while(0)
+#else
+#   include <stdio.h>
+#   define debug(fmt, ...) \
+        do { \
+            fprintf(stderr, "(%s:%d) - " fmt "\n", \
+                    __func__, __LINE__, ## __VA_ARGS__); \
+        } while (0)
+#endif
+
+/* Length of substrings, whose frequency is measured (in bytes) */
+#define DICT_DMER_LEN    (8)
+/* Length of segments picked into dictionary (in bytes) */
+#define DICT_SEGMENT_LEN (1024)
+
+/* Dictionary training context */
+struct dict_ctx {
+    /* Samples concatenated one after another */
+    const uint8_t *text;
+    /* Length of samples (in bytes) */
+    size_t text_len;
+
+    /* Suffix array of samples */
+    int32_t *sa;
+    /* Permuted LCP array */
+    int32_t *plcp;
+    /* D-mer starting at each position, or -1 if it crosses end of sample */
+    int32_t *ids;
+    /* Number of distinct samples each d-mer occurs in */
+    int32_t *freqs;
+    /* Occurrences of each d-mer in current candidate segment */
+    int32_t *counts;
+};
+
+static void build_plcp_array(struct dict_ctx *ctx)
+{
+    /* Permuted LCP array construction through PHI array as in [2] */
+
+    int32_t *sa = ctx->sa;
+    int32_t *plcp = ctx->plcp;
+    size_t len = 0;
+
+    plcp[sa[0]] = -1;
+    for (size_t i = 1; i < ctx->text_len; i++)
+        plcp[sa[i]] = sa[i - 1];
+
+    for (size_t pos = 0; pos < ctx->text_len; pos++) {
+        int32_t prev = plcp[pos];
+
+        if (prev == -1) {
+            len = 0;
+            plcp[pos] = 0;
+            continue;
+        }
+
+        while (pos + len < ctx->text_len &&
+               (size_t)prev + len < ctx->text_len &&
+               ctx->text[pos + len] == ctx->text[prev + len])
+            len += 1;
+
+        plcp[pos] = (int32_t)len;
+        len -= !!len;
+    }
+}
+
+static bool count_dmers(struct dict_ctx *ctx, const size_t *sample_lens,
+    size_t samples_cnt)
+{
+    /*
+     * Suffixes sharing a d-mer are adjacent in suffix array. Each d-mer gets
+     * an identifier and a frequency, which is the number of distinct samples
+     * it occurs in.
+     */
+
+    int32_t *owner = NULL;
+    int32_t *last_seen = NULL;
+    int32_t id = -1;
+
+    owner = malloc(ctx->text_len * sizeof(*owner));
+    last_seen = malloc(samples_cnt * sizeof(*last_seen));
+    if (owner == NULL || last_seen == NULL) {
+        debug("Couldn't allocate memory");
+        free(owner);
+        free(last_seen);
+        return false;
+    }
+
+    for (size_t i = 0, pos = 0; i < samples_cnt; i++) {
+        for (size_t end = pos + sample_lens[i]; pos < end; pos++) {
+            owner[pos] = (int32_t)i;
+            ctx->ids[pos] = pos + DICT_DMER_LEN <= end ? 0 : -1;
+        }
+        last_seen[i] = -1;
+    }
+
+    for (size_t i = 0; i < ctx->text_len; i++) {
+        int32_t pos = ctx->sa[i];
+
+        if (i == 0 || ctx->plcp[pos] < DICT_DMER_LEN) {
+            id += 1;
+            ctx->freqs[id] = 0;
+        }
+
+        if (ctx->ids[pos] == -1)
+            continue;
+
+        ctx->ids[pos] = id;
+        if (last_seen[owner[pos]] != id) {
+            last_seen[owner[pos]] = id;
+            ctx->freqs[id] += 1;
+        }
+    }
+
+    free(owner);
+    free(last_seen);
+
+    return true;
+}
+
+static int32_t add_dmer(struct dict_ctx *ctx, size_t pos)
+{
+    int32_t id = ctx->ids[pos];
+
+    if (id == -1 || ctx->counts[id]++ != 0)
+        return 0;
+
+    return ctx->freqs[id];
+}
+
+static int32_t remove_dmer(struct dict_ctx *ctx, size_t pos)
+{
+    int32_t id = ctx->ids[pos];
+
+    if (id == -1 || --ctx->counts[id] != 0)
+        return 0;
+
+    return ctx->freqs[id];
+}
+
+static size_t select_segment(struct dict_ctx *ctx, size_t begin, size_t end,
+    size_t segment_len, uint64_t *best_score)
+{
+    /*
+     * Slide a window over the epoch and pick the segment, whose distinct
+     * d-mers have the highest total frequency, in spirit of [1].
+     */
+
+    size_t dmers_cnt = segment_len - DICT_DMER_LEN + 1;
+    size_t best_pos = begin;
+    size_t tail = begin;
+    uint64_t score = 0;
+
+    *best_score = 0;
+
+    for (size_t pos = begin; pos + DICT_DMER_LEN <= end; pos++) {
+        score += (uint64_t)add_dmer(ctx, pos);
+
+        if (pos - tail + 1 < dmers_cnt)
+            continue;
+
+        if (score > *best_score) {
+            *best_score = score;
+            best_pos = tail;
+        }
+
+        score -= (uint64_t)remove_dmer(ctx, tail++);
+    }
+
+    /* Leave counts clean for the next epoch */
+    for ( ; tail + DICT_DMER_LEN <= end; tail++)
+        remove_dmer(ctx, tail);
+
+    return best_pos;
+}
+
+static size_t build_dict(struct dict_ctx *ctx, uint8_t *dict, size_t dict_cap)
+{
+    /*
+     * Samples are divided into epochs, each of which contributes its best
+     * segment in turn until dictionary is full. D-mers of a picked segment
+     * no longer count, so that dictionary covers as much as possible.
+     * Dictionary is filled from the end, as segments picked first are the
+     * most valuable and are closest to the encoded segment.
+     */
+
+    size_t segment_len = DICT_SEGMENT_LEN;
+    size_t epochs_cnt = dict_cap / segment_len;
+    size_t epoch_len;
+    size_t dict_pos = dict_cap;
+    size_t idle_cnt = 0;
+
+    epochs_cnt = min(epochs_cnt, ctx->text_len / segment_len);
+    epoch_len = ctx->text_len / epochs_cnt;
+
+    for (size_t epoch = 0; dict_pos >= segment_len && idle_cnt < epochs_cnt;
+         epoch = (epoch + 1) % epochs_cnt) {
+        size_t begin = epoch * epoch_len;
+        size_t end = epoch + 1 == epochs_cnt ? ctx->text_len : begin + epoch_len;
+        uint64_t score;
+        size_t pos = select_segment(ctx, begin, end, segment_len, &score);
+
+        if (score == 0) {
+            idle_cnt += 1;
+            continue;
+        }
+        idle_cnt = 0;
+
+        dict_pos -= segment_len;
+        memcpy(dict + dict_pos, ctx->text + pos, segment_len);
+
+        for (size_t i = pos; i + DICT_DMER_LEN <= pos + segment_len; i++) {
+            if (ctx->ids[i] != -1)
+                ctx->freqs[ctx->ids[i]] = 0;
+        }
+    }
+
+    memmove(dict, dict + dict_pos, dict_cap - dict_pos);
+
+    return dict_cap - dict_pos;
+}
+
+int salz_dict_train(const uint8_t *samples, const size_t *sample_lens,
+    size_t samples_cnt, uint8_t *dict, size_t *dict_len)
+{
+    struct dict_ctx ctx;
+    size_t text_len = 0;
+    int ret = 0;
+
+    if (samples == NULL || sample_lens == NULL || dict == NULL) {
+        debug("NULL samples or dictionary buffer");
+        return -1;
+    }
+
+    for (size_t i = 0; i < samples_cnt; i++)
+        text_len += sample_lens[i];
+
+    if (text_len > SALZ_SEGMENT_LEN_MAX) {
+        debug("Too much samples (%zu bytes)", text_len);
+        return -1;
+    }
+
+    /* Samples fit as such, or there is no room for a single segment */
+    if (text_len <= *dict_len) {
+        memcpy(dict, samples, text_len);
+        *dict_len = text_len;
+        return 0;
+    }
+
+    if (*dict_len < DICT_SEGMENT_LEN) {
+        debug("Dictionary too short (%zu bytes)", *dict_len);
+        return -1;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.text = samples;
+    ctx.text_len = text_len;
+    ctx.sa = malloc(text_len * sizeof(*ctx.sa));
+    ctx.plcp = malloc(text_len * sizeof(*ctx.plcp));
+    ctx.ids = malloc(text_len * sizeof(*ctx.ids));
+    ctx.freqs = malloc(text_len * sizeof(*ctx.freqs));
+    ctx.counts = calloc(text_len, sizeof(*ctx.counts));
+    if (ctx.sa == NULL || ctx.plcp == NULL || ctx.ids == NULL ||
+        ctx.freqs == NULL || ctx.counts == NULL) {
+        debug("Couldn't allocate memory (%zu bytes)",
+              5 * text_len * sizeof(int32_t));
+        ret = -1;
+        goto out;
+    }
+
+    if (libsais(samples, ctx.sa, text_len, 0, NULL) < 0) {
+        debug("Couldn't build SA");
+        ret = -1;
+        goto out;
+    }
+
+    build_plcp_array(&ctx);
+
+    if (!count_dmers(&ctx, sample_lens, samples_cnt)) {
+        ret = -1;
+        goto out;
+    }
+
+    *dict_len = build_dict(&ctx, dict, *dict_len);
+    if (*dict_len == 0) {
+        debug("Samples have nothing in common");
+        ret = -1;
+    }
+
+out:
+    free(ctx.sa);
+    free(ctx.plcp);
+    free(ctx.ids);
+    free(ctx.freqs);
+    free(ctx.counts);
+
+    return ret;
+}
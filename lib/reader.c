@@ -0,0 +1,777 @@
+/*
+ * reader.c - Random access reader of SALZ files
+ *
+ * Copyright (c) 2021-2023 Aki Utoslahti. All rights reserved.
+ *
+ * This work is distributed under terms of the MIT license.
+ * See file LICENSE or a copy at <https://opensource.org/licenses/MIT>.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "common.h"
+#include "salz.h"
+
+#ifdef NDEBUG
+#   define debug(fmt, ...) do {} while(0)
+#else
+#   include <stdio.h>
+#   define debug(fmt, ...) \
+        do { \
+            fprintf(stderr, "(%s:%d) - " fmt "\n", \
+                    __func__, __LINE__, ## __VA_ARGS__); \
+        } while (0)
+#endif
+
+/* Segment located in SALZ file */
+struct segment {
+    /* Offset of plain segment in plain data */
+    uint64_t plain_off;
+    /* Offset of encoded segment in file */
+    uint64_t encoded_off;
+    /* Length of encoded segment (in bytes) */
+    uint32_t encoded_len;
+    /* Length of plain segment (in bytes) */
+    uint32_t plain_len;
+};
+
+/* Decoded segment kept in cache */
+struct cache_entry {
+    /* Index of segment */
+    size_t seg;
+    /* Decoded segment */
+    uint8_t *buf;
+    /* Readers copying from the entry, which can't be evicted meanwhile */
+    unsigned refs;
+    /* Segment is still being decoded */
+    bool loading;
+    /* Segment couldn't be decoded */
+    bool failed;
+
+    /* Neighbors in order of use, most recently used first */
+    struct cache_entry *prev;
+    struct cache_entry *next;
+};
+
+/* Buffers reused by a thread from one decoded segment to the next */
+struct scratch {
+    /* Encoded segment */
+    uint8_t *in;
+    size_t in_cap;
+    /* Head of range decoded before its first restart point */
+    uint8_t *head;
+    size_t head_cap;
+};
+
+struct salz_reader {
+    int fd;
+    /* Plain length of full segments */
+    uint32_t block_len;
+    /* Plain length of the whole file */
+    uint64_t file_len;
+    /* Encoded segments have restart points */
+    bool restarts;
+
+    /* Segments in order of their plain offsets */
+    struct segment *segs;
+    size_t segs_cnt;
+    size_t segs_cap;
+
+    /* Cache entry of each segment, or NULL if not cached */
+    struct cache_entry **cached;
+    /* Cache entries in order of use */
+    struct cache_entry *lru_head;
+    struct cache_entry *lru_tail;
+    /* Plain length of cached segments (in bytes) */
+    size_t cache_len;
+    size_t cache_cap;
+
+    /* Plain offset, where previous read ended */
+    uint64_t read_end;
+
+    struct salz_reader_stats stats;
+
+    /* Scratch of reading thread and of prefetching thread */
+    struct scratch reading;
+    struct scratch prefetched;
+
+    /* Prefetching thread and segment requested from it, or segs_cnt */
+    pthread_t prefetcher;
+    bool prefetching;
+    size_t prefetch_seg;
+    bool stop;
+
+    /* Lock protecting cache, statistics and prefetch request */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static const struct salz_reader_opts default_opts = {
+    .cache_len = SALZ_READER_CACHE_LEN_DEFAULT,
+    .prefetch = false,
+};
+
+static bool read_fully(int fd, uint8_t *buf, size_t len, uint64_t off)
+{
+    while (len > 0) {
+        ssize_t rc = pread(fd, buf, len, (off_t)off);
+
+        if (rc < 0 && errno == EINTR)
+            continue;
+
+        if (rc <= 0)
+            return false;
+
+        buf += rc;
+        len -= (size_t)rc;
+        off += (uint64_t)rc;
+    }
+
+    return true;
+}
+
+static bool add_segment(salz_reader *reader, uint64_t encoded_off,
+    uint32_t encoded_len, uint32_t plain_len, uint64_t *plain_off)
+{
+    struct segment *seg;
+
+    if (encoded_len > salz_encoded_len_max(reader->block_len) ||
+        plain_len > reader->block_len ||
+        plain_len > reader->file_len - *plain_off) {
+        debug("Malformed segment at offset %" PRIu64, encoded_off);
+        return false;
+    }
+
+    if (reader->segs_cnt == reader->segs_cap) {
+        size_t cap = reader->segs_cap ? 2 * reader->segs_cap : 64;
+        struct segment *tmp = realloc(reader->segs, cap * sizeof(*tmp));
+
+        if (tmp == NULL) {
+            debug("Couldn't allocate memory (%zu bytes)", cap * sizeof(*tmp));
+            return false;
+        }
+
+        reader->segs = tmp;
+        reader->segs_cap = cap;
+    }
+
+    seg = &reader->segs[reader->segs_cnt++];
+    seg->plain_off = *plain_off;
+    seg->encoded_off = encoded_off;
+    seg->encoded_len = encoded_len;
+    seg->plain_len = plain_len;
+
+    *plain_off += plain_len;
+
+    return true;
+}
+
+static bool load_seek_table(salz_reader *reader, uint64_t file_size)
+{
+    uint8_t footer[SALZ_SEEK_FOOTER_LEN];
+    uint8_t *table;
+    uint64_t entries_cnt;
+    uint64_t table_off;
+    uint64_t plain_off = 0;
+    uint32_t magic;
+    bool ok = true;
+
+    if (file_size < SALZ_FILE_HDR_LEN + SALZ_SEEK_FOOTER_LEN ||
+        !read_fully(reader->fd, footer, sizeof(footer),
+                    file_size - SALZ_SEEK_FOOTER_LEN)) {
+        debug("Couldn't read seek table footer");
+        return false;
+    }
+
+    memcpy(&entries_cnt, footer + 0, sizeof(entries_cnt));
+    memcpy(&magic, footer + 8, sizeof(magic));
+
+    if (magic != SALZ_SEEK_MAGIC || entries_cnt >
+        (file_size - SALZ_FILE_HDR_LEN - SALZ_SEEK_FOOTER_LEN) /
+        SALZ_SEEK_ENTRY_LEN) {
+        debug("Malformed seek table footer");
+        return false;
+    }
+
+    table_off = file_size - SALZ_SEEK_FOOTER_LEN -
+                entries_cnt * SALZ_SEEK_ENTRY_LEN;
+
+    if ((table = malloc(entries_cnt * SALZ_SEEK_ENTRY_LEN + 1)) == NULL) {
+        debug("Couldn't allocate memory (%" PRIu64 " bytes)",
+              entries_cnt * SALZ_SEEK_ENTRY_LEN);
+        return false;
+    }
+
+    if (!read_fully(reader->fd, table, entries_cnt * SALZ_SEEK_ENTRY_LEN,
+                    table_off)) {
+        debug("Couldn't read seek table");
+        free(table);
+        return false;
+    }
+
+    for (size_t i = 0; i < entries_cnt && ok; i++) {
+        const uint8_t *entry = table + i * SALZ_SEEK_ENTRY_LEN;
+        uint64_t encoded_off;
+        uint32_t encoded_len;
+        uint32_t plain_len;
+
+        memcpy(&encoded_off, entry + 0, sizeof(encoded_off));
+        memcpy(&encoded_len, entry + 8, sizeof(encoded_len));
+        memcpy(&plain_len, entry + 12, sizeof(plain_len));
+
+        /* Segments must lie between header and seek table */
+        if (encoded_off < SALZ_FILE_HDR_LEN + SALZ_FRAME_HDR_LEN ||
+            encoded_off > table_off || encoded_len > table_off - encoded_off) {
+            debug("Malformed seek table entry %zu", i);
+            ok = false;
+            break;
+        }
+
+        ok = add_segment(reader, encoded_off, encoded_len, plain_len,
+                         &plain_off);
+    }
+
+    free(table);
+
+    if (ok && plain_off != reader->file_len) {
+        debug("Seek table doesn't cover the whole file");
+        ok = false;
+    }
+
+    return ok;
+}
+
+static bool scan_frames(salz_reader *reader, uint64_t file_size)
+{
+    uint64_t pos = SALZ_FILE_HDR_LEN;
+    uint64_t plain_off = 0;
+
+    while (pos < file_size) {
+        uint8_t frame_hdr[SALZ_FRAME_HDR_LEN];
+        uint32_t encoded_len;
+        uint32_t plain_len;
+
+        if (!read_fully(reader->fd, frame_hdr, sizeof(frame_hdr), pos)) {
+            debug("Couldn't read frame header at offset %" PRIu64, pos);
+            return false;
+        }
+        memcpy(&encoded_len, frame_hdr + 0, sizeof(encoded_len));
+        memcpy(&plain_len, frame_hdr + 4, sizeof(plain_len));
+        pos += SALZ_FRAME_HDR_LEN;
+
+        if (encoded_len > file_size - pos) {
+            debug("Truncated segment at offset %" PRIu64, pos);
+            return false;
+        }
+
+        if (!add_segment(reader, pos, encoded_len, plain_len, &plain_off))
+            return false;
+
+        pos += encoded_len;
+    }
+
+    if (plain_off != reader->file_len) {
+        debug("Input is truncated (expected: %" PRIu64 ", have: %" PRIu64
+              " bytes)", reader->file_len, plain_off);
+        return false;
+    }
+
+    return true;
+}
+
+static void *prefetch_worker(void *arg);
+
+salz_reader *salz_reader_open_opts(int fd, const struct salz_reader_opts *opts)
+{
+    salz_reader *reader;
+    uint8_t hdr[SALZ_FILE_HDR_LEN];
+    uint32_t magic;
+    uint8_t flags;
+    struct stat st;
+    bool ok;
+
+    if (opts == NULL)
+        opts = &default_opts;
+
+    if (fstat(fd, &st) != 0) {
+        debug("Couldn't stat SALZ file (err: %d)", errno);
+        return NULL;
+    }
+
+    if ((uint64_t)st.st_size < SALZ_FILE_HDR_LEN ||
+        !read_fully(fd, hdr, sizeof(hdr), 0)) {
+        debug("Couldn't read SALZ header");
+        return NULL;
+    }
+
+    memcpy(&magic, hdr + 0, sizeof(magic));
+    flags = hdr[5];
+
+    if (magic != SALZ_FILE_MAGIC || hdr[4] != SALZ_FILE_VERSION ||
+        (flags & ~SALZ_FILE_FLAGS_KNOWN)) {
+        debug("Unsupported SALZ header");
+        return NULL;
+    }
+
+    /* Segment would have to be decoded after all segments preceding it */
+    if (flags & SALZ_FILE_FLAG_LOOKBACK) {
+        debug("Segments depend on preceding ones");
+        return NULL;
+    }
+
+    if ((reader = calloc(1, sizeof(*reader))) == NULL) {
+        debug("Couldn't allocate memory (%zu bytes)", sizeof(*reader));
+        return NULL;
+    }
+
+    reader->fd = fd;
+    reader->cache_cap = opts->cache_len;
+    pthread_mutex_init(&reader->lock, NULL);
+    pthread_cond_init(&reader->cond, NULL);
+    memcpy(&reader->block_len, hdr + 8, sizeof(reader->block_len));
+    memcpy(&reader->file_len, hdr + 16, sizeof(reader->file_len));
+    reader->restarts = flags & SALZ_FILE_FLAG_RESTARTS;
+
+    if (reader->block_len == 0 || reader->block_len > SALZ_SEGMENT_LEN_MAX) {
+        debug("Invalid block length (%u)", reader->block_len);
+        salz_reader_close(reader);
+        return NULL;
+    }
+
+    if (flags & SALZ_FILE_FLAG_SEEK_TABLE)
+        ok = load_seek_table(reader, (uint64_t)st.st_size);
+    else
+        ok = scan_frames(reader, (uint64_t)st.st_size);
+
+    if (ok) {
+        reader->prefetch_seg = reader->segs_cnt;
+        reader->cached = calloc(reader->segs_cnt + 1, sizeof(*reader->cached));
+        ok = reader->cached != NULL;
+        if (!ok)
+            debug("Couldn't allocate memory (%zu bytes)",
+                  reader->segs_cnt * sizeof(*reader->cached));
+    }
+
+    /* Prefetched segment would only push out the one being read */
+    if (ok && opts->prefetch && reader->cache_cap >= 2 * reader->block_len) {
+        reader->prefetching = pthread_create(&reader->prefetcher, NULL,
+                                             prefetch_worker, reader) == 0;
+        ok = reader->prefetching;
+        if (!ok)
+            debug("Couldn't start prefetching thread");
+    }
+
+    if (!ok) {
+        salz_reader_close(reader);
+        return NULL;
+    }
+
+    return reader;
+}
+
+salz_reader *salz_reader_open(int fd)
+{
+    return salz_reader_open_opts(fd, NULL);
+}
+
+void salz_reader_close(salz_reader *reader)
+{
+    struct cache_entry *entry;
+
+    if (reader == NULL)
+        return;
+
+    if (reader->prefetching) {
+        pthread_mutex_lock(&reader->lock);
+        reader->stop = true;
+        pthread_cond_broadcast(&reader->cond);
+        pthread_mutex_unlock(&reader->lock);
+        pthread_join(reader->prefetcher, NULL);
+    }
+
+    while ((entry = reader->lru_head) != NULL) {
+        reader->lru_head = entry->next;
+        free(entry->buf);
+        free(entry);
+    }
+
+    free(reader->reading.in);
+    free(reader->reading.head);
+    free(reader->prefetched.in);
+    free(reader->prefetched.head);
+
+    pthread_cond_destroy(&reader->cond);
+    pthread_mutex_destroy(&reader->lock);
+    free(reader->cached);
+    free(reader->segs);
+    free(reader);
+}
+
+uint64_t salz_reader_len(const salz_reader *reader)
+{
+    return reader->file_len;
+}
+
+void salz_reader_stats_get(salz_reader *reader, struct salz_reader_stats *res)
+{
+    pthread_mutex_lock(&reader->lock);
+    *res = reader->stats;
+    pthread_mutex_unlock(&reader->lock);
+}
+
+static bool reserve(uint8_t **buf, size_t *cap, size_t len)
+{
+    uint8_t *grown;
+
+    if (len <= *cap)
+        return true;
+
+    if ((grown = realloc(*buf, len)) == NULL) {
+        debug("Couldn't allocate memory (%zu bytes)", len);
+        return false;
+    }
+
+    *buf = grown;
+    *cap = len;
+
+    return true;
+}
+
+static bool decode_range(salz_reader *reader, size_t idx, size_t seg_pos,
+    uint8_t *dst, size_t len, bool prefetch)
+{
+    const struct segment *seg = &reader->segs[idx];
+    struct scratch *scratch = prefetch ? &reader->prefetched :
+                                         &reader->reading;
+    size_t dst_len = len;
+    size_t src_used;
+    size_t head_len;
+    int rc;
+
+    if (!reserve(&scratch->in, &scratch->in_cap, seg->encoded_len + 1))
+        return false;
+
+    if (!read_fully(reader->fd, scratch->in, seg->encoded_len,
+                    seg->encoded_off)) {
+        debug("Couldn't read segment %zu", idx);
+        return false;
+    }
+
+    /* Segment wanted as a whole needs no restart points */
+    if (len == seg->plain_len) {
+        rc = salz_decode_safe(scratch->in, seg->encoded_len, dst, &dst_len);
+    } else if (seg_pos == 0) {
+        rc = salz_decode_partial_safe(scratch->in, seg->encoded_len, dst,
+                                      &dst_len, &src_used);
+    } else {
+        head_len = salz_decode_range_buf_len(scratch->in, seg->encoded_len,
+                                             seg_pos, len);
+        if (!reserve(&scratch->head, &scratch->head_cap, head_len))
+            return false;
+
+        rc = salz_decode_range_buf_safe(scratch->in, seg->encoded_len,
+                                        seg_pos, dst, &dst_len, scratch->head,
+                                        scratch->head_cap);
+    }
+
+    if (rc != 0 || dst_len != len) {
+        debug("Couldn't decode segment %zu", idx);
+        return false;
+    }
+
+    return true;
+}
+
+static bool decode_segment(salz_reader *reader, size_t idx, uint8_t *dst,
+    bool prefetch)
+{
+    return decode_range(reader, idx, 0, dst, reader->segs[idx].plain_len,
+                        prefetch);
+}
+
+/*
+ * Cache functions below expect reader->lock to be held
+ */
+
+static void lru_unlink(salz_reader *reader, struct cache_entry *entry)
+{
+    if (entry->prev != NULL)
+        entry->prev->next = entry->next;
+    else
+        reader->lru_head = entry->next;
+
+    if (entry->next != NULL)
+        entry->next->prev = entry->prev;
+    else
+        reader->lru_tail = entry->prev;
+
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+static void lru_push(salz_reader *reader, struct cache_entry *entry)
+{
+    entry->next = reader->lru_head;
+    if (reader->lru_head != NULL)
+        reader->lru_head->prev = entry;
+    else
+        reader->lru_tail = entry;
+    reader->lru_head = entry;
+}
+
+static void cache_remove(salz_reader *reader, struct cache_entry *entry)
+{
+    lru_unlink(reader, entry);
+    reader->cached[entry->seg] = NULL;
+    reader->cache_len -= reader->segs[entry->seg].plain_len;
+    free(entry->buf);
+    free(entry);
+}
+
+static void cache_evict(salz_reader *reader)
+{
+    /* Least recently used entries go first, unless someone still uses them */
+    struct cache_entry *entry = reader->lru_tail;
+
+    while (entry != NULL && reader->cache_len > reader->cache_cap) {
+        struct cache_entry *prev = entry->prev;
+
+        if (entry->refs == 0)
+            cache_remove(reader, entry);
+
+        entry = prev;
+    }
+}
+
+static struct cache_entry *cache_get(salz_reader *reader, size_t idx,
+    bool *hit)
+{
+    struct cache_entry *entry = reader->cached[idx];
+
+    *hit = entry != NULL;
+
+    if (entry == NULL) {
+        if ((entry = calloc(1, sizeof(*entry))) == NULL ||
+            (entry->buf = malloc(reader->segs[idx].plain_len + 1)) == NULL) {
+            debug("Couldn't allocate memory (%u bytes)",
+                  reader->segs[idx].plain_len);
+            free(entry);
+            return NULL;
+        }
+
+        entry->seg = idx;
+        entry->loading = true;
+        reader->cached[idx] = entry;
+        reader->cache_len += reader->segs[idx].plain_len;
+    } else {
+        lru_unlink(reader, entry);
+    }
+
+    entry->refs++;
+    lru_push(reader, entry);
+    cache_evict(reader);
+
+    return entry;
+}
+
+static void cache_put(salz_reader *reader, struct cache_entry *entry)
+{
+    entry->refs--;
+
+    if (entry->failed && entry->refs == 0)
+        cache_remove(reader, entry);
+    else
+        cache_evict(reader);
+}
+
+static struct cache_entry *acquire_segment(salz_reader *reader, size_t idx,
+    bool prefetch)
+{
+    /*
+     * Segment is decoded without holding the lock, while others wanting the
+     * same segment wait for it to be ready.
+     */
+
+    struct cache_entry *entry;
+    bool hit;
+    bool ok;
+
+    pthread_mutex_lock(&reader->lock);
+
+    if ((entry = cache_get(reader, idx, &hit)) == NULL) {
+        pthread_mutex_unlock(&reader->lock);
+        return NULL;
+    }
+
+    if (prefetch)
+        reader->stats.prefetches += !hit;
+    else if (hit)
+        reader->stats.hits++;
+    else
+        reader->stats.misses++;
+
+    if (hit) {
+        while (entry->loading)
+            pthread_cond_wait(&reader->cond, &reader->lock);
+        pthread_mutex_unlock(&reader->lock);
+    } else {
+        pthread_mutex_unlock(&reader->lock);
+
+        ok = decode_segment(reader, idx, entry->buf, prefetch);
+
+        pthread_mutex_lock(&reader->lock);
+        entry->loading = false;
+        entry->failed = !ok;
+        pthread_cond_broadcast(&reader->cond);
+        pthread_mutex_unlock(&reader->lock);
+    }
+
+    if (entry->failed) {
+        pthread_mutex_lock(&reader->lock);
+        cache_put(reader, entry);
+        pthread_mutex_unlock(&reader->lock);
+        return NULL;
+    }
+
+    return entry;
+}
+
+static void release_segment(salz_reader *reader, struct cache_entry *entry)
+{
+    pthread_mutex_lock(&reader->lock);
+    cache_put(reader, entry);
+    pthread_mutex_unlock(&reader->lock);
+}
+
+static void *prefetch_worker(void *arg)
+{
+    salz_reader *reader = arg;
+
+    pthread_mutex_lock(&reader->lock);
+
+    for ( ;; ) {
+        struct cache_entry *entry;
+        size_t idx;
+
+        while (!reader->stop && reader->prefetch_seg == reader->segs_cnt)
+            pthread_cond_wait(&reader->cond, &reader->lock);
+
+        if (reader->stop)
+            break;
+
+        idx = reader->prefetch_seg;
+        reader->prefetch_seg = reader->segs_cnt;
+
+        if (reader->cached[idx] != NULL)
+            continue;
+
+        pthread_mutex_unlock(&reader->lock);
+
+        if ((entry = acquire_segment(reader, idx, true)) != NULL)
+            release_segment(reader, entry);
+
+        pthread_mutex_lock(&reader->lock);
+    }
+
+    pthread_mutex_unlock(&reader->lock);
+
+    return NULL;
+}
+
+static size_t find_segment(const salz_reader *reader, uint64_t offs)
+{
+    /* Last segment beginning at or before offset */
+    size_t lo = 0;
+    size_t hi = reader->segs_cnt;
+
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (reader->segs[mid].plain_off <= offs)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+int salz_reader_pread(salz_reader *reader, uint8_t *dst, size_t *dst_len,
+    uint64_t offs)
+{
+    size_t len;
+    size_t done = 0;
+    size_t idx;
+
+    if (reader == NULL || dst == NULL) {
+        debug("NULL reader or output buffer");
+        return -1;
+    }
+
+    if (offs >= reader->file_len) {
+        *dst_len = 0;
+        return 0;
+    }
+
+    len = min(*dst_len, reader->file_len - offs);
+
+    for (idx = find_segment(reader, offs); done < len; idx++) {
+        const struct segment *seg = &reader->segs[idx];
+        struct cache_entry *entry;
+        size_t seg_pos = offs + done - seg->plain_off;
+        size_t n = min(seg->plain_len - seg_pos, len - done);
+        bool direct;
+
+        /*
+         * Segments wanted as a whole are decoded straight into place. So are
+         * parts read out of sequence, which are unlikely to be read on, if
+         * they begin a segment or segment has restart points.
+         */
+        pthread_mutex_lock(&reader->lock);
+        direct = reader->cached[idx] == NULL &&
+                 (n == seg->plain_len ||
+                  ((reader->restarts || seg_pos == 0) &&
+                   offs != reader->read_end));
+        reader->stats.misses += direct;
+        pthread_mutex_unlock(&reader->lock);
+
+        if (direct) {
+            if (!decode_range(reader, idx, seg_pos, dst + done, n, false))
+                return -1;
+            done += n;
+            continue;
+        }
+
+        if ((entry = acquire_segment(reader, idx, false)) == NULL)
+            return -1;
+
+        memcpy(dst + done, entry->buf + seg_pos, n);
+        done += n;
+
+        release_segment(reader, entry);
+    }
+
+    /* Reading on from where previous read ended asks for next segment */
+    pthread_mutex_lock(&reader->lock);
+    if (reader->prefetching && offs == reader->read_end &&
+        idx < reader->segs_cnt && reader->cached[idx] == NULL) {
+        reader->prefetch_seg = idx;
+        pthread_cond_broadcast(&reader->cond);
+    }
+    reader->read_end = offs + done;
+    pthread_mutex_unlock(&reader->lock);
+
+    *dst_len = done;
+
+    return 0;
+}
@@ -20,6 +20,7 @@
  */
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -41,21 +42,64 @@
         } while (0)
 #endif
 
-#ifdef __GNUC__
-#   define salz_memcpy(dst, src, n) __builtin_memcpy(dst, src, n)
-#else
-#   define salz_memcpy(dst, src, n) memcpy(dst, src, n)
-#endif
-
 enum salz_stream_type {
     SALZ_STREAM_TYPE_PLAIN = 0,
     SALZ_STREAM_TYPE_SALZ,
+    SALZ_STREAM_TYPE_SALZ_RESTART,
     SALZ_STREAM_TYPE_MAX,
 };
 
+/*
+ * Stream header is a 32-bit word holding stream type in its top byte and
+ * stream length in its lower 24 bits. Streams whose length doesn't fit in
+ * 24 bits set SALZ_STREAM_FLAG_LONG in the type byte and are followed by
+ * another 32-bit word holding the upper 32 bits of their length.
+ */
+#define SALZ_STREAM_FLAG_LONG (0x80u)
+
+#define SALZ_STREAM_HDR_LEN      (4)
+#define SALZ_STREAM_HDR_LEN_LONG (8)
+#define SALZ_STREAM_LEN_MASK     (0xffffffu)
+
+/*
+ * Stream with restart points begins with a restart table, which holds length
+ * of plain segment (u32), distance between restart points (u32) and offset
+ * into rest of the stream of each restart point (u32). Restart points lie at
+ * multiples of the distance short of the last 8 bytes of segment. No factor
+ * crosses a restart point or refers to data before it, and buffered bitfield
+ * is left unfilled at each of them, so that decoding may begin there.
+ */
+#define SALZ_RESTART_HDR_LEN (8)
+
 #define SALZ_TOKEN_TYPE_LITERAL (0)
 #define SALZ_TOKEN_TYPE_FACTOR  (1)
 
+/* Encoder workspace, which may be reused between segments */
+struct salz_workspace {
+    /* Suffix array */
+    int32_t *sa;
+    /* Capacity of suffix array (in elements) */
+    size_t sa_cap;
+    /* Auxiliary array */
+    int32_t *aux;
+    /* Capacity of auxiliary array (in elements) */
+    size_t aux_cap;
+};
+
+/* Prepared dictionary */
+struct salz_dict {
+    /* Dictionary, followed by space for a segment */
+    uint8_t *buf;
+    /* Capacity of buffer (in bytes) */
+    size_t buf_cap;
+    /* Length of dictionary (in bytes) */
+    size_t dict_len;
+    /* Suffix array of dictionary */
+    int32_t *sa;
+    /* Workspace for encoding segments with dictionary */
+    struct salz_workspace ws;
+};
+
 /* SALZ I/O context */
 struct salz_io_ctx {
     /* Common members */
@@ -67,6 +111,13 @@ struct salz_io_ctx {
     /* Current position in input buffer */
     size_t src_pos;
 
+    /*
+     * Length of history preceding the segment (in bytes). History lives at
+     * the beginning of input buffer when encoding and at the beginning of
+     * output buffer when decoding.
+     */
+    size_t prefix_len;
+
     /* Output buffer */
     uint8_t *dst;
     /* Length of output buffer (in bytes) */
@@ -79,12 +130,48 @@ struct salz_io_ctx {
     /* Bits currently available for writing in buffered bitfield */
     size_t bits_avail;
 
+    /* Distance between restart points (in bytes), or 0 without them */
+    size_t restart_len;
+    /* Number of restart points following beginning of segment */
+    size_t restarts_cnt;
+    /* Index of next restart point in restart table */
+    size_t restart_idx;
+    /* Position of next restart point, or SIZE_MAX past the last one */
+    size_t restart_next;
+
     /* Context-bound members */
     union {
         /* Encoding-only members */
         struct {
             /* Output buffer position reserved for current buffered bitfield */
             size_t bits_pos;
+            /* Length of stream header reserved at beginning of output */
+            size_t hdr_len;
+            /* Length of restart table following stream header */
+            size_t restarts_len;
+
+            /*
+             * Position in input buffer, where suffix array begins. History
+             * not covered by suffix array is only reached through a
+             * dictionary.
+             */
+            size_t sa_base;
+            /* Workspace owned by context, unless one is borrowed */
+            struct salz_workspace own_ws;
+            /* Outcome isn't counted, as encoding may still be discarded */
+            bool uncounted;
+            /* Matcher and parser settings of effort of encoding */
+            const struct effort_params *params;
+            /* Callback called as each phase of encoding begins, or NULL */
+            void (*phase_cb)(enum salz_phase phase, void *arg);
+            /* Argument passed to phase callback */
+            void *phase_arg;
+            /* Statistics collected while encoding, or NULL */
+            struct salz_stats *stats;
+            /* Phase of encoding being timed for statistics */
+            enum salz_phase phase;
+            /* Time current phase began at (in ns) */
+            uint64_t phase_begin_ns;
 
             /* Suffix array */
             int32_t *sa;
@@ -109,44 +196,62 @@ struct salz_io_ctx {
         struct {
             /* Type of SALZ encoded stream */
             uint8_t stream_type;
+            /* Offsets of restart points in restart table */
+            const uint8_t *restarts;
+            /* Length of plain segment recorded in restart table */
+            size_t plain_len;
+            /* Decoding stops once output buffer is full */
+            bool partial;
+            /* Stream continues past end of input buffer */
+            bool truncated;
+            /* Position of next restart point or end of output buffer */
+            size_t dst_mark;
         };
     };
 };
 
 typedef struct salz_io_ctx salz_io_ctx;
 
-/*******************
- * Raw I/O functions
- *******************/
-
-static void write_u32_raw(uint8_t *buf, size_t pos, uint32_t val)
-{
-    salz_memcpy(&buf[pos], &val, sizeof(val));
-}
-
-static void write_u64_raw(uint8_t *buf, size_t pos, uint64_t val)
-{
-    salz_memcpy(&buf[pos], &val, sizeof(val));
-}
+#include "bitio.h"
 
-static uint64_t read_u32_raw(const uint8_t *buf, size_t pos)
-{
-    uint32_t val;
+/* Matcher and parser settings of an effort of encoding */
+struct effort_params {
+    /* Only the longer of PSV and NSV candidates is weighed by optimal parse */
+    bool longer_only;
+    /* Depth of hash chains matched in small segments */
+    uint8_t chain_depth;
+    /* Shorter lengths of each factor weighed by optimal parse */
+    uint16_t trunc_len;
+};
 
-    salz_memcpy(&val, &buf[pos], sizeof(val));
+static const struct effort_params efforts[] = {
+    [1] = { .longer_only = true, .chain_depth = 1, .trunc_len = 0 },
+    [2] = { .longer_only = true, .chain_depth = 2, .trunc_len = 0 },
+    [3] = { .longer_only = false, .chain_depth = 2, .trunc_len = 0 },
+    [4] = { .longer_only = false, .chain_depth = 3, .trunc_len = 0 },
+    [5] = { .longer_only = false, .chain_depth = 4, .trunc_len = 0 },
+    [6] = { .longer_only = false, .chain_depth = 8, .trunc_len = 4 },
+    [7] = { .longer_only = false, .chain_depth = 8, .trunc_len = 8 },
+    [8] = { .longer_only = false, .chain_depth = 16, .trunc_len = 16 },
+    [9] = { .longer_only = false, .chain_depth = 32, .trunc_len = 32 },
+};
+static_assert(sizeof(efforts) / sizeof(*efforts) == SALZ_EFFORT_MAX + 1);
 
-    return val;
-}
+/* Counters of encoding outcomes shared by all threads */
+static struct salz_counters counters;
 
-static uint64_t read_u64_raw(const uint8_t *buf, size_t pos)
+static void count(uint64_t *counter)
 {
-    uint64_t val;
-
-    salz_memcpy(&val, &buf[pos], sizeof(val));
-
-    return val;
+    __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
 }
 
+/* Without SALZ_STATS, code collecting statistics is optimized out */
+#ifdef SALZ_STATS
+#   define stats_requested(stats) ((stats) != NULL)
+#else
+#   define stats_requested(stats) false
+#endif
+
 /******************************
  * Common I/O context functions
  ******************************/
@@ -168,24 +273,59 @@ static bool cpy_literal(salz_io_ctx *ctx)
     return true;
 }
 
+static void next_restart(salz_io_ctx *ctx)
+{
+    ctx->restart_idx += 1;
+    if (ctx->restart_idx < ctx->restarts_cnt)
+        ctx->restart_next += ctx->restart_len;
+    else
+        ctx->restart_next = SIZE_MAX;
+}
+
 /*************************************
  * Encoding-only I/O context functions
  *************************************/
 
-static salz_io_ctx *encode_ctx_create(const uint8_t *src, size_t src_len,
-    uint8_t *dst, size_t dst_len)
+static void workspace_release(struct salz_workspace *ws)
 {
-    salz_io_ctx *ctx = NULL;
-    int32_t *sa = NULL;
-    size_t sa_len;
-    int32_t *aux = NULL;
-    size_t aux_len;
+    free(ws->sa);
+    free(ws->aux);
+    memset(ws, 0, sizeof(*ws));
+}
 
-    ctx = malloc(sizeof(*ctx));
-    if (ctx == NULL) {
-        debug("Couldn't allocate memory (%zu bytes)", sizeof(*ctx));
-        return NULL;
+static bool workspace_reserve(struct salz_workspace *ws, size_t sa_len,
+    size_t aux_len)
+{
+    if (sa_len > ws->sa_cap) {
+        free(ws->sa);
+        ws->sa_cap = 0;
+        ws->sa = malloc(sa_len * sizeof(*ws->sa));
+        if (ws->sa == NULL) {
+            debug("Couldn't allocate memory (%zu bytes)",
+                  sa_len * sizeof(*ws->sa));
+            return false;
+        }
+        ws->sa_cap = sa_len;
+    }
+
+    if (aux_len > ws->aux_cap) {
+        free(ws->aux);
+        ws->aux_cap = 0;
+        ws->aux = malloc(aux_len * sizeof(*ws->aux));
+        if (ws->aux == NULL) {
+            debug("Couldn't allocate memory (%zu bytes)",
+                  aux_len * sizeof(*ws->aux));
+            return false;
+        }
+        ws->aux_cap = aux_len;
     }
+
+    return true;
+}
+
+static bool encode_ctx_init(salz_io_ctx *ctx, const uint8_t *src,
+    size_t prefix_len, size_t src_len, uint8_t *dst, size_t dst_len)
+{
     memset(ctx, 0, sizeof(*ctx));
 
     /*
@@ -194,266 +334,124 @@ static salz_io_ctx *encode_ctx_create(const uint8_t *src, size_t src_len,
      * This must be taken into account when finalizing the encoding, where
      * these bytes can be simply encoded as literals.
      */
+    assert(src_len > 8);
     src_len -= 8;
 
-    sa_len = src_len + 2;
-    sa = calloc(sa_len, sizeof(*sa));
-    if (sa == NULL) {
-        debug("Couldn't allocate memory (%zu bytes)", sa_len * sizeof(*sa));
-        goto fail;
-    }
-
-    aux_len = 4 * (src_len + 1);
-    aux = calloc(aux_len, sizeof(*aux));
-    if (sa == NULL) {
-        debug("Couldn't allocate memory (%zu bytes)", aux_len * sizeof(*aux));
-        goto fail;
-    }
+    /* Auxiliary array spans over history as well */
+    src_len += prefix_len;
 
     ctx->src = src;
     ctx->src_len = src_len;
-    ctx->src_pos = 0;
+    ctx->src_pos = prefix_len;
+    ctx->prefix_len = prefix_len;
+
+    /* Plain fallback must be representable in stream header as well */
+    ctx->hdr_len = src_len - prefix_len + 8 > SALZ_STREAM_LEN_MASK ?
+                   SALZ_STREAM_HDR_LEN_LONG : SALZ_STREAM_HDR_LEN;
 
     ctx->dst = dst;
     ctx->dst_len = dst_len;
-    if (dst_len < 4) {
+    if (dst_len < ctx->hdr_len) {
         debug("Couldn't reserve space for stream header");
-        goto fail;
+        return false;
     }
-    ctx->dst_pos = 4;
+    ctx->dst_pos = ctx->hdr_len;
 
     ctx->bits = 0;
     ctx->bits_avail = 0;
     ctx->bits_pos = 0;
 
-    ctx->sa = sa;
-    ctx->sa_len = sa_len;
-    ctx->aux = aux;
-    ctx->aux_len = aux_len;
-
     ctx->prev_psv = -1;
     ctx->prev_psv_len = 0;
     ctx->prev_nsv = -1;
     ctx->prev_nsv_len = 0;
 
-    return ctx;
-
-fail:
-    free(sa);
-    free(aux);
-    free(ctx);
-
-    return NULL;
-}
-
-static void encode_ctx_destroy(salz_io_ctx *ctx)
-{
-    if (ctx != NULL) {
-        free(ctx->sa);
-        free(ctx->aux);
-        free(ctx);
-    }
-}
-
-static bool write_u8(salz_io_ctx *ctx, uint8_t val)
-{
-    if (unlikely(ctx->dst_pos >= ctx->dst_len))
-        return false;
-
-    ctx->dst[ctx->dst_pos++] = val;
-
-    return true;
-}
-
-static bool flush_bits(salz_io_ctx *ctx)
-{
-    static_assert(sizeof(ctx->bits) == 8);
-
-    write_u64_raw(ctx->dst, ctx->bits_pos, ctx->bits);
-
-    if (unlikely(ctx->dst_pos + 8 > ctx->dst_len))
-        return false;
-
-    ctx->bits = 0;
-    ctx->bits_avail = 64;
-    ctx->bits_pos = ctx->dst_pos;
-    ctx->dst_pos += 8;
-
-    return true;
-}
-
-static bool write_bit(salz_io_ctx *ctx, uint8_t val)
-{
-    if (ctx->bits_avail == 0 && unlikely(!flush_bits(ctx)))
-        return false;
-
-    ctx->bits = (ctx->bits << 1) | (val & 1);
-    ctx->bits_avail -= 1;
+    ctx->restart_next = SIZE_MAX;
+    ctx->params = &efforts[SALZ_EFFORT_DEFAULT];
 
     return true;
 }
 
-static bool write_bits(salz_io_ctx *ctx, uint64_t bits, size_t count)
+static void enter_phase(salz_io_ctx *ctx, enum salz_phase phase)
 {
-    if (ctx->bits_avail == 0 && unlikely(!flush_bits(ctx)))
-        return false;
+    if (stats_requested(ctx->stats)) {
+        uint64_t now_ns = 0;
 
-    if (count > ctx->bits_avail) {
-        ctx->bits = (ctx->bits << ctx->bits_avail) |
-                    ((bits >> (count - ctx->bits_avail)) &
-                     ((1u << ctx->bits_avail) - 1));
-        count -= ctx->bits_avail;
+        get_time_ns(&now_ns);
+        if (ctx->phase != SALZ_PHASE_DONE)
+            ctx->stats->phase_ns[ctx->phase] += now_ns - ctx->phase_begin_ns;
 
-        if (unlikely(!flush_bits(ctx)))
-            return false;
+        ctx->phase = phase;
+        ctx->phase_begin_ns = now_ns;
     }
 
-    ctx->bits = (ctx->bits << count) | (bits & ((1u << count) - 1));
-    ctx->bits_avail -= count;
-
-    return true;
+    if (ctx->phase_cb != NULL)
+        ctx->phase_cb(phase, ctx->phase_arg);
 }
 
-static bool write_zeros(salz_io_ctx *ctx, size_t count)
+static bool encode_ctx_opts(salz_io_ctx *ctx,
+    const struct salz_encode_opts *opts)
 {
-    while (count) {
-        if (ctx->bits_avail == 0 && unlikely(!flush_bits(ctx)))
-            return false;
+    size_t restart_len = opts->restart_len;
 
-        size_t write_count = min(ctx->bits_avail, count);
-        ctx->bits <<= write_count;
-        ctx->bits_avail -= write_count;
-        count -= write_count;
-    }
-
-    return true;
-}
+    ctx->phase_cb = opts->phase_cb;
+    ctx->phase_arg = opts->phase_arg;
+    ctx->stats = opts->stats;
+    ctx->phase = SALZ_PHASE_DONE;
+    if (opts->effort)
+        ctx->params = &efforts[opts->effort];
 
-static bool write_unary(salz_io_ctx *ctx, uint32_t val)
-{
-    if (unlikely(!write_zeros(ctx, val)))
-        return false;
-    if (unlikely(!write_bit(ctx, 1)))
-        return false;
+    if (restart_len == 0)
+        return true;
 
-    return true;
-}
+    /* Restart points stay short of the last 8 bytes */
+    ctx->restart_len = restart_len;
+    ctx->restarts_cnt = (ctx->src_len - ctx->prefix_len - 1) / restart_len;
+    ctx->restart_idx = 0;
+    ctx->restart_next = ctx->restarts_cnt ? ctx->prefix_len + restart_len :
+                        SIZE_MAX;
 
-static bool write_gr3(salz_io_ctx *ctx, uint32_t val)
-{
-    if (unlikely(!write_unary(ctx, val >> 3)))
-        return false;
-    if (unlikely(!write_bits(ctx, val & 0x7u, 3)))
+    ctx->restarts_len = SALZ_RESTART_HDR_LEN + 4 * ctx->restarts_cnt;
+    if (ctx->dst_len < ctx->hdr_len + ctx->restarts_len) {
+        debug("Couldn't reserve space for restart table");
         return false;
+    }
+    ctx->dst_pos = ctx->hdr_len + ctx->restarts_len;
 
     return true;
 }
 
-size_t encode_vnibble_le(uint32_t val, uint64_t *res)
+static bool encode_ctx_reserve(salz_io_ctx *ctx, struct salz_workspace *ws,
+    size_t sa_base)
 {
-    uint8_t *p = (uint8_t *)res;
-
-    uint32_t v0 = val;
-
-    if (val < 8) {
-        p[0] = v0 | 0x8u;
-        return 1;
-    }
-
-    if (val < 72) {
-        p[0] = (((v0 >> 3) - 1) << 4) | ((v0 & 0x7u) | 0x8u);
-        return 2;
-    }
-
-    uint32_t v1 = val - 72;
-
-    if (val < 584) {
-        p[0] = ((((v0 >> 3) - 1) & 0x7u) << 4) | ((v0 & 0x7u) | 0x8u);
-        p[1] = v1 >> 6;
-        return 3;
-    }
-
-    if (val < 4680) {
-        p[0] = ((((v0 >> 3) - 1) & 0x7u) << 4) | ((v0 & 0x7u) | 0x8u);
-        p[1] = (((v1 >> 9) - 1) << 4) | ((v1 >> 6) & 0x7u);
-        return 4;
-    }
-
-    uint32_t v2 = val - 4680;
-
-    if (val < 37448) {
-        p[0] = ((((v0 >> 3) - 1) & 0x7u) << 4) | ((v0 & 0x7u) | 0x8u);
-        p[1] = ((((v1 >> 9) - 1) & 0x7u) << 4) | ((v1 >> 6) & 0x7u);
-        p[2] = v2 >> 12;
-        return 5;
-    }
-
-    if (val < 299592) {
-        p[0] = ((((v0 >> 3) - 1) & 0x7u) << 4) | ((v0 & 0x7u) | 0x8u);
-        p[1] = ((((v1 >> 9) - 1) & 0x7u) << 4) | ((v1 >> 6) & 0x7u);
-        p[2] = (((v2 >> 15) - 1) << 4) | ((v2 >> 12) & 0x7u);
-        return 6;
-    }
-
-    uint32_t v3 = val - 299592;
-
-    if (val < 2396744) {
-        p[0] = ((((v0 >> 3) - 1) & 0x7u) << 4) | ((v0 & 0x7u) | 0x8u);
-        p[1] = ((((v1 >> 9) - 1) & 0x7u) << 4) | ((v1 >> 6) & 0x7u);
-        p[2] = ((((v2 >> 15) - 1) & 0x7u) << 4) | ((v2 >> 12) & 0x7u);
-        p[3] = v3 >> 18;
-        return 7;
-    }
+    assert(sa_base <= ctx->prefix_len);
 
-    if (val < 19173960) {
-        p[0] = ((((v0 >> 3) - 1) & 0x7u) << 4) | ((v0 & 0x7u) | 0x8u);
-        p[1] = ((((v1 >> 9) - 1) & 0x7u) << 4) | ((v1 >> 6) & 0x7u);
-        p[2] = ((((v2 >> 15) - 1) & 0x7u) << 4) | ((v2 >> 12) & 0x7u);
-        p[3] = (((v3 >> 21) - 1) << 4) | ((v3 >> 18) & 0x7u);
-        return 8;
-    }
+    if (ws == NULL)
+        ws = &ctx->own_ws;
 
-    uint32_t v4 = val - 19173960;
+    ctx->sa_base = sa_base;
+    ctx->sa_len = ctx->src_len - sa_base + 2;
+    ctx->aux_len = 4 * (ctx->src_len + 1);
+    if (!workspace_reserve(ws, ctx->sa_len, ctx->aux_len))
+        return false;
 
-    if (val < 153391688) {
-        p[0] = ((((v0 >> 3) - 1) & 0x7u) << 4) | ((v0 & 0x7u) | 0x8u);
-        p[1] = ((((v1 >> 9) - 1) & 0x7u) << 4) | ((v1 >> 6) & 0x7u);
-        p[2] = ((((v2 >> 15) - 1) & 0x7u) << 4) | ((v2 >> 12) & 0x7u);
-        p[3] = ((((v3 >> 21) - 1) & 0x7u) << 4) | ((v3 >> 18) & 0x7u);
-        p[4] = v4 >> 24;
-        return 9;
-    }
+    if (stats_requested(ctx->stats)) {
+        uint64_t workspace_len = ctx->sa_len * sizeof(*ctx->sa) +
+                                 ctx->aux_len * sizeof(*ctx->aux);
 
-    if (val < 1227133512) {
-        p[0] = ((((v0 >> 3) - 1) & 0x7u) << 4) | ((v0 & 0x7u) | 0x8u);
-        p[1] = ((((v1 >> 9) - 1) & 0x7u) << 4) | ((v1 >> 6) & 0x7u);
-        p[2] = ((((v2 >> 15) - 1) & 0x7u) << 4) | ((v2 >> 12) & 0x7u);
-        p[3] = ((((v3 >> 21) - 1) & 0x7u) << 4) | ((v3 >> 18) & 0x7u);
-        p[4] = (((v4 >> 27) - 1) << 4) | ((v4 >> 24) & 0x7u);
-        return 10;
+        ctx->stats->workspace_len = max(ctx->stats->workspace_len,
+                                        workspace_len);
     }
 
-    uint32_t v5 = val - 1227133512;
+    ctx->sa = ws->sa;
+    ctx->aux = ws->aux;
 
-    p[0] = ((((v0 >> 3) - 1) & 0x7u) << 4) | ((v0 & 0x7u) | 0x8u);
-    p[1] = ((((v1 >> 9) - 1) & 0x7u) << 4) | ((v1 >> 6) & 0x7u);
-    p[2] = ((((v2 >> 15) - 1) & 0x7u) << 4) | ((v2 >> 12) & 0x7u);
-    p[3] = ((((v3 >> 21) - 1) & 0x7u) << 4) | ((v3 >> 18) & 0x7u);
-    p[4] = ((((v4 >> 27) - 1) & 0x7u) << 4) | ((v4 >> 24) & 0x7u);
-    p[5] = v5 >> 30;
-    return 11;
+    return true;
 }
 
-static bool write_vnibble(salz_io_ctx *ctx, uint32_t val)
+static void encode_ctx_fini(salz_io_ctx *ctx)
 {
-    uint64_t nibbles;
-
-    size_t nibbles_len = encode_vnibble_le(val, &nibbles);
-
-    if (unlikely(!write_bits(ctx, nibbles, nibbles_len * 4)))
-        return false;
-
-    return true;
+    workspace_release(&ctx->own_ws);
 }
 
 /********************
@@ -462,7 +460,9 @@ static bool write_vnibble(salz_io_ctx *ctx, uint32_t val)
 
 static bool build_suffix_array(salz_io_ctx *ctx)
 {
-    if (libsais(ctx->src, ctx->sa + 1, ctx->src_len, 0, NULL) < 0)
+    size_t base = ctx->sa_base;
+
+    if (libsais(ctx->src + base, ctx->sa + 1, ctx->src_len - base, 0, NULL) < 0)
         return false;
 
     return true;
@@ -472,9 +472,10 @@ static void build_psvnsv_array(salz_io_ctx *ctx)
 {
     /* PSV/NSV array construction from Suffix Array as described in [2] */
 
+    /* Positions are relative to beginning of suffix array */
     int32_t *sa = ctx->sa;
-    int32_t *aux = ctx->aux;
-    size_t len = ctx->src_len;
+    int32_t *aux = ctx->aux + 4 * ctx->sa_base;
+    size_t len = ctx->src_len - ctx->sa_base;
 
     sa[0] = -1;
     sa[len + 1] = -1;
@@ -542,14 +543,27 @@ static void factorize(salz_io_ctx *ctx)
     /* Factorization of all text positions as described in Section 3.4 of [1] */
 
     int32_t *aux = ctx->aux;
+    size_t pos = ctx->prefix_len;
 
-    /* Skip factorization of first position and force it to be a literal */
-    aux[1 + 4 * 0] = 1;
-    aux[3 + 4 * 0] = 1;
-    for (size_t pos = 1; pos < ctx->src_len; pos++) {
+    /*
+     * Positions of history are never encoded. Without history, skip
+     * factorization of first position and force it to be a literal.
+     */
+    if (pos == 0) {
+        aux[1 + 4 * 0] = 1;
+        aux[3 + 4 * 0] = 1;
+        pos = 1;
+    }
+
+    for ( ; pos < ctx->src_len; pos++) {
         int32_t psv = aux[0 + 4 * pos];
         int32_t nsv = aux[1 + 4 * pos];
 
+        if (psv != -1)
+            psv += (int32_t)ctx->sa_base;
+        if (nsv != -1)
+            nsv += (int32_t)ctx->sa_base;
+
         factorize_pos(ctx, pos, psv, nsv);
 
         aux[0 + 4 * pos] = (int32_t)(pos - ctx->prev_psv);
@@ -562,6 +576,128 @@ static void factorize(salz_io_ctx *ctx)
 #define FACTOR_OFFSET_MIN 1
 #define FACTOR_LENGTH_MIN 3
 
+/* Bits of hash of hash matcher */
+#define SMALL_HASH_BITS   10
+#define SMALL_POS_NONE    UINT16_MAX
+/* Length of hash matcher match, which is reused at next position */
+#define SMALL_MATCH_REUSE_LEN 32
+
+static uint32_t small_hash(salz_io_ctx *ctx, size_t pos)
+{
+    /* Hash of 3 bytes, which is the shortest factor */
+    uint32_t val = (uint32_t)read_u32_raw(ctx->src, pos) & 0xffffffu;
+
+    return (val * 2654435761u) >> (32 - SMALL_HASH_BITS);
+}
+
+static void factorize_small(salz_io_ctx *ctx)
+{
+    /*
+     * Factorization of small segments with a hash chain matcher, which
+     * needs no suffix array. Auxiliary array is filled in the same way as by
+     * factorize(), with nearest match as first candidate and longest match
+     * as second one.
+     */
+
+    int32_t *aux = ctx->aux;
+    uint16_t head[1 << SMALL_HASH_BITS];
+    uint16_t chain[SALZ_SMALL_SEGMENT_LEN_MAX];
+    size_t near_offs = 0;
+    size_t near_len = 0;
+    size_t best_offs = 0;
+    size_t best_len = 0;
+    size_t prev_near_offs;
+    size_t prev_near_len;
+    size_t prev_best_offs;
+    size_t prev_best_len;
+
+    static_assert(SALZ_SMALL_SEGMENT_LEN_MAX < SMALL_POS_NONE);
+    /* Small segments are too short to have restart points */
+    static_assert(SALZ_SMALL_SEGMENT_LEN_MAX < SALZ_RESTART_LEN_MIN);
+    assert(ctx->src_len <= SALZ_SMALL_SEGMENT_LEN_MAX);
+
+    memset(head, 0xff, sizeof(head));
+
+    /* Without history, first position is a forced literal */
+    aux[1 + 4 * 0] = 1;
+    aux[3 + 4 * 0] = 1;
+
+    for (size_t pos = 0; pos < ctx->src_len; pos++) {
+        uint32_t hash = small_hash(ctx, pos);
+        uint16_t cand = head[hash];
+
+        chain[pos] = cand;
+        head[hash] = (uint16_t)pos;
+
+        /* Positions of history are never encoded */
+        if (pos < ctx->prefix_len || pos == 0)
+            continue;
+
+        /*
+         * Long match continues at next position, which is rarely beaten by
+         * searching again. This keeps matching linear in long repetitions.
+         */
+        if (best_len > SMALL_MATCH_REUSE_LEN) {
+            best_len -= 1;
+            if (near_len > FACTOR_LENGTH_MIN) {
+                near_len -= 1;
+            } else {
+                near_offs = best_offs;
+                near_len = best_len;
+            }
+            goto store;
+        }
+
+        prev_near_offs = near_offs;
+        prev_near_len = near_len;
+        prev_best_offs = best_offs;
+        prev_best_len = best_len;
+        near_offs = 0;
+        near_len = 0;
+        best_offs = 0;
+        best_len = 0;
+
+        for (size_t depth = 0; depth < ctx->params->chain_depth &&
+             cand != SMALL_POS_NONE; depth++, cand = chain[cand]) {
+            size_t offs = pos - cand;
+            size_t common_len = 0;
+            size_t len;
+
+            /* Once nearest match is known, only longer ones are of interest */
+            if (near_len && (pos + best_len >= ctx->src_len ||
+                ctx->src[cand + best_len] != ctx->src[pos + best_len]))
+                continue;
+
+            /* Match at previous position is known to continue but one byte */
+            if (offs == prev_best_offs && prev_best_len)
+                common_len = prev_best_len - 1;
+            else if (offs == prev_near_offs && prev_near_len)
+                common_len = prev_near_len - 1;
+
+            len = lcp_cmp(ctx, common_len, cand, pos);
+            if (len < FACTOR_LENGTH_MIN)
+                continue;
+
+            if (near_len == 0) {
+                near_offs = offs;
+                near_len = len;
+            }
+
+            if (len > best_len) {
+                best_offs = offs;
+                best_len = len;
+            }
+        }
+
+store:
+        /* Longest match isn't weighed twice, when it is the nearest one */
+        aux[0 + 4 * pos] = (int32_t)near_offs;
+        aux[1 + 4 * pos] = (int32_t)near_len;
+        aux[2 + 4 * pos] = (int32_t)best_offs;
+        aux[3 + 4 * pos] = best_offs != near_offs ? (int32_t)best_len : 0;
+    }
+}
+
 size_t vnibble_size(uint32_t val)
 {
     if (val < 8)
@@ -607,6 +743,133 @@ static size_t factor_len_bitsize(uint32_t val)
     return gr3_bitsize(val - FACTOR_LENGTH_MIN);
 }
 
+static size_t dict_lcp(salz_io_ctx *ctx, size_t dict_len, size_t common_len,
+    size_t dict_pos, size_t pos)
+{
+    size_t len = common_len;
+
+    while (dict_pos + len + 8 <= dict_len && pos + len + 8 <= ctx->src_len) {
+        uint64_t val1 = read_u64_raw(ctx->src, dict_pos + len);
+        uint64_t val2 = read_u64_raw(ctx->src, pos + len);
+        uint64_t diff = val1 ^ val2;
+
+        if (diff)
+            return len + (__builtin_ctzll(diff) >> 3);
+
+        len += 8;
+    }
+
+    while (dict_pos + len < dict_len && pos + len < ctx->src_len &&
+           ctx->src[dict_pos + len] == ctx->src[pos + len])
+        len += 1;
+
+    return len;
+}
+
+static size_t dict_match(salz_io_ctx *ctx, const salz_dict *dict, size_t pos,
+    size_t *match_pos)
+{
+    /*
+     * Binary search for the suffix of text in suffix array of dictionary.
+     * Longest match is found with one of the neighbours of its insertion
+     * point, which are both visited during the search. Prefix known to be
+     * shared with both bounds of the search is never compared again.
+     */
+
+    const uint8_t *text = ctx->src;
+    size_t lo = 0;
+    size_t hi = dict->dict_len;
+    size_t lo_len = 0;
+    size_t hi_len = 0;
+    size_t best_len = 0;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        size_t dict_pos = (size_t)dict->sa[mid];
+        size_t len = dict_lcp(ctx, dict->dict_len, min(lo_len, hi_len),
+                              dict_pos, pos);
+
+        if (len > best_len) {
+            best_len = len;
+            *match_pos = dict_pos;
+        }
+
+        if (dict_pos + len == dict->dict_len ||
+            (pos + len < ctx->src_len && text[dict_pos + len] < text[pos + len])) {
+            lo = mid + 1;
+            lo_len = len;
+        } else {
+            hi = mid;
+            hi_len = len;
+        }
+    }
+
+    return best_len;
+}
+
+/* Length of dictionary match, which is reused at next position */
+#define DICT_MATCH_REUSE_LEN 32
+
+static void factorize_dict(salz_io_ctx *ctx, const salz_dict *dict)
+{
+    /*
+     * Suffix array of the segment doesn't cover the dictionary preceding it.
+     * Matches into dictionary are looked up from its own suffix array, and
+     * replace the shorter of PSV/NSV candidates when they are longer.
+     */
+
+    int32_t *aux = ctx->aux;
+    size_t match_pos = 0;
+    size_t len = 0;
+
+    for (size_t pos = ctx->prefix_len; pos < ctx->src_len; pos++) {
+        size_t slot = aux[1 + 4 * pos] <= aux[3 + 4 * pos] ? 0 : 2;
+
+        /*
+         * Long match continues at next position, which is rarely beaten by
+         * searching again. This keeps lookups linear in long repetitions.
+         */
+        if (len > DICT_MATCH_REUSE_LEN) {
+            match_pos += 1;
+            len -= 1;
+        } else {
+            len = dict_match(ctx, dict, pos, &match_pos);
+        }
+
+        if (len < FACTOR_LENGTH_MIN || len <= (size_t)aux[slot + 1 + 4 * pos])
+            continue;
+
+        aux[slot + 0 + 4 * pos] = (int32_t)(pos - match_pos);
+        aux[slot + 1 + 4 * pos] = (int32_t)len;
+    }
+}
+
+static inline void weigh_factor(salz_io_ctx *ctx, size_t src_pos,
+    int32_t alt_offs, int32_t alt_len, uint32_t *cost, int32_t *factor_offs,
+    int32_t *factor_len)
+{
+    int32_t *aux = ctx->aux;
+    /* Shorter lengths of factor may leave a cheaper parse of what follows */
+    int32_t len_min = max(alt_len - (int32_t)ctx->params->trunc_len,
+                          FACTOR_LENGTH_MIN);
+    uint32_t offs_cost;
+
+    if (alt_len < FACTOR_LENGTH_MIN)
+        return;
+
+    offs_cost = 1 + factor_offs_bitsize(alt_offs);
+    for (int32_t len = alt_len; len >= len_min; len--) {
+        uint32_t alt_cost = offs_cost + factor_len_bitsize(len) +
+                            (uint32_t)aux[2 + 4 * (src_pos + len)];
+
+        if (alt_cost < *cost) {
+            *cost = alt_cost;
+            *factor_offs = alt_offs;
+            *factor_len = len;
+        }
+    }
+}
+
 static void optimize_factorization(salz_io_ctx *ctx)
 {
     /*
@@ -616,48 +879,48 @@ static void optimize_factorization(salz_io_ctx *ctx)
      */
 
     int32_t *aux = ctx->aux;
+    /* First position to optimize, which is a forced literal without history */
+    size_t first = ctx->prefix_len ? ctx->prefix_len : 1;
+
+    /*
+     * @note: Costs are stored as unsigned 32-bit values, which is enough for
+     * segments up to SALZ_SEGMENT_LEN_MAX bytes.
+     */
 
     /* Nothing to do after reaching last position - initialize cost as zero */
     aux[2 + 4 * ctx->src_len] = 0;
-    for (size_t src_pos = ctx->src_len - 1; src_pos; src_pos--) {
+    for (size_t src_pos = ctx->src_len - 1; src_pos >= first; src_pos--) {
         /* Cost of using a literal */
         int32_t factor_offs = 0;
         int32_t factor_len = 1;
-        int32_t cost = 9 + aux[2 + 4 * (src_pos + 1)];
-
-        /* Cost of using PSV candidate */
-        int32_t alt_len = aux[1 + 4 * src_pos];
-        if (alt_len >= FACTOR_LENGTH_MIN) {
-            int32_t alt_offs = aux[0 + 4 * src_pos];
-            int32_t alt_cost = 1 + factor_offs_bitsize(alt_offs) +
-                               factor_len_bitsize(alt_len) +
-                               aux[2 + 4 * (src_pos + alt_len)];
-
-            if (alt_cost < cost) {
-                cost = alt_cost;
-                factor_offs = alt_offs;
-                factor_len = alt_len;
-            }
-        }
+        uint32_t cost = 9 + (uint32_t)aux[2 + 4 * (src_pos + 1)];
 
-        /* Cost of using NSV candidate */
-        alt_len = aux[3 + 4 * src_pos];
-        if (alt_len >= FACTOR_LENGTH_MIN) {
-            int32_t alt_offs = aux[2 + 4 * src_pos];
-            int32_t alt_cost = 1 + factor_offs_bitsize(alt_offs) +
-                               factor_len_bitsize(alt_len) +
-                               aux[2 + 4 * (src_pos + alt_len)];
-
-            if (alt_cost < cost) {
-                cost = alt_cost;
-                factor_offs = alt_offs;
-                factor_len = alt_len;
-            }
+        /* Costs of using PSV and NSV candidates */
+        int32_t psv_offs = aux[0 + 4 * src_pos];
+        int32_t psv_len = aux[1 + 4 * src_pos];
+        int32_t nsv_offs = aux[2 + 4 * src_pos];
+        int32_t nsv_len = aux[3 + 4 * src_pos];
+
+        /*
+         * Low efforts weigh only the longer candidate. Shorter one is dropped
+         * instead of NSV altogether, as NSV alone finds runs and short
+         * periods, whose later suffixes sort before earlier ones.
+         */
+        if (ctx->params->longer_only) {
+            if (psv_len >= nsv_len)
+                nsv_len = 0;
+            else
+                psv_len = 0;
         }
 
+        weigh_factor(ctx, src_pos, psv_offs, psv_len, &cost, &factor_offs,
+                     &factor_len);
+        weigh_factor(ctx, src_pos, nsv_offs, nsv_len, &cost, &factor_offs,
+                     &factor_len);
+
         aux[0 + 4 * src_pos] = factor_offs;
         aux[1 + 4 * src_pos] = factor_len;
-        aux[2 + 4 * src_pos] = cost;
+        aux[2 + 4 * src_pos] = (int32_t)cost;
     }
 }
 
@@ -698,17 +961,38 @@ static bool write_factor(salz_io_ctx *ctx, uint32_t factor_offs,
     return true;
 }
 
-static bool emit_encoding(salz_io_ctx *ctx)
+static void restart_encoding(salz_io_ctx *ctx)
 {
+    size_t data_pos = ctx->hdr_len + ctx->restarts_len;
+    size_t entry_pos = ctx->hdr_len + SALZ_RESTART_HDR_LEN +
+                       4 * ctx->restart_idx;
+
     /*
-     * Optimal Lempel-Ziv factorization is encoded using a format described in
-     * Sections 3.6.1 and 3.6.3 of [1].
+     * Rest of buffered bitfield is left unfilled, so that first token after
+     * restart point reserves a new one right where decoding begins.
      */
+    ctx->bits <<= ctx->bits_avail;
+    ctx->bits_avail = 0;
 
-    int32_t *aux = ctx->aux;
+    write_u32_raw(ctx->dst, entry_pos, (uint32_t)(ctx->dst_pos - data_pos));
 
-    while (!input_processed(ctx)) {
-        uint32_t factor_len = (uint32_t)aux[1 + 4 * ctx->src_pos];
+    next_restart(ctx);
+}
+
+static bool emit_encoding(salz_io_ctx *ctx)
+{
+    /*
+     * Optimal Lempel-Ziv factorization is encoded using a format described in
+     * Sections 3.6.1 and 3.6.3 of [1].
+     */
+
+    int32_t *aux = ctx->aux;
+
+    while (!input_processed(ctx)) {
+        uint32_t factor_len = (uint32_t)aux[1 + 4 * ctx->src_pos];
+
+        if (unlikely(ctx->src_pos == ctx->restart_next))
+            restart_encoding(ctx);
 
         if (factor_len == 1) {
             if (unlikely(!write_token(ctx, SALZ_TOKEN_TYPE_LITERAL)))
@@ -731,13 +1015,26 @@ static bool emit_encoding(salz_io_ctx *ctx)
     return true;
 }
 
+static void write_stream_hdr(salz_io_ctx *ctx, uint8_t stream_type,
+    size_t stream_len)
+{
+    uint32_t stream_hdr = stream_len & SALZ_STREAM_LEN_MASK;
+
+    if (ctx->hdr_len == SALZ_STREAM_HDR_LEN_LONG) {
+        stream_type |= SALZ_STREAM_FLAG_LONG;
+        write_u32_raw(ctx->dst, 4, (uint32_t)(stream_len >> 24));
+    }
+
+    stream_hdr |= (uint32_t)stream_type << 24;
+    write_u32_raw(ctx->dst, 0, stream_hdr);
+}
+
 static bool finalize_encoding(salz_io_ctx *ctx)
 {
     /*
      * @todo: create more substantial stream header, which contains
      * version, type, flags, size and checksum (optional?)
      */
-    uint32_t stream_hdr = 0;
 
     /* Encode the last 8 bytes */
     ctx->src_len += 8;
@@ -752,386 +1049,760 @@ static bool finalize_encoding(salz_io_ctx *ctx)
     ctx->bits <<= ctx->bits_avail;
     write_u64_raw(ctx->dst, ctx->bits_pos, ctx->bits);
 
-    if (ctx->dst_pos > ctx->src_len + 4) {
-        /*
-         * Encoded size exceed original size. Discard encoded segment
-         * and use plain input instead
-         */
-        stream_hdr |= SALZ_STREAM_TYPE_PLAIN << 24;
-        stream_hdr |= ctx->src_len & 0xffffff;
-
-        if (unlikely(ctx->src_len + 4 > ctx->dst_len))
-            return false;
-
-        salz_memcpy(ctx->dst + 4, ctx->src, ctx->src_len);
-        ctx->dst_pos = ctx->src_len + 4;
-    } else {
-        stream_hdr |= SALZ_STREAM_TYPE_SALZ << 24;
-        stream_hdr |= (ctx->dst_pos - 4) & 0xffffff;
+    if (ctx->restart_len) {
+        write_u32_raw(ctx->dst, ctx->hdr_len + 0,
+                      (uint32_t)(ctx->src_len - ctx->prefix_len));
+        write_u32_raw(ctx->dst, ctx->hdr_len + 4, (uint32_t)ctx->restart_len);
+        write_stream_hdr(ctx, SALZ_STREAM_TYPE_SALZ_RESTART,
+                         ctx->dst_pos - ctx->hdr_len);
+        return true;
     }
-    write_u32_raw(ctx->dst, 0, stream_hdr);
+
+    write_stream_hdr(ctx, SALZ_STREAM_TYPE_SALZ, ctx->dst_pos - ctx->hdr_len);
 
     return true;
 }
 
-int salz_encode_safe(const uint8_t *src, size_t src_len, uint8_t *dst,
-    size_t *dst_len)
+static bool emit_plain(salz_io_ctx *ctx)
 {
-    salz_io_ctx *ctx = NULL;
-    int ret = 0;
+    size_t plain_len = ctx->src_len + 8 - ctx->prefix_len;
 
-    if (src == NULL || dst == NULL) {
-        debug("NULL I/O buffer(s)");
-        return -1;
-    }
-
-    ctx = encode_ctx_create(src, src_len, dst, *dst_len);
-    if (ctx == NULL) {
-        debug("Couldn't initialize encoding context");
-        return -1;
-    }
+    if (unlikely(plain_len + ctx->hdr_len > ctx->dst_len))
+        return false;
 
-    if (!build_suffix_array(ctx)) {
-        debug("Couldn't build SA");
-        ret = -1;
-        goto out;
-    }
+    salz_memcpy(ctx->dst + ctx->hdr_len, ctx->src + ctx->prefix_len, plain_len);
+    ctx->dst_pos = plain_len + ctx->hdr_len;
 
-    build_psvnsv_array(ctx);
+    write_stream_hdr(ctx, SALZ_STREAM_TYPE_PLAIN, plain_len);
 
-    factorize(ctx);
+    return true;
+}
 
-    optimize_factorization(ctx);
+static size_t encoded_len(salz_io_ctx *ctx)
+{
+    /*
+     * Exact length of encoded segment is derived from cost of optimal parse
+     * without emitting it. Parse is followed to count literals and offsets
+     * written as whole bytes, while rest of the bits go into buffered
+     * bitfields of 64 bits. Each interval between restart points begins a
+     * bitfield of its own. Interval is visited even if parse is empty, which
+     * happens for a segment of 9 bytes without history, so that forced and
+     * last literals are always counted.
+     */
 
-    if (!emit_encoding(ctx)) {
-        debug("Encoding failed");
-        ret = -1;
-        goto out;
-    }
+    int32_t *aux = ctx->aux;
+    /* First position is a forced literal without history */
+    size_t first = ctx->prefix_len ? ctx->prefix_len : 1;
+    size_t forced = first - ctx->prefix_len;
+    size_t len = ctx->hdr_len + ctx->restarts_len;
+    size_t begin = first;
+    size_t next = ctx->restart_next;
+
+    do {
+        size_t end = min(next, ctx->src_len);
+        /* Cost of optimal parse over interval */
+        uint64_t bits = (uint32_t)aux[2 + 4 * begin] -
+                        (uint32_t)aux[2 + 4 * end];
+        size_t bytes = 0;
+
+        for (size_t pos = begin; pos < end; pos += (size_t)aux[1 + 4 * pos])
+            bytes += 1;
+
+        /* Forced first literal and last 8 literals */
+        if (begin == first) {
+            bits += 9 * forced;
+            bytes += forced;
+        }
+        if (end == ctx->src_len) {
+            bits += 9 * 8;
+            bytes += 8;
+        }
 
-    if (!finalize_encoding(ctx)) {
-        debug("Couldn't finalize encoding");
-        ret = -1;
-        goto out;
-    }
+        len += bytes + 8 * divup(bits - 8 * bytes, 64);
 
-    *dst_len = ctx->dst_pos;
+        begin = end;
+        next += ctx->restart_len;
+    } while (begin < ctx->src_len);
 
-out:
-    encode_ctx_destroy(ctx);
-    return ret;
+    return len;
 }
 
-/*************************************
- * Decoding-only I/O context functions
- *************************************/
-
-static salz_io_ctx *decode_ctx_create(const uint8_t *src, size_t src_len,
-    uint8_t *dst, size_t dst_len)
+static bool factorize_intervals(salz_io_ctx *ctx)
 {
-    salz_io_ctx *ctx = NULL;
-    uint32_t stream_hdr;
-    uint8_t stream_type;
-    size_t stream_len;
-
-    ctx = malloc(sizeof(*ctx));
-    if (ctx == NULL) {
-        debug("Couldn't allocate memory (%zu bytes)", sizeof(*ctx));
-        return NULL;
-    }
-    memset(ctx, 0, sizeof(*ctx));
+    /*
+     * Interval following each restart point is factorized as if it was a
+     * segment with no history, so that its factors neither cross the next
+     * restart point nor refer to data before its own.
+     */
 
-    if (src_len < 4) {
-        debug("Couldn't read stream header");
-        goto fail;
-    }
+    size_t src_len = ctx->src_len;
+    size_t prefix_len = ctx->prefix_len;
+    size_t sa_base = ctx->sa_base;
+    size_t next = ctx->restart_next;
+    bool ok = true;
 
-    stream_hdr = read_u32_raw(src, 0);
-    stream_type = stream_hdr >> 24;
-    stream_len = stream_hdr & 0xffffff;
+    while (ctx->prefix_len < src_len) {
+        ctx->src_len = min(next, src_len);
 
-    if (stream_type >= SALZ_STREAM_TYPE_MAX) {
-        debug("Unknown stream type (%u)", stream_type);
-        goto fail;
-    }
+        enter_phase(ctx, SALZ_PHASE_SUFFIX_ARRAY);
+        if (!build_suffix_array(ctx)) {
+            debug("Couldn't build SA");
+            ok = false;
+            break;
+        }
 
-    if (stream_len > src_len - 4) {
-        debug("Stream is truncated (expected: %zu, have: %zu)",
-               stream_len, src_len - 4);
-        goto fail;
-    }
+        enter_phase(ctx, SALZ_PHASE_PSVNSV_ARRAY);
+        build_psvnsv_array(ctx);
 
-    ctx->stream_type = stream_type;
-    /* Stream is repositioned right after the header, as it is no longer needed */
-    ctx->src = src + 4;
-    ctx->src_len = stream_len;
-    ctx->src_pos = 0;
-    ctx->dst = dst;
-    ctx->dst_len = dst_len;
-    ctx->dst_pos = 0;
-    ctx->bits = 0;
-    ctx->bits_avail = 0;
+        enter_phase(ctx, SALZ_PHASE_FACTORIZE);
+        factorize(ctx);
 
-    return ctx;
+        ctx->prefix_len = ctx->src_len;
+        ctx->sa_base = ctx->src_len;
+        ctx->prev_psv_len = 0;
+        ctx->prev_nsv_len = 0;
+        next += ctx->restart_len;
+    }
 
-fail:
-    free(ctx);
-    return NULL;
-}
+    ctx->src_len = src_len;
+    ctx->prefix_len = prefix_len;
+    ctx->sa_base = sa_base;
 
-static void decode_ctx_destroy(salz_io_ctx *ctx)
-{
-    if (ctx != NULL)
-        free(ctx);
+    return ok;
 }
 
-static bool read_u8(salz_io_ctx *ctx, uint8_t *res)
+static bool parse(salz_io_ctx *ctx, const salz_dict *dict)
 {
-    if (unlikely(ctx->src_pos >= ctx->src_len))
+    if (ctx->sa == NULL) {
+        enter_phase(ctx, SALZ_PHASE_FACTORIZE);
+        factorize_small(ctx);
+    } else if (!factorize_intervals(ctx)) {
+        enter_phase(ctx, SALZ_PHASE_DONE);
         return false;
+    }
+
+    if (dict != NULL)
+        factorize_dict(ctx, dict);
 
-    *res = ctx->src[ctx->src_pos++];
+    enter_phase(ctx, SALZ_PHASE_OPTIMIZE);
+    optimize_factorization(ctx);
 
     return true;
 }
 
-static bool read_u64(salz_io_ctx *ctx, uint64_t *res)
+static size_t stats_bucket(uint32_t val, size_t buckets_cnt)
 {
-    if (unlikely(ctx->src_pos + 8 > ctx->src_len))
-        return false;
-
-    salz_memcpy(res, &ctx->src[ctx->src_pos], 8);
-    ctx->src_pos += 8;
-
-    return true;
+    /* Bucket i holds values in [2^i, 2^(i+1)), last one anything above */
+    return min(31 - (size_t)__builtin_clz(val), buckets_cnt - 1);
 }
 
-static bool queue_bits(salz_io_ctx *ctx)
+static void collect_stats(salz_io_ctx *ctx)
 {
-    if (unlikely(!read_u64(ctx, &ctx->bits)))
-        return false;
+    struct salz_stats *stats = ctx->stats;
+    int32_t *aux = ctx->aux;
+    /* First position is a forced literal without history */
+    size_t first = ctx->prefix_len ? ctx->prefix_len : 1;
+    /* Forced first literal and last 8 literals */
+    size_t literals_cnt = first - ctx->prefix_len + 8;
+    uint32_t factor_len;
 
-    ctx->bits_avail = 64;
+    for (size_t pos = first; pos < ctx->src_len; pos += factor_len) {
+        factor_len = (uint32_t)aux[1 + 4 * pos];
 
-    return true;
+        if (factor_len == 1) {
+            literals_cnt += 1;
+        } else {
+            uint32_t factor_offs = (uint32_t)aux[0 + 4 * pos];
+
+            stats->factors_cnt += 1;
+            stats->factors_len += factor_len;
+            stats->factor_len_max = max(stats->factor_len_max, factor_len);
+            stats->offs_hist[stats_bucket(factor_offs,
+                                          SALZ_STATS_OFFS_BUCKETS)] += 1;
+            stats->len_hist[stats_bucket(factor_len,
+                                         SALZ_STATS_LEN_BUCKETS)] += 1;
+            stats->token_bits += 1;
+            stats->offs_bits += factor_offs_bitsize(factor_offs);
+            stats->len_bits += factor_len_bitsize(factor_len);
+        }
+    }
+
+    stats->literals_cnt += literals_cnt;
+    stats->token_bits += literals_cnt;
+    stats->literal_bits += 8 * literals_cnt;
+    stats->cost_bits += (uint32_t)aux[2 + 4 * first] +
+                        9 * (first - ctx->prefix_len + 8);
 }
 
-static bool read_bit(salz_io_ctx *ctx, uint8_t *res)
+static int emit(salz_io_ctx *ctx)
 {
-    if (ctx->bits_avail == 0 && unlikely(!queue_bits(ctx)))
-        return false;
+    size_t len = encoded_len(ctx);
+    size_t plain_len = ctx->src_len + 8 - ctx->prefix_len;
 
-    *res = !!(ctx->bits & 0x8000000000000000u);
-    ctx->bits <<= 1;
-    ctx->bits_avail -= 1;
+    /* Without output, only length of encoded segment is of interest */
+    if (ctx->dst == NULL) {
+        ctx->dst_pos = min(len, ctx->hdr_len + plain_len);
+        return 0;
+    }
 
-    return true;
-}
+    /* Encoding, which wouldn't be shorter than plain segment, isn't emitted */
+    if (len > ctx->hdr_len + plain_len) {
+        if (!ctx->uncounted) {
+            count(&counters.plain_late);
+            if (stats_requested(ctx->stats))
+                ctx->stats->plain_late += 1;
+        }
 
-static bool read_bits(salz_io_ctx *ctx, size_t count, uint64_t *res)
-{
-    assert(count <= 64);
+        if (!emit_plain(ctx)) {
+            debug("Couldn't copy plain segment");
+            return -1;
+        }
 
-    if (ctx->bits_avail == 0 && unlikely(!queue_bits(ctx)))
-        return false;
+        return 0;
+    }
 
-    if (count <= ctx->bits_avail) {
-        *res = ctx->bits >> (64 - count);
-        ctx->bits <<= count;
-        ctx->bits_avail -= count;
-        return true;
+    if (stats_requested(ctx->stats)) {
+        collect_stats(ctx);
+        ctx->stats->parsed_len += len;
+    }
+
+    if (!emit_encoding(ctx)) {
+        debug("Encoding failed");
+        return -1;
     }
 
-    *res = ctx->bits >> (64 - ctx->bits_avail);
-    count -= ctx->bits_avail;
+    if (!finalize_encoding(ctx)) {
+        debug("Couldn't finalize encoding");
+        return -1;
+    }
 
-    if (unlikely(!queue_bits(ctx)))
-        return false;
+    assert(ctx->dst_pos == len);
 
-    *res = (*res << count) | (ctx->bits >> (64 - count));
-    ctx->bits <<= count;
-    ctx->bits_avail -= count;
+    return 0;
+}
 
-    return true;
+static int finish(salz_io_ctx *ctx)
+{
+    int ret;
+
+    enter_phase(ctx, SALZ_PHASE_EMIT);
+    ret = emit(ctx);
+    enter_phase(ctx, SALZ_PHASE_DONE);
+
+    return ret;
 }
 
-static bool read_unary(salz_io_ctx *ctx, uint32_t *res)
+static int encode(salz_io_ctx *ctx, const salz_dict *dict)
 {
-    uint32_t last_zeros;
+    if (!parse(ctx, dict))
+        return -1;
 
-    if (ctx->bits_avail == 0 && unlikely(!queue_bits(ctx)))
-        return false;
+    return finish(ctx);
+}
 
-    *res = 0;
-    while (ctx->bits == 0) {
-        *res += ctx->bits_avail;
-        if (!unlikely(queue_bits(ctx)))
-            return false;
+static int encode_plain(const uint8_t *src, size_t src_len, uint8_t *dst,
+    size_t *dst_len)
+{
+    size_t hdr_len = src_len > SALZ_STREAM_LEN_MASK ?
+                     SALZ_STREAM_HDR_LEN_LONG : SALZ_STREAM_HDR_LEN;
+    uint32_t stream_hdr = (uint32_t)SALZ_STREAM_TYPE_PLAIN << 24;
+
+    if (*dst_len < hdr_len + src_len) {
+        debug("Couldn't fit plain stream (%zu bytes)", src_len);
+        return -1;
     }
 
-    last_zeros = __builtin_clzll(ctx->bits);
-    ctx->bits <<= last_zeros + 1;
-    ctx->bits_avail -= last_zeros + 1;
+    *dst_len = hdr_len + src_len;
+    if (dst == NULL)
+        return 0;
 
-    *res += last_zeros;
+    if (hdr_len == SALZ_STREAM_HDR_LEN_LONG) {
+        stream_hdr |= SALZ_STREAM_FLAG_LONG << 24;
+        write_u32_raw(dst, 4, (uint32_t)(src_len >> 24));
+    }
 
-    return true;
+    write_u32_raw(dst, 0, stream_hdr | (src_len & SALZ_STREAM_LEN_MASK));
+    if (src_len)
+        salz_memcpy(dst + hdr_len, src, src_len);
+
+    return 0;
 }
 
-static bool read_gr3(salz_io_ctx *ctx, uint32_t *res)
+/*
+ * Incompressibility is estimated from chunks sampled evenly over the
+ * segment. Segment is deemed incompressible, when byte entropy of samples
+ * is high and hardly any of their 4-byte substrings repeat.
+ */
+#define PROBE_CHUNK_LEN  (256)
+#define PROBE_CHUNKS_CNT (64)
+#define PROBE_HASH_BITS  (12)
+/* Segments shorter than this are always encoded (in bytes) */
+#define PROBE_LEN_MIN    (4 * PROBE_CHUNK_LEN * PROBE_CHUNKS_CNT / 16)
+
+static uint32_t log2_fix(uint32_t val)
 {
-    uint32_t var;
-    uint64_t fixed;
+    /* Binary logarithm in 1/1024 bits by repeated squaring */
 
-    if (unlikely(!read_unary(ctx, &var)))
-        return false;
-    if (unlikely(!read_bits(ctx, 3, &fixed)))
-        return false;
+    uint32_t res = 31 - __builtin_clz(val);
+    uint64_t frac = ((uint64_t)val << 31) >> res;
 
-    *res = (var << 3) | fixed;
+    for (size_t i = 0; i < 10; i++) {
+        frac = (frac * frac) >> 31;
+        res <<= 1;
+        if (frac >= (1ull << 32)) {
+            frac >>= 1;
+            res |= 1;
+        }
+    }
 
-    return true;
+    return res;
 }
 
-static bool read_nibble(salz_io_ctx *ctx, uint8_t *res)
+static bool is_incompressible(const uint8_t *src, size_t prefix_len,
+    size_t src_len, uint32_t entropy_min)
 {
-    uint64_t var;
+    uint32_t counts[256] = { 0 };
+    uint32_t table[1 << PROBE_HASH_BITS];
+    size_t stride = max(src_len / PROBE_CHUNKS_CNT, PROBE_CHUNK_LEN);
+    size_t samples_cnt = 0;
+    size_t probes_cnt = 0;
+    size_t hits_cnt = 0;
+    uint64_t sum = 0;
+    uint32_t entropy;
+
+    /* Positions are offset by one, so that zero marks an empty slot */
+    memset(table, 0, sizeof(table));
+
+    for (size_t chunk = 0; chunk + PROBE_CHUNK_LEN <= src_len; chunk += stride) {
+        /* Tail of history takes part in match probe */
+        size_t begin = chunk ? prefix_len + chunk :
+                       prefix_len - min(prefix_len, PROBE_CHUNK_LEN);
+        size_t end = prefix_len + chunk + PROBE_CHUNK_LEN - 3;
+
+        for (size_t pos = begin; pos < end; pos++) {
+            uint32_t val = (uint32_t)read_u32_raw(src, pos);
+            uint32_t hash = (val * 2654435761u) >> (32 - PROBE_HASH_BITS);
+            uint32_t prev = table[hash];
+
+            table[hash] = (uint32_t)pos + 1;
+            if (pos < prefix_len)
+                continue;
+
+            probes_cnt += 1;
+            hits_cnt += prev && read_u32_raw(src, prev - 1) == val;
+        }
+
+        for (size_t pos = prefix_len + chunk;
+             pos < prefix_len + chunk + PROBE_CHUNK_LEN; pos++)
+            counts[src[pos]] += 1;
+        samples_cnt += PROBE_CHUNK_LEN;
+    }
 
-    if (unlikely(!read_bits(ctx, 4, &var)))
+    /* Repetition of at least one in 64 substrings is worth encoding */
+    if (probes_cnt == 0 || hits_cnt * 64 >= probes_cnt)
         return false;
 
-    *res = (uint8_t)var;
+    /* Entropy as log2(N) - sum(c * log2(c)) / N */
+    for (size_t i = 0; i < 256; i++) {
+        if (counts[i])
+            sum += (uint64_t)counts[i] * log2_fix(counts[i]);
+    }
+    entropy = log2_fix(samples_cnt) - (uint32_t)(sum / samples_cnt);
 
-    return true;
+    return (uint64_t)entropy * 1000 >= (uint64_t)entropy_min * 1024;
 }
 
-static bool read_vnibble(salz_io_ctx *ctx, uint32_t *res)
+void salz_counters_get(struct salz_counters *res)
 {
-    uint8_t nibble;
+    res->segments = __atomic_load_n(&counters.segments, __ATOMIC_RELAXED);
+    res->plain_early = __atomic_load_n(&counters.plain_early, __ATOMIC_RELAXED);
+    res->plain_late = __atomic_load_n(&counters.plain_late, __ATOMIC_RELAXED);
+}
 
-    if (unlikely(!read_nibble(ctx, &nibble)))
-        return false;
-    *res = nibble & 0x7u;
-    if (nibble >= 0x8u)
-        return true;
+static const struct salz_encode_opts default_opts = {
+    .plain_entropy_min = SALZ_PLAIN_ENTROPY_MIN_DEFAULT,
+    .restart_len = 0,
+    .effort = SALZ_EFFORT_DEFAULT,
+    .phase_cb = NULL,
+    .phase_arg = NULL,
+    .stats = NULL,
+};
 
-    if (unlikely(!read_nibble(ctx, &nibble)))
+static bool opts_valid(const struct salz_encode_opts *opts)
+{
+    if (opts->restart_len && (opts->restart_len < SALZ_RESTART_LEN_MIN ||
+                              opts->restart_len > SALZ_SEGMENT_LEN_MAX)) {
+        debug("Invalid distance between restart points (%u bytes)",
+              opts->restart_len);
         return false;
-    *res = ((*res + 1) << 3) | (nibble & 0x7u);
-    if (nibble >= 0x8u)
-        return true;
+    }
 
-    if (unlikely(!read_nibble(ctx, &nibble)))
+    if (opts->effort > SALZ_EFFORT_MAX) {
+        debug("Invalid effort (%u)", opts->effort);
         return false;
-    *res = ((*res + 1) << 3) | (nibble & 0x7u);
-    if (nibble >= 0x8u)
-        return true;
+    }
 
-    if (unlikely(!read_nibble(ctx, &nibble)))
+#ifndef SALZ_STATS
+    if (opts->stats != NULL) {
+        debug("Statistics not compiled in");
         return false;
-    *res = ((*res + 1) << 3) | (nibble & 0x7u);
-    if (nibble >= 0x8u)
-        return true;
+    }
+#endif
 
-    if (unlikely(!read_nibble(ctx, &nibble)))
-        return false;
-    *res = ((*res + 1) << 3) | (nibble & 0x7u);
-    if (nibble >= 0x8u)
-        return true;
+    return true;
+}
 
-    if (unlikely(!read_nibble(ctx, &nibble)))
-        return false;
-    *res = ((*res + 1) << 3) | (nibble & 0x7u);
-    if (nibble >= 0x8u)
-        return true;
+static void stats_reset(const struct salz_encode_opts *opts)
+{
+    if (opts != NULL && stats_requested(opts->stats))
+        memset(opts->stats, 0, sizeof(*opts->stats));
+}
 
-    if (unlikely(!read_nibble(ctx, &nibble)))
-        return false;
-    *res = ((*res + 1) << 3) | (nibble & 0x7u);
-    if (nibble >= 0x8u)
-        return true;
+static void stats_segment(struct salz_stats *stats, size_t plain_len,
+    size_t encoded_len)
+{
+    if (stats_requested(stats)) {
+        stats->segments += 1;
+        stats->plain_len += plain_len;
+        stats->encoded_len += encoded_len;
+    }
+}
 
-    if (unlikely(!read_nibble(ctx, &nibble)))
-        return false;
-    *res = ((*res + 1) << 3) | (nibble & 0x7u);
-    if (nibble >= 0x8u)
-        return true;
+static int encode_prefix(const uint8_t *src, size_t prefix_len,
+    size_t src_len, uint8_t *dst, size_t *dst_len, struct salz_workspace *ws,
+    const struct salz_encode_opts *opts)
+{
+    salz_io_ctx ctx;
+    int32_t aux_small[4 * (SALZ_SMALL_SEGMENT_LEN_MAX + 1)];
+    /* Without output buffer, only length of encoded segment is estimated */
+    bool estimate = dst == NULL;
+    int ret;
+
+    if (src_len > SALZ_SEGMENT_LEN_MAX || prefix_len > SALZ_SEGMENT_LEN_MAX) {
+        debug("Segment or history too long (%zu + %zu bytes)", src_len,
+              prefix_len);
+        return -1;
+    }
 
-    if (unlikely(!read_nibble(ctx, &nibble)))
-        return false;
-    *res = ((*res + 1) << 3) | (nibble & 0x7u);
-    if (nibble >= 0x8u)
-        return true;
+    if (opts == NULL)
+        opts = &default_opts;
 
-    if (unlikely(!read_nibble(ctx, &nibble)))
-        return false;
-    *res = ((*res + 1) << 3) | (nibble & 0x7u);
-    if (nibble >= 0x8u)
-        return true;
+    if (!opts_valid(opts))
+        return -1;
 
-    if (unlikely(!read_nibble(ctx, &nibble)))
-        return false;
-    *res = ((*res + 1) << 3) | (nibble & 0x7u);
-    return true;
-}
+    if (!estimate)
+        count(&counters.segments);
+
+    /* Segment must have positions to encode besides its last 8 bytes */
+    if (src_len <= 8 ||
+        (opts->plain_entropy_min && src_len >= PROBE_LEN_MIN &&
+         is_incompressible(src, prefix_len, src_len,
+                           opts->plain_entropy_min))) {
+        if (src_len > 8 && !estimate)
+            count(&counters.plain_early);
+
+        ret = encode_plain(src + prefix_len, src_len, dst, dst_len);
+        if (ret == 0 && stats_requested(opts->stats)) {
+            opts->stats->plain_early += 1;
+            stats_segment(opts->stats, src_len, *dst_len);
+        }
 
-/********************
- * Decoding functions
- ********************/
+        return ret;
+    }
 
-static bool cpy_plain_stream(salz_io_ctx *ctx)
-{
-    if (unlikely(ctx->src_len > ctx->dst_len))
-        return false;
+    if (!encode_ctx_init(&ctx, src, prefix_len, src_len, dst, *dst_len) ||
+        !encode_ctx_opts(&ctx, opts)) {
+        debug("Couldn't initialize encoding context");
+        return -1;
+    }
 
-    salz_memcpy(ctx->dst, ctx->src, ctx->src_len);
-    ctx->dst_pos = ctx->src_len;
+    /* Small segments are factorized with a hash matcher on stack instead */
+    if (prefix_len + src_len <= SALZ_SMALL_SEGMENT_LEN_MAX) {
+        ctx.aux = aux_small;
+        ctx.aux_len = sizeof(aux_small) / sizeof(*aux_small);
+    } else if (!encode_ctx_reserve(&ctx, ws, 0)) {
+        debug("Couldn't initialize encoding context");
+        return -1;
+    }
 
-    return true;
+    ret = encode(&ctx, NULL);
+    if (ret == 0) {
+        *dst_len = ctx.dst_pos;
+        stats_segment(opts->stats, src_len, *dst_len);
+    }
+
+    encode_ctx_fini(&ctx);
+    return ret;
 }
 
-static bool read_token(salz_io_ctx *ctx, uint8_t *res)
+int salz_estimate_encoded_len(const uint8_t *src, size_t prefix_len,
+    size_t src_len, size_t *encoded_len)
 {
-    if (unlikely(!read_bit(ctx, res)))
-        return false;
+    if (src == NULL || encoded_len == NULL) {
+        debug("NULL input buffer or result");
+        return -1;
+    }
 
-    return true;
+    /* Without output buffer encoding stops short of emitting anything */
+    *encoded_len = SIZE_MAX;
+
+    return encode_prefix(src, prefix_len, src_len, NULL, encoded_len, NULL,
+                         NULL);
 }
 
-static bool read_factor_offs(salz_io_ctx *ctx, uint32_t *res)
+size_t salz_encode_workspace_len(size_t prefix_len, size_t src_len,
+    bool adaptive)
 {
-    uint32_t var;
-    uint8_t fixed;
+    size_t len;
 
-    if (unlikely(!read_vnibble(ctx, &var)))
-        return false;
-    if (unlikely(!read_u8(ctx, &fixed)))
-        return false;
+    /* Segments stored plain or matched on stack allocate nothing */
+    if (src_len <= 8 || prefix_len + src_len <= SALZ_SMALL_SEGMENT_LEN_MAX)
+        return 0;
 
-    *res = ((var << 8) | fixed) + FACTOR_OFFSET_MIN;
+    /* Arrays span over history and segment short of its last 8 bytes */
+    len = prefix_len + src_len - 8;
+    len = (len + 2) * sizeof(int32_t) + 4 * (len + 1) * sizeof(int32_t);
 
-    return true;
+    return adaptive ? 2 * len : len;
 }
 
-static bool read_factor_len(salz_io_ctx *ctx, uint32_t *res)
+int salz_encode_opts_safe(const uint8_t *src, size_t prefix_len,
+    size_t src_len, uint8_t *dst, size_t *dst_len,
+    const struct salz_encode_opts *opts)
 {
-    if (unlikely(!read_gr3(ctx, res)))
-        return false;
+    if (src == NULL || dst == NULL) {
+        debug("NULL I/O buffer(s)");
+        return -1;
+    }
 
-    *res += FACTOR_LENGTH_MIN;
+    stats_reset(opts);
 
-    return true;
+    return encode_prefix(src, prefix_len, src_len, dst, dst_len, NULL, opts);
 }
 
-static bool cpy_factor(salz_io_ctx *ctx)
+int salz_encode_prefix_safe(const uint8_t *src, size_t prefix_len,
+    size_t src_len, uint8_t *dst, size_t *dst_len)
 {
-    uint32_t factor_offs;
-    uint32_t factor_len;
-    uint8_t *src;
-    uint8_t *dst;
-    uint8_t *end;
+    return salz_encode_opts_safe(src, prefix_len, src_len, dst, dst_len, NULL);
+}
 
-    static const int inc1[8] = { 0, 1, 2, 1, 4, 4, 4, 4 };
+int salz_encode_safe(const uint8_t *src, size_t src_len, uint8_t *dst,
+    size_t *dst_len)
+{
+    return salz_encode_prefix_safe(src, 0, src_len, dst, dst_len);
+}
+
+/*************************************
+ * Decoding-only I/O context functions
+ *************************************/
+
+static bool decode_ctx_restart(salz_io_ctx *ctx)
+{
+    size_t restarts_len;
+
+    if (ctx->src_len < SALZ_RESTART_HDR_LEN) {
+        debug("Couldn't read restart table");
+        return false;
+    }
+
+    ctx->plain_len = read_u32_raw(ctx->src, 0);
+    ctx->restart_len = read_u32_raw(ctx->src, 4);
+    if (ctx->restart_len < SALZ_RESTART_LEN_MIN) {
+        debug("Invalid distance between restart points (%zu bytes)",
+              ctx->restart_len);
+        return false;
+    }
+
+    /* Restart points stay short of the last 8 bytes */
+    ctx->restarts_cnt = ctx->plain_len > 8 ?
+                        (ctx->plain_len - 8 - 1) / ctx->restart_len : 0;
+    restarts_len = SALZ_RESTART_HDR_LEN + 4 * ctx->restarts_cnt;
+    if (restarts_len > ctx->src_len) {
+        debug("Restart table is truncated");
+        return false;
+    }
+
+    /* Stream is repositioned once more right after restart table */
+    ctx->restarts = ctx->src + SALZ_RESTART_HDR_LEN;
+    ctx->src += restarts_len;
+    ctx->src_len -= restarts_len;
+    ctx->restart_idx = 0;
+    if (ctx->restarts_cnt)
+        ctx->restart_next = ctx->prefix_len + ctx->restart_len;
+
+    return true;
+}
+
+static bool decode_ctx_init(salz_io_ctx *ctx, const uint8_t *src,
+    size_t src_len, uint8_t *dst, size_t prefix_len, size_t dst_len,
+    bool partial)
+{
+    uint32_t stream_hdr;
+    uint8_t stream_type;
+    size_t stream_len;
+    size_t hdr_len = SALZ_STREAM_HDR_LEN;
+
+    memset(ctx, 0, sizeof(*ctx));
+
+    if (src_len < hdr_len) {
+        debug("Couldn't read stream header");
+        return false;
+    }
+
+    stream_hdr = read_u32_raw(src, 0);
+    stream_type = stream_hdr >> 24;
+    stream_len = stream_hdr & SALZ_STREAM_LEN_MASK;
+
+    if (stream_type & SALZ_STREAM_FLAG_LONG) {
+        hdr_len = SALZ_STREAM_HDR_LEN_LONG;
+        if (src_len < hdr_len) {
+            debug("Couldn't read stream header");
+            return false;
+        }
+
+        stream_type &= ~SALZ_STREAM_FLAG_LONG;
+        stream_len |= read_u32_raw(src, 4) << 24;
+    }
+
+    if (stream_type >= SALZ_STREAM_TYPE_MAX) {
+        debug("Unknown stream type (%u)", stream_type);
+        return false;
+    }
+
+    /* Partial decoding may stop before the end of stream is needed */
+    if (stream_len > src_len - hdr_len) {
+        if (!partial) {
+            debug("Stream is truncated (expected: %zu, have: %zu)",
+                   stream_len, src_len - hdr_len);
+            return false;
+        }
+
+        ctx->truncated = true;
+        stream_len = src_len - hdr_len;
+    }
+
+    ctx->stream_type = stream_type;
+    /* Stream is repositioned right after the header, as it is no longer needed */
+    ctx->src = src + hdr_len;
+    ctx->src_len = stream_len;
+    ctx->src_pos = 0;
+    ctx->prefix_len = prefix_len;
+    ctx->dst = dst;
+    ctx->dst_len = prefix_len + dst_len;
+    ctx->dst_pos = prefix_len;
+    ctx->bits = 0;
+    ctx->bits_avail = 0;
+    ctx->restart_next = SIZE_MAX;
+    ctx->partial = partial;
+
+    if (stream_type == SALZ_STREAM_TYPE_SALZ_RESTART)
+        return decode_ctx_restart(ctx);
+
+    return true;
+}
+
+/*
+ * Upper bound of plain length of stream, which decoding context was just
+ * initialized for
+ */
+static size_t decoded_len_max(const salz_io_ctx *ctx)
+{
+    if (ctx->stream_type == SALZ_STREAM_TYPE_PLAIN)
+        return ctx->src_len;
+
+    if (ctx->stream_type == SALZ_STREAM_TYPE_SALZ_RESTART)
+        return ctx->plain_len;
+
+    /*
+     * Without restart table, plain length isn't recorded. Literals take 9
+     * bits per byte, and a factor of 8v + 10 bytes at most takes v + 17 bits
+     * or more, so no bit of stream decodes to more than 8 bytes.
+     */
+    return min(64 * ctx->src_len, SALZ_SEGMENT_LEN_MAX);
+}
+
+/********************
+ * Decoding functions
+ ********************/
+
+static bool cpy_plain_stream(salz_io_ctx *ctx)
+{
+    size_t len = ctx->src_len;
+
+    if (unlikely(len > ctx->dst_len - ctx->dst_pos)) {
+        if (!ctx->partial)
+            return false;
+        len = ctx->dst_len - ctx->dst_pos;
+    }
+
+    if (len)
+        salz_memcpy(ctx->dst + ctx->dst_pos, ctx->src, len);
+    ctx->src_pos += len;
+    ctx->dst_pos += len;
+
+    return true;
+}
+
+static bool read_token(salz_io_ctx *ctx, uint8_t *res)
+{
+    if (unlikely(!read_bit(ctx, res)))
+        return false;
+
+    return true;
+}
+
+static bool read_factor_offs(salz_io_ctx *ctx, uint32_t *res)
+{
+    uint32_t var;
+    uint8_t fixed;
+
+    if (unlikely(!read_vnibble(ctx, &var)))
+        return false;
+    if (unlikely(!read_u8(ctx, &fixed)))
+        return false;
+
+    *res = ((var << 8) | fixed) + FACTOR_OFFSET_MIN;
+
+    return true;
+}
+
+static bool read_factor_len(salz_io_ctx *ctx, uint32_t *res)
+{
+    if (unlikely(!read_gr3(ctx, res)))
+        return false;
+
+    *res += FACTOR_LENGTH_MIN;
+
+    return true;
+}
+
+static bool cpy_factor_exact(salz_io_ctx *ctx, uint32_t factor_offs,
+    uint32_t factor_len)
+{
+    /* Last factor of partial output is cut short */
+    if (ctx->dst_pos + factor_len > ctx->dst_len) {
+        if (!ctx->partial)
+            return false;
+        factor_len = (uint32_t)(ctx->dst_len - ctx->dst_pos);
+    }
+
+    for (size_t i = ctx->dst_pos; i < ctx->dst_pos + factor_len; i++)
+        ctx->dst[i] = ctx->dst[i - factor_offs];
+
+    ctx->dst_pos += factor_len;
+
+    return true;
+}
+
+static bool cpy_factor(salz_io_ctx *ctx)
+{
+    uint32_t factor_offs;
+    uint32_t factor_len;
+    uint8_t *src;
+    uint8_t *dst;
+    uint8_t *end;
+
+    static const int inc1[8] = { 0, 1, 2, 1, 4, 4, 4, 4 };
     static const int inc2[8] = { 0, 1, 2, 2, 4, 3, 2, 1 };
 
     if (unlikely(!read_factor_offs(ctx, &factor_offs)))
@@ -1139,9 +1810,13 @@ static bool cpy_factor(salz_io_ctx *ctx)
     if (unlikely(!read_factor_len(ctx, &factor_len)))
         return false;
 
-    if (unlikely(ctx->dst_pos + factor_len > ctx->dst_len))
+    if (unlikely(factor_offs > ctx->dst_pos))
         return false;
 
+    /* Copying 8 bytes at a time would overrun end of output buffer */
+    if (unlikely(ctx->dst_pos + factor_len + 8 > ctx->dst_len))
+        return cpy_factor_exact(ctx, factor_offs, factor_len);
+
     dst = &ctx->dst[ctx->dst_pos];
     src = dst - factor_offs;
     end = dst + factor_len;
@@ -1167,11 +1842,40 @@ static bool cpy_factor(salz_io_ctx *ctx)
     return true;
 }
 
+static bool restart_decoding(salz_io_ctx *ctx)
+{
+    size_t restart_pos = read_u32_raw(ctx->restarts, 4 * ctx->restart_idx);
+
+    if (ctx->dst_pos != ctx->restart_next || ctx->src_pos != restart_pos)
+        return false;
+
+    /* Rest of buffered bitfield was left unfilled */
+    ctx->bits_avail = 0;
+
+    next_restart(ctx);
+    ctx->dst_mark = min(ctx->restart_next, ctx->dst_len);
+
+    return true;
+}
+
 static bool decode(salz_io_ctx *ctx)
 {
+    /* Both restart points and full output are caught with a single check */
+    ctx->dst_mark = min(ctx->restart_next, ctx->dst_len);
+
     while (!input_processed(ctx)) {
         uint8_t token;
 
+        if (unlikely(ctx->dst_pos >= ctx->dst_mark)) {
+            if (ctx->dst_pos >= ctx->dst_len)
+                break;
+
+            if (!restart_decoding(ctx)) {
+                debug("Restart point missed");
+                return false;
+            }
+        }
+
         if (unlikely(!read_token(ctx, &token))) {
             debug("Couldn't read token");
             return false;
@@ -1188,41 +1892,824 @@ static bool decode(salz_io_ctx *ctx)
         }
     }
 
+    if (!input_processed(ctx) && !ctx->partial) {
+        debug("Output buffer too short");
+        return false;
+    }
+
     return true;
 }
 
-int salz_decode_safe(const uint8_t *src, size_t src_len, uint8_t *dst,
-    size_t *dst_len)
+int salz_decode_prefix_safe(const uint8_t *src, size_t src_len, uint8_t *dst,
+    size_t prefix_len, size_t *dst_len)
 {
-    salz_io_ctx *ctx = NULL;
-    int ret = 0;
+    salz_io_ctx ctx;
 
     if (src == NULL || dst == NULL) {
         debug("NULL I/O buffer(s)");
         return -1;
     }
 
-    ctx = decode_ctx_create(src, src_len, dst, *dst_len);
-    if (ctx == NULL) {
+    if (!decode_ctx_init(&ctx, src, src_len, dst, prefix_len, *dst_len,
+                         false)) {
+        debug("Couldn't initialize decoding context");
+        return -1;
+    }
+
+    if (ctx.stream_type == SALZ_STREAM_TYPE_PLAIN && !cpy_plain_stream(&ctx)) {
+        debug("Couldn't copy plain stream");
+        return -1;
+    }
+
+    if (ctx.stream_type != SALZ_STREAM_TYPE_PLAIN && !decode(&ctx)) {
+        debug("Decoding failed");
+        return -1;
+    }
+
+    if (ctx.stream_type == SALZ_STREAM_TYPE_SALZ_RESTART &&
+        ctx.dst_pos - ctx.prefix_len != ctx.plain_len) {
+        debug("Decoded length differs from restart table");
+        return -1;
+    }
+
+    *dst_len = ctx.dst_pos - ctx.prefix_len;
+
+    return 0;
+}
+
+int salz_decode_safe(const uint8_t *src, size_t src_len, uint8_t *dst,
+    size_t *dst_len)
+{
+    return salz_decode_prefix_safe(src, src_len, dst, 0, dst_len);
+}
+
+int salz_decode_partial_safe(const uint8_t *src, size_t src_len, uint8_t *dst,
+    size_t *dst_len, size_t *src_used)
+{
+    salz_io_ctx ctx;
+
+    if (src == NULL || dst == NULL || src_used == NULL) {
+        debug("NULL I/O buffer(s) or result");
+        return -1;
+    }
+
+    if (!decode_ctx_init(&ctx, src, src_len, dst, 0, *dst_len, true)) {
         debug("Couldn't initialize decoding context");
         return -1;
     }
 
-    if (ctx->stream_type == SALZ_STREAM_TYPE_PLAIN && !cpy_plain_stream(ctx)) {
+    if (ctx.stream_type == SALZ_STREAM_TYPE_PLAIN && !cpy_plain_stream(&ctx)) {
         debug("Couldn't copy plain stream");
-        ret = -1;
-        goto out;
+        return -1;
+    }
+
+    if (ctx.stream_type != SALZ_STREAM_TYPE_PLAIN && !decode(&ctx)) {
+        debug("Decoding failed");
+        return -1;
+    }
+
+    /* Segment may only end short of output buffer at the end of stream */
+    if (ctx.truncated && ctx.dst_pos < ctx.dst_len) {
+        debug("Stream is truncated");
+        return -1;
+    }
+
+    *dst_len = ctx.dst_pos;
+    *src_used = (size_t)(ctx.src - src) + ctx.src_pos;
+
+    return 0;
+}
+
+static bool decode_intervals(salz_io_ctx *ctx, size_t first, size_t last,
+    uint8_t *buf, size_t buf_len)
+{
+    /*
+     * Intervals from restart point first to the one following restart point
+     * last are decoded into buffer, as if they were a segment on their own,
+     * until buffer is full. Restart point 0 is beginning of segment.
+     */
+
+    size_t src_len = ctx->src_len;
+
+    if (last < ctx->restarts_cnt)
+        ctx->src_len = read_u32_raw(ctx->restarts, 4 * last);
+    if (first)
+        ctx->src_pos = read_u32_raw(ctx->restarts, 4 * (first - 1));
+
+    if (ctx->src_len > src_len || ctx->src_pos > ctx->src_len) {
+        debug("Invalid restart table");
+        return false;
     }
 
-    if (ctx->stream_type == SALZ_STREAM_TYPE_SALZ && !decode(ctx)) {
+    ctx->dst = buf;
+    ctx->dst_len = buf_len;
+    ctx->dst_pos = 0;
+    ctx->restart_idx = first;
+    ctx->restart_next = first < ctx->restarts_cnt ? ctx->restart_len : SIZE_MAX;
+    /* Last interval is decoded only up to end of buffer */
+    ctx->partial = true;
+
+    if (!decode(ctx) || ctx->dst_pos != buf_len) {
         debug("Decoding failed");
-        ret = -1;
-        goto out;
+        return false;
+    }
+
+    return true;
+}
+
+static bool range_ctx_init(salz_io_ctx *ctx, const uint8_t *src,
+    size_t src_len, size_t offs, size_t *len)
+{
+    /* Length of range is cut short at the end of segment */
+
+    if (!decode_ctx_init(ctx, src, src_len, NULL, 0, 0, false)) {
+        debug("Couldn't initialize decoding context");
+        return false;
+    }
+
+    if (ctx->stream_type == SALZ_STREAM_TYPE_PLAIN) {
+        *len = offs < ctx->src_len ? min(*len, ctx->src_len - offs) : 0;
+        return true;
+    }
+
+    if (ctx->stream_type != SALZ_STREAM_TYPE_SALZ_RESTART) {
+        debug("Stream has no restart points");
+        return false;
+    }
+
+    *len = offs < ctx->plain_len ? min(*len, ctx->plain_len - offs) : 0;
+
+    return true;
+}
+
+static size_t range_head_len(const salz_io_ctx *ctx, size_t offs, size_t len)
+{
+    /*
+     * Range, which begins past a restart point, needs the interval from that
+     * restart point up to the end of range, or of the interval, decoded aside
+     */
+
+    size_t first;
+    size_t begin;
+    size_t end;
+
+    if (ctx->stream_type == SALZ_STREAM_TYPE_PLAIN || len == 0)
+        return 0;
+
+    first = min(offs / ctx->restart_len, ctx->restarts_cnt);
+    begin = first * ctx->restart_len;
+    end = first < ctx->restarts_cnt ? begin + ctx->restart_len : ctx->plain_len;
+
+    if (offs == begin)
+        return 0;
+
+    return min(end, offs + len) - begin;
+}
+
+size_t salz_decode_range_buf_len(const uint8_t *src, size_t src_len,
+    size_t offs, size_t len)
+{
+    salz_io_ctx ctx;
+
+    /* Invalid stream fails once decoded */
+    if (src == NULL || !range_ctx_init(&ctx, src, src_len, offs, &len))
+        return 0;
+
+    return range_head_len(&ctx, offs, len);
+}
+
+int salz_decode_range_buf_safe(const uint8_t *src, size_t src_len,
+    size_t offs, uint8_t *dst, size_t *dst_len, uint8_t *buf, size_t buf_len)
+{
+    salz_io_ctx ctx;
+    salz_io_ctx head_ctx;
+    size_t len;
+    size_t head_len;
+    size_t first;
+    size_t last;
+    size_t skip;
+    size_t done = 0;
+    uint8_t *head = buf;
+
+    if (src == NULL || dst == NULL || dst_len == NULL) {
+        debug("NULL I/O buffer(s)");
+        return -1;
+    }
+
+    len = *dst_len;
+    if (!range_ctx_init(&ctx, src, src_len, offs, &len))
+        return -1;
+
+    if (ctx.stream_type == SALZ_STREAM_TYPE_PLAIN) {
+        if (len)
+            salz_memcpy(dst, ctx.src + offs, len);
+        *dst_len = len;
+        return 0;
+    }
+
+    if (len == 0) {
+        *dst_len = 0;
+        return 0;
+    }
+
+    head_len = range_head_len(&ctx, offs, len);
+    if (head_len > buf_len && buf != NULL) {
+        debug("Buffer too short (expected: %zu, have: %zu)", head_len,
+              buf_len);
+        return -1;
+    }
+
+    if (head_len && buf == NULL && (head = malloc(head_len)) == NULL) {
+        debug("Couldn't allocate memory (%zu bytes)", head_len);
+        return -1;
+    }
+
+    /* Restart points nearest before and after the range */
+    first = min(offs / ctx.restart_len, ctx.restarts_cnt);
+    last = min((offs + len - 1) / ctx.restart_len, ctx.restarts_cnt);
+
+    /* Part of first interval preceding the range is decoded aside */
+    if (head_len) {
+        head_ctx = ctx;
+        skip = offs - first * ctx.restart_len;
+        if (!decode_intervals(&head_ctx, first, first, head, head_len))
+            goto fail;
+
+        done = head_len - skip;
+        salz_memcpy(dst, head + skip, done);
+        first += 1;
+    }
+
+    /* Rest of intervals are decoded in place */
+    if (done < len && !decode_intervals(&ctx, first, last, dst + done,
+                                        len - done))
+        goto fail;
+
+    if (head != buf)
+        free(head);
+    *dst_len = len;
+
+    return 0;
+
+fail:
+    if (head != buf)
+        free(head);
+
+    return -1;
+}
+
+int salz_decode_range_safe(const uint8_t *src, size_t src_len, size_t offs,
+    uint8_t *dst, size_t *dst_len)
+{
+    return salz_decode_range_buf_safe(src, src_len, offs, dst, dst_len, NULL,
+                                      0);
+}
+
+/**********************
+ * Dictionary functions
+ **********************/
+
+static bool dict_reserve(salz_dict *dict, size_t len)
+{
+    uint8_t *buf;
+
+    if (dict->dict_len + len <= dict->buf_cap)
+        return true;
+
+    buf = realloc(dict->buf, dict->dict_len + len);
+    if (buf == NULL) {
+        debug("Couldn't allocate memory (%zu bytes)", dict->dict_len + len);
+        return false;
+    }
+
+    dict->buf = buf;
+    dict->buf_cap = dict->dict_len + len;
+
+    return true;
+}
+
+salz_dict *salz_dict_create(const uint8_t *dict_buf, size_t dict_len)
+{
+    salz_dict *dict;
+
+    if (dict_buf == NULL || dict_len == 0 || dict_len > SALZ_SEGMENT_LEN_MAX) {
+        debug("Invalid dictionary (%zu bytes)", dict_len);
+        return NULL;
+    }
+
+    dict = calloc(1, sizeof(*dict));
+    if (dict == NULL) {
+        debug("Couldn't allocate memory (%zu bytes)", sizeof(*dict));
+        return NULL;
+    }
+
+    dict->dict_len = dict_len;
+    if (!dict_reserve(dict, 0))
+        goto fail;
+    memcpy(dict->buf, dict_buf, dict_len);
+
+    dict->sa = malloc(dict_len * sizeof(*dict->sa));
+    if (dict->sa == NULL) {
+        debug("Couldn't allocate memory (%zu bytes)",
+              dict_len * sizeof(*dict->sa));
+        goto fail;
+    }
+
+    if (libsais(dict->buf, dict->sa, dict_len, 0, NULL) < 0) {
+        debug("Couldn't build SA");
+        goto fail;
+    }
+
+    return dict;
+
+fail:
+    salz_dict_destroy(dict);
+    return NULL;
+}
+
+void salz_dict_destroy(salz_dict *dict)
+{
+    if (dict != NULL) {
+        workspace_release(&dict->ws);
+        free(dict->sa);
+        free(dict->buf);
+        free(dict);
+    }
+}
+
+int salz_encode_dict_safe(salz_dict *dict, const uint8_t *src, size_t src_len,
+    uint8_t *dst, size_t *dst_len)
+{
+    salz_io_ctx ctx;
+    int ret;
+
+    if (dict == NULL || src == NULL || dst == NULL || dst_len == NULL) {
+        debug("NULL dictionary or I/O buffer(s)");
+        return -1;
+    }
+
+    if (src_len > SALZ_SEGMENT_LEN_MAX) {
+        debug("Segment too long (%zu bytes)", src_len);
+        return -1;
+    }
+
+    /* Segment must have positions to encode besides its last 8 bytes */
+    count(&counters.segments);
+
+    if (src_len <= 8)
+        return encode_plain(src, src_len, dst, dst_len);
+
+    /* Segment is placed right after dictionary, which becomes its history */
+    if (!dict_reserve(dict, src_len))
+        return -1;
+    memcpy(dict->buf + dict->dict_len, src, src_len);
+
+    if (!encode_ctx_init(&ctx, dict->buf, dict->dict_len, src_len, dst,
+                         *dst_len) ||
+        !encode_ctx_reserve(&ctx, &dict->ws, dict->dict_len)) {
+        debug("Couldn't initialize encoding context");
+        return -1;
+    }
+
+    ret = encode(&ctx, dict);
+    if (ret == 0)
+        *dst_len = ctx.dst_pos;
+
+    encode_ctx_fini(&ctx);
+    return ret;
+}
+
+int salz_decode_dict_safe(salz_dict *dict, const uint8_t *src, size_t src_len,
+    uint8_t *dst, size_t *dst_len)
+{
+    salz_io_ctx ctx;
+    size_t len;
+
+    if (dict == NULL || src == NULL || dst == NULL || dst_len == NULL) {
+        debug("NULL dictionary or I/O buffer(s)");
+        return -1;
+    }
+
+    /* Dictionary grows by what segment may decode to, not by space of caller */
+    if (!decode_ctx_init(&ctx, src, src_len, NULL, 0, 0, false)) {
+        debug("Couldn't initialize decoding context");
+        return -1;
+    }
+    len = min(*dst_len, decoded_len_max(&ctx));
+
+    /* Segment is decoded right after dictionary and copied out of there */
+    if (!dict_reserve(dict, len))
+        return -1;
+
+    if (salz_decode_prefix_safe(src, src_len, dict->buf, dict->dict_len,
+                                &len) != 0)
+        return -1;
+
+    memcpy(dst, dict->buf + dict->dict_len, len);
+    *dst_len = len;
+
+    return 0;
+}
+
+/*****************
+ * Batch functions
+ *****************/
+
+/* Batch shared by workers */
+struct batch {
+    /* Items of batch */
+    struct salz_batch_item *items;
+    /* Number of items */
+    size_t items_cnt;
+    /* Next item to be taken by a worker */
+    size_t next;
+    /* Whether items are encoded or decoded */
+    bool encode;
+    /* Number of failed items */
+    size_t failed_cnt;
+};
+
+static void *batch_worker(void *arg)
+{
+    struct batch *batch = arg;
+    struct salz_workspace ws;
+    size_t failed_cnt = 0;
+    size_t i;
+
+    /* Workspace is reused for all items taken by this worker */
+    memset(&ws, 0, sizeof(ws));
+
+    while ((i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) <
+           batch->items_cnt) {
+        struct salz_batch_item *item = &batch->items[i];
+
+        if (item->src == NULL || item->dst == NULL) {
+            item->ret = -1;
+        } else if (batch->encode) {
+            item->ret = encode_prefix(item->src, 0, item->src_len, item->dst,
+                                      &item->dst_len, &ws, NULL);
+        } else {
+            item->ret = salz_decode_safe(item->src, item->src_len, item->dst,
+                                         &item->dst_len);
+        }
+
+        failed_cnt += item->ret != 0;
+    }
+
+    workspace_release(&ws);
+    __atomic_fetch_add(&batch->failed_cnt, failed_cnt, __ATOMIC_RELAXED);
+
+    return NULL;
+}
+
+static int run_batch(struct batch *batch, unsigned threads)
+{
+    pthread_t tids[SALZ_BATCH_THREADS_MAX];
+    size_t tids_cnt = 0;
+
+    /* Calling thread is one of the workers */
+    threads = min(threads, SALZ_BATCH_THREADS_MAX);
+    while (tids_cnt + 1 < threads && tids_cnt + 1 < batch->items_cnt) {
+        if (pthread_create(&tids[tids_cnt], NULL, batch_worker, batch) != 0) {
+            debug("Couldn't create worker thread");
+            break;
+        }
+        tids_cnt += 1;
+    }
+
+    batch_worker(batch);
+
+    for (size_t i = 0; i < tids_cnt; i++)
+        pthread_join(tids[i], NULL);
+
+    return batch->failed_cnt ? -1 : 0;
+}
+
+int salz_encode_batch(struct salz_batch_item *items, size_t items_cnt,
+    unsigned threads)
+{
+    struct batch batch = {
+        .items = items,
+        .items_cnt = items_cnt,
+        .next = 0,
+        .encode = true,
+        .failed_cnt = 0,
+    };
+
+    if (items == NULL && items_cnt) {
+        debug("NULL batch items");
+        return -1;
+    }
+
+    return run_batch(&batch, threads);
+}
+
+int salz_decode_batch(struct salz_batch_item *items, size_t items_cnt,
+    unsigned threads)
+{
+    struct batch batch = {
+        .items = items,
+        .items_cnt = items_cnt,
+        .next = 0,
+        .encode = false,
+        .failed_cnt = 0,
+    };
+
+    if (items == NULL && items_cnt) {
+        debug("NULL batch items");
+        return -1;
+    }
+
+    return run_batch(&batch, threads);
+}
+
+/********************
+ * Adaptive splitting
+ ********************/
+
+/* Granularity of segment boundaries chosen by adaptive splitting */
+#define SPLIT_WINDOW_LEN (4096)
+
+static uint64_t window_cost(salz_io_ctx *ctx, size_t begin, size_t end)
+{
+    /*
+     * Cost of optimal parse from a position to the end of segment is left in
+     * auxiliary array. Their difference approximates cost of the window.
+     */
+
+    int32_t *aux = ctx->aux;
+    size_t last = ctx->src_len;
+    uint64_t cost_begin = begin ? (uint32_t)aux[2 + 4 * min(begin, last)] :
+                          9 + (uint32_t)aux[2 + 4 * 1];
+    uint64_t cost_end = end < last ? (uint32_t)aux[2 + 4 * end] : 0;
+
+    /* Last 8 bytes are always literals */
+    if (end > last)
+        cost_begin += 9 * (end - max(begin, last));
+
+    return cost_begin - cost_end;
+}
+
+static size_t plan_splits(salz_io_ctx *ctx, struct salz_split *splits,
+    size_t splits_cap)
+{
+    /*
+     * Windows, which cost more encoded than plain, are split off and stored
+     * plain. Runs of such windows shorter than SALZ_ADAPTIVE_SEGMENT_LEN_MIN
+     * aren't worth it, as literals cost only a bit more than plain bytes.
+     * Compressible windows are kept together, as segment boundaries cut off
+     * history of factors.
+     */
+
+    size_t plain_len = ctx->src_len + 8;
+    size_t splits_cnt = 0;
+    size_t run_begin = 0;
+    bool run_plain = false;
+
+    for (size_t pos = 0; ; pos += SPLIT_WINDOW_LEN) {
+        bool done = pos >= plain_len;
+        size_t end = min(pos + SPLIT_WINDOW_LEN, plain_len);
+        bool plain = !done &&
+                     window_cost(ctx, pos, end) > 8 * (uint64_t)(end - pos);
+
+        if (!done && plain == run_plain)
+            continue;
+
+        /* Windows of a short plain run are absorbed by compressible ones */
+        if (run_plain && min(pos, plain_len) - run_begin <
+                         SALZ_ADAPTIVE_SEGMENT_LEN_MIN) {
+            run_plain = false;
+            if (!done)
+                continue;
+        }
+
+        /* Compressible run may continue the previous one */
+        if (splits_cnt && !run_plain && !splits[splits_cnt - 1].plain) {
+            splits_cnt -= 1;
+        } else {
+            if (splits_cnt == splits_cap)
+                return 0;
+            splits[splits_cnt].offs = run_begin;
+        }
+
+        splits[splits_cnt].plain_len = min(pos, plain_len) -
+                                       splits[splits_cnt].offs;
+        splits[splits_cnt].plain = run_plain;
+        splits_cnt += 1;
+
+        if (done)
+            break;
+
+        run_begin = pos;
+        run_plain = plain;
+    }
+
+    return splits_cnt;
+}
+
+static bool stored_plain(const uint8_t *dst)
+{
+    uint8_t stream_type = read_u32_raw(dst, 0) >> 24;
+
+    return (stream_type & ~SALZ_STREAM_FLAG_LONG) == SALZ_STREAM_TYPE_PLAIN;
+}
+
+static int encode_split(const uint8_t *src, struct salz_split *split,
+    uint8_t *dst, size_t *dst_len, struct salz_workspace *ws,
+    const struct salz_encode_opts *opts)
+{
+    salz_io_ctx ctx;
+    int ret;
+
+    if (split->plain || split->plain_len <= 8) {
+        split->plain = true;
+        return encode_plain(src, split->plain_len, dst, dst_len);
+    }
+
+    if (!encode_ctx_init(&ctx, src, 0, split->plain_len, dst, *dst_len) ||
+        !encode_ctx_opts(&ctx, opts) ||
+        !encode_ctx_reserve(&ctx, ws, 0)) {
+        debug("Couldn't initialize encoding context");
+        return -1;
+    }
+    ctx.uncounted = true;
+
+    ret = encode(&ctx, NULL);
+    if (ret == 0) {
+        *dst_len = ctx.dst_pos;
+        split->plain = stored_plain(dst);
+    }
+
+    encode_ctx_fini(&ctx);
+    return ret;
+}
+
+/* Time and workspace spent on split segments count, even if discarded */
+static void stats_merge(struct salz_stats *stats,
+    const struct salz_stats *split_stats, bool emitted)
+{
+    for (size_t i = 0; i < SALZ_PHASE_MAX; i++)
+        stats->phase_ns[i] += split_stats->phase_ns[i];
+    stats->workspace_len = max(stats->workspace_len,
+                               split_stats->workspace_len);
+
+    if (!emitted)
+        return;
+
+    stats->literals_cnt += split_stats->literals_cnt;
+    stats->factors_cnt += split_stats->factors_cnt;
+    stats->factors_len += split_stats->factors_len;
+    stats->factor_len_max = max(stats->factor_len_max,
+                                split_stats->factor_len_max);
+    for (size_t i = 0; i < SALZ_STATS_OFFS_BUCKETS; i++)
+        stats->offs_hist[i] += split_stats->offs_hist[i];
+    for (size_t i = 0; i < SALZ_STATS_LEN_BUCKETS; i++)
+        stats->len_hist[i] += split_stats->len_hist[i];
+    stats->token_bits += split_stats->token_bits;
+    stats->literal_bits += split_stats->literal_bits;
+    stats->offs_bits += split_stats->offs_bits;
+    stats->len_bits += split_stats->len_bits;
+    stats->cost_bits += split_stats->cost_bits;
+    stats->parsed_len += split_stats->parsed_len;
+}
+
+int salz_encode_adaptive(const uint8_t *src, size_t src_len, uint8_t *dst,
+    size_t *dst_len, struct salz_split *splits, size_t *splits_cnt,
+    const struct salz_encode_opts *opts)
+{
+    salz_io_ctx ctx;
+    struct salz_workspace ws;
+    struct salz_encode_opts split_opts;
+    struct salz_stats split_stats;
+    size_t cnt = 0;
+    size_t early_cnt = 0;
+    size_t late_cnt = 0;
+    size_t dst_pos = 0;
+    int ret = 0;
+
+    if (src == NULL || dst == NULL || splits == NULL || *splits_cnt == 0) {
+        debug("NULL I/O buffer(s) or no room for splits");
+        return -1;
+    }
+
+    if (opts == NULL)
+        opts = &default_opts;
+
+    if (!opts_valid(opts))
+        return -1;
+
+    memset(&ws, 0, sizeof(ws));
+    stats_reset(opts);
+
+    /* Split segments are tallied apart, until they are known to be kept */
+    split_opts = *opts;
+    memset(&split_stats, 0, sizeof(split_stats));
+    if (stats_requested(opts->stats))
+        split_opts.stats = &split_stats;
+
+    /* Segment too short to be split or incompressible is encoded as a whole */
+    if (src_len < 2 * SALZ_ADAPTIVE_SEGMENT_LEN_MIN || *splits_cnt == 1 ||
+        src_len > SALZ_SEGMENT_LEN_MAX ||
+        (opts->plain_entropy_min &&
+         is_incompressible(src, 0, src_len, opts->plain_entropy_min)))
+        goto whole;
+
+    if (!encode_ctx_init(&ctx, src, 0, src_len, dst, *dst_len) ||
+        !encode_ctx_opts(&ctx, opts) ||
+        !encode_ctx_reserve(&ctx, NULL, 0)) {
+        debug("Couldn't initialize encoding context");
+        encode_ctx_fini(&ctx);
+        return -1;
+    }
+
+    if (!parse(&ctx, NULL)) {
+        encode_ctx_fini(&ctx);
+        return -1;
+    }
+
+    cnt = plan_splits(&ctx, splits, *splits_cnt);
+
+    /*
+     * Split segments lose history of each other, which may cost more than
+     * storing parts plain saves. Split segments are encoded in a workspace of
+     * their own, so that parse over whole input can still be emitted, if
+     * splitting doesn't pay off.
+     */
+    if (cnt > 1) {
+        size_t whole_len = min(encoded_len(&ctx), ctx.hdr_len + src_len);
+
+        for (size_t i = 0; i < cnt && ret == 0 && dst_pos < whole_len; i++) {
+            struct salz_split *split = &splits[i];
+            size_t len = *dst_len - dst_pos;
+
+            early_cnt += split->plain;
+            ret = encode_split(src + split->offs, split, dst + dst_pos, &len,
+                               &ws, &split_opts);
+            late_cnt += split->plain;
+
+            split->encoded_len = len;
+            dst_pos += len;
+        }
+
+        if (ret != 0 || dst_pos >= whole_len) {
+            cnt = 1;
+            ret = 0;
+        }
     }
 
-    *dst_len = ctx->dst_pos;
+    workspace_release(&ws);
+
+    if (cnt > 1) {
+        encode_ctx_fini(&ctx);
+
+        __atomic_fetch_add(&counters.segments, cnt, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&counters.plain_early, early_cnt, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&counters.plain_late, late_cnt - early_cnt,
+                           __ATOMIC_RELAXED);
+
+        if (stats_requested(opts->stats)) {
+            stats_merge(opts->stats, &split_stats, true);
+            opts->stats->segments = cnt;
+            opts->stats->plain_early = early_cnt;
+            opts->stats->plain_late = late_cnt - early_cnt;
+            opts->stats->plain_len = src_len;
+            opts->stats->encoded_len = dst_pos;
+        }
+
+        *dst_len = dst_pos;
+        *splits_cnt = cnt;
+
+        return 0;
+    }
+
+    /* Without anything worth splitting off, parse is emitted as it is */
+    count(&counters.segments);
+    if (stats_requested(opts->stats))
+        stats_merge(opts->stats, &split_stats, false);
+
+    ret = finish(&ctx);
+    if (ret == 0) {
+        stats_segment(opts->stats, src_len, ctx.dst_pos);
+        splits[0].offs = 0;
+        splits[0].plain_len = src_len;
+        splits[0].plain = stored_plain(dst);
+        splits[0].encoded_len = ctx.dst_pos;
+        *dst_len = ctx.dst_pos;
+        *splits_cnt = 1;
+    }
+
+    encode_ctx_fini(&ctx);
+    return ret;
+
+whole:
+    ret = encode_prefix(src, 0, src_len, dst, dst_len, NULL, opts);
+    if (ret == 0) {
+        splits[0].offs = 0;
+        splits[0].plain_len = src_len;
+        splits[0].plain = stored_plain(dst);
+        splits[0].encoded_len = *dst_len;
+        *splits_cnt = 1;
+    }
 
-out:
-    decode_ctx_destroy(ctx);
     return ret;
 }
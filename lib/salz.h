@@ -10,11 +10,28 @@
 #ifndef SALZ_H
 #define SALZ_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 #include "common.h"
 
+/*
+ * Maximum length of a plain segment (in bytes)
+ *
+ * Optimal parse keeps its bit costs in 32 bits, and a segment of literals
+ * only costs 9 bits per byte.
+ */
+#define SALZ_SEGMENT_LEN_MAX (1u << 28)
+
+/*
+ * Maximum length of a small segment (in bytes)
+ *
+ * Small segments are encoded without heap allocations, using a hash matcher
+ * instead of suffix array.
+ */
+#define SALZ_SMALL_SEGMENT_LEN_MAX (1024u)
+
 /*
  * Get worst case length for encoded segment
  *
@@ -22,9 +39,9 @@
  *
  * @return                Worst case length for encoded segment
  */
-static inline int salz_encoded_len_max(size_t plain_len)
+static inline size_t salz_encoded_len_max(size_t plain_len)
 {
-    return 4 + plain_len + roundup(plain_len, 64) / 8;
+    return 8 + plain_len + roundup(plain_len, 64) / 8;
 }
 
 /*
@@ -57,4 +74,636 @@ extern int salz_encode_safe(const uint8_t *src, size_t src_len,
 extern int salz_decode_safe(const uint8_t *src, size_t src_len,
     uint8_t *dst, size_t *dst_len);
 
+/*
+ * Decode beginning of SALZ encoded segment
+ *
+ * Decoding stops once @p dst_len bytes are decoded, cutting the last factor
+ * short as needed, so that no more of the segment is read than it takes.
+ * Encoded segment may be truncated, as long as it covers the decoded part.
+ *
+ * @param[in]     src       SALZ encoded segment, or beginning of it
+ * @param[in]     src_len   Length of @p src (in bytes)
+ * @param[in]     dst       Preallocated space for decoded data
+ * @param[in/out] dst_len   Length of data to decode (in bytes) [in]
+ *                          Length of data decoded, which ends short at the
+ *                          end of segment (in bytes) [out]
+ * @param[out]    src_used  Length of @p src read (in bytes)
+ *
+ * @return                  0, if successful
+ *                          -1, otherwise
+ */
+extern int salz_decode_partial_safe(const uint8_t *src, size_t src_len,
+    uint8_t *dst, size_t *dst_len, size_t *src_used);
+
+/*
+ * Encode plain segment with SALZ, using data preceding it as history
+ *
+ * Factors of the segment may refer to history, thus the same history must be
+ * given when decoding the segment.
+ *
+ * @param[in]     src         History immediately followed by plain segment
+ * @param[in]     prefix_len  Length of history in @p src (in bytes)
+ * @param[in]     src_len     Length of plain segment in @p src (in bytes)
+ * @param[in]     dst         Preallocated space for encoded segment
+ * @param[in/out] dst_len     Space available in @p dst (in bytes) [in]
+ *                            Length of encoded segment (in bytes) [out]
+ *
+ * @return                    0, if successful
+ *                            -1, otherwise
+ */
+extern int salz_encode_prefix_safe(const uint8_t *src, size_t prefix_len,
+    size_t src_len, uint8_t *dst, size_t *dst_len);
+
+/* Default for salz_encode_opts.plain_entropy_min (in millibits per byte) */
+#define SALZ_PLAIN_ENTROPY_MIN_DEFAULT (7900u)
+
+/* Minimum for salz_encode_opts.restart_len (in bytes) */
+#define SALZ_RESTART_LEN_MIN (4096u)
+
+/* Range and default of salz_encode_opts.effort */
+#define SALZ_EFFORT_MIN     (1u)
+#define SALZ_EFFORT_MAX     (9u)
+#define SALZ_EFFORT_DEFAULT (5u)
+
+/* Phases of encoding reported through salz_encode_opts.phase_cb */
+enum salz_phase {
+    SALZ_PHASE_SUFFIX_ARRAY,
+    SALZ_PHASE_PSVNSV_ARRAY,
+    SALZ_PHASE_FACTORIZE,
+    SALZ_PHASE_OPTIMIZE,
+    SALZ_PHASE_EMIT,
+    /* Encoding of segment is over */
+    SALZ_PHASE_DONE,
+    SALZ_PHASE_MAX,
+};
+
+/* Number of buckets in salz_stats.offs_hist */
+#define SALZ_STATS_OFFS_BUCKETS (30)
+/* Number of buckets in salz_stats.len_hist */
+#define SALZ_STATS_LEN_BUCKETS (30)
+
+/*
+ * Statistics of a call encoding one or more segments, which is collected
+ * through salz_encode_opts.stats. Library must be built with SALZ_STATS.
+ */
+struct salz_stats {
+    /* Segments encoded */
+    uint64_t segments;
+    /* Segments stored plain without encoding, being short or incompressible */
+    uint64_t plain_early;
+    /* Segments stored plain after their optimal parse didn't pay off */
+    uint64_t plain_late;
+    /* Length of plain input (in bytes) */
+    uint64_t plain_len;
+    /* Length of encoded output (in bytes) */
+    uint64_t encoded_len;
+    /* Literals emitted */
+    uint64_t literals_cnt;
+    /* Factors emitted */
+    uint64_t factors_cnt;
+    /* Total length of factors (in bytes), mean being this per factor */
+    uint64_t factors_len;
+    /* Length of the longest factor (in bytes) */
+    uint64_t factor_len_max;
+    /* Factors by offset, bucket i holding offsets in [2^i, 2^(i+1)) */
+    uint64_t offs_hist[SALZ_STATS_OFFS_BUCKETS];
+    /* Factors by length, bucket i holding lengths in [2^i, 2^(i+1)) */
+    uint64_t len_hist[SALZ_STATS_LEN_BUCKETS];
+    /* Bits spent on tokens telling literals and factors apart */
+    uint64_t token_bits;
+    /* Bits spent on literals */
+    uint64_t literal_bits;
+    /* Bits spent on factor offsets */
+    uint64_t offs_bits;
+    /* Bits spent on factor lengths */
+    uint64_t len_bits;
+    /*
+     * Cost of optimal parses (in bits) as seen by the optimizer, which
+     * parsed_len exceeds by headers, restart tables and padding of bitfields
+     * to whole bytes
+     */
+    uint64_t cost_bits;
+    /* Length of segments emitted encoded rather than plain (in bytes) */
+    uint64_t parsed_len;
+    /* Time spent in each phase of encoding (in ns) */
+    uint64_t phase_ns[SALZ_PHASE_MAX];
+    /* Peak workspace of a single parse (in bytes), small ones using stack */
+    uint64_t workspace_len;
+};
+
+/* Options for encoding */
+struct salz_encode_opts {
+    /*
+     * Estimated entropy (in millibits per byte), at or above which a segment
+     * with hardly any repetition is stored plain without attempting to
+     * encode it. 0 disables the detection.
+     */
+    uint32_t plain_entropy_min;
+    /*
+     * Distance between restart points within encoded segment (in bytes), at
+     * which decoding of a range may begin. Data between restart points is
+     * encoded on its own, which costs ratio. 0 disables restart points.
+     */
+    uint32_t restart_len;
+    /*
+     * Effort of matching and parsing from SALZ_EFFORT_MIN to SALZ_EFFORT_MAX,
+     * or 0 for SALZ_EFFORT_DEFAULT. Lower efforts weigh fewer candidates at
+     * each position, and higher ones weigh shorter lengths of factors found
+     * as well, which trades speed for ratio.
+     */
+    uint32_t effort;
+    /*
+     * Called as each phase of encoding begins, or NULL. Phases may repeat
+     * within a segment, e.g. once for each interval between restart points.
+     * Segments stored plain without encoding them report no phases.
+     */
+    void (*phase_cb)(enum salz_phase phase, void *arg);
+    /* Argument passed to phase_cb */
+    void *phase_arg;
+    /*
+     * Statistics of encoding, which are reset and filled by the call, or
+     * NULL. Collecting them costs a pass over the parse of each segment.
+     * Requesting them fails, unless library was built with SALZ_STATS.
+     */
+    struct salz_stats *stats;
+};
+
+/*
+ * Encode plain segment with SALZ, using history and options
+ *
+ * @param[in]     src         History immediately followed by plain segment
+ * @param[in]     prefix_len  Length of history in @p src (in bytes)
+ * @param[in]     src_len     Length of plain segment in @p src (in bytes)
+ * @param[in]     dst         Preallocated space for encoded segment
+ * @param[in/out] dst_len     Space available in @p dst (in bytes) [in]
+ *                            Length of encoded segment (in bytes) [out]
+ * @param[in]     opts        Options, or NULL for defaults
+ *
+ * @return                    0, if successful
+ *                            -1, otherwise
+ */
+extern int salz_encode_opts_safe(const uint8_t *src, size_t prefix_len,
+    size_t src_len, uint8_t *dst, size_t *dst_len,
+    const struct salz_encode_opts *opts);
+
+/*
+ * Get length of segment encoded with SALZ without encoding it
+ *
+ * Optimal parse of segment is computed, but not emitted. Length is exactly
+ * the one salz_encode_prefix_safe() would produce.
+ *
+ * @param[in]  src          History immediately followed by plain segment
+ * @param[in]  prefix_len   Length of history in @p src (in bytes)
+ * @param[in]  src_len      Length of plain segment in @p src (in bytes)
+ * @param[out] encoded_len  Length of encoded segment (in bytes)
+ *
+ * @return                  0, if successful
+ *                          -1, otherwise
+ */
+extern int salz_estimate_encoded_len(const uint8_t *src, size_t prefix_len,
+    size_t src_len, size_t *encoded_len);
+
+/*
+ * Get peak length of workspace allocated for encoding a segment
+ *
+ * Suffix array and auxiliary arrays take about 20 bytes per byte of history
+ * and segment. Small segments are encoded on stack, and
+ * salz_encode_adaptive() keeps workspace of split segments alongside that of
+ * whole input. Workspace is what salz_stats.workspace_len reports afterwards.
+ *
+ * @param[in]  prefix_len  Length of history preceding segment (in bytes)
+ * @param[in]  src_len     Length of plain segment (in bytes)
+ * @param[in]  adaptive    Segment is encoded with salz_encode_adaptive()
+ *
+ * @return                 Peak length of workspace (in bytes)
+ */
+extern size_t salz_encode_workspace_len(size_t prefix_len, size_t src_len,
+    bool adaptive);
+
+/*
+ * Counters of encoding outcomes since start of process. They are shared by
+ * all threads and callers of the process, so a difference of two readings
+ * covers whatever was encoded meanwhile anywhere in it. Outcomes of a single
+ * call come from salz_stats instead.
+ */
+struct salz_counters {
+    /* Segments encoded */
+    uint64_t segments;
+    /* Segments detected incompressible and stored plain without encoding */
+    uint64_t plain_early;
+    /* Segments stored plain after their optimal parse didn't pay off */
+    uint64_t plain_late;
+};
+
+/*
+ * Get process-wide counters of encoding outcomes
+ *
+ * @param[out] res  Current values of counters
+ */
+extern void salz_counters_get(struct salz_counters *res);
+
+/*
+ * Decode SALZ encoded segment, which was encoded using history
+ *
+ * @param[in]     src         SALZ encoded segment to decode
+ * @param[in]     src_len     Length of @p src (in bytes)
+ * @param[in]     dst         History, which decoded segment is placed after
+ * @param[in]     prefix_len  Length of history in @p dst (in bytes)
+ * @param[in/out] dst_len     Space available after history (in bytes) [in]
+ *                            Length of decoded segment (in bytes) [out]
+ *
+ * @return                    0, if successful
+ *                            -1, otherwise
+ */
+extern int salz_decode_prefix_safe(const uint8_t *src, size_t src_len,
+    uint8_t *dst, size_t prefix_len, size_t *dst_len);
+
+/*
+ * Decode range of SALZ encoded segment
+ *
+ * Decoding begins at the restart point nearest before the range and stops at
+ * the end of range. Intervals between restart points within the range are
+ * decoded in place, while the part of the interval preceding the range is
+ * decoded into allocated space. Segment must have been stored plain or
+ * encoded with restart points (see salz_encode_opts.restart_len) and without
+ * history.
+ *
+ * @param[in]     src      SALZ encoded segment to decode
+ * @param[in]     src_len  Length of @p src (in bytes)
+ * @param[in]     offs     Offset of range in decoded segment (in bytes)
+ * @param[in]     dst      Preallocated space for range
+ * @param[in/out] dst_len  Length of range to decode (in bytes) [in]
+ *                         Length of range decoded, which ends short at the
+ *                         end of segment (in bytes) [out]
+ *
+ * @return                 0, if successful
+ *                         -1, otherwise
+ */
+extern int salz_decode_range_safe(const uint8_t *src, size_t src_len,
+    size_t offs, uint8_t *dst, size_t *dst_len);
+
+/*
+ * Get length of space needed for decoding range of SALZ encoded segment
+ *
+ * Range, which begins past a restart point, needs the interval from that
+ * restart point up to the end of range decoded aside. This is never more than
+ * distance between restart points.
+ *
+ * @param[in]  src      SALZ encoded segment to decode
+ * @param[in]  src_len  Length of @p src (in bytes)
+ * @param[in]  offs     Offset of range in decoded segment (in bytes)
+ * @param[in]  len      Length of range to decode (in bytes)
+ *
+ * @return              Length of space needed (in bytes), 0 if none
+ */
+extern size_t salz_decode_range_buf_len(const uint8_t *src, size_t src_len,
+    size_t offs, size_t len);
+
+/*
+ * Decode range of SALZ encoded segment using space of caller
+ *
+ * Same as salz_decode_range_safe(), but the part of the interval preceding
+ * the range is decoded into space of caller, which may be reused between
+ * calls to avoid allocating it each time.
+ *
+ * @param[in]     src      SALZ encoded segment to decode
+ * @param[in]     src_len  Length of @p src (in bytes)
+ * @param[in]     offs     Offset of range in decoded segment (in bytes)
+ * @param[in]     dst      Preallocated space for range
+ * @param[in/out] dst_len  Length of range to decode (in bytes) [in]
+ *                         Length of range decoded, which ends short at the
+ *                         end of segment (in bytes) [out]
+ * @param[in]     buf      Space of at least salz_decode_range_buf_len()
+ *                         bytes, or NULL to allocate it
+ * @param[in]     buf_len  Length of @p buf (in bytes)
+ *
+ * @return                 0, if successful
+ *                         -1, otherwise
+ */
+extern int salz_decode_range_buf_safe(const uint8_t *src, size_t src_len,
+    size_t offs, uint8_t *dst, size_t *dst_len, uint8_t *buf, size_t buf_len);
+
+/* Prepared dictionary */
+typedef struct salz_dict salz_dict;
+
+/*
+ * Train dictionary from samples
+ *
+ * Dictionary is assembled from segments of samples, which cover substrings
+ * common to most samples.
+ *
+ * @param[in]     samples      Samples concatenated one after another
+ * @param[in]     sample_lens  Lengths of samples (in bytes)
+ * @param[in]     samples_cnt  Number of samples
+ * @param[in]     dict         Preallocated space for dictionary
+ * @param[in/out] dict_len     Space available in @p dict (in bytes) [in]
+ *                             Length of dictionary (in bytes) [out]
+ *
+ * @return                     0, if successful
+ *                             -1, otherwise
+ */
+extern int salz_dict_train(const uint8_t *samples, const size_t *sample_lens,
+    size_t samples_cnt, uint8_t *dict, size_t *dict_len);
+
+/*
+ * Prepare dictionary for encoding and decoding segments
+ *
+ * Suffix array of dictionary and encoder workspace are kept in prepared
+ * dictionary and reused between segments. Prepared dictionary must not be
+ * used by multiple threads at a time.
+ *
+ * @param[in]  dict_buf  Dictionary
+ * @param[in]  dict_len  Length of @p dict_buf (in bytes)
+ *
+ * @return               Prepared dictionary, if successful
+ *                       NULL, otherwise
+ */
+extern salz_dict *salz_dict_create(const uint8_t *dict_buf, size_t dict_len);
+
+/*
+ * Release prepared dictionary
+ *
+ * @param[in]  dict  Prepared dictionary
+ */
+extern void salz_dict_destroy(salz_dict *dict);
+
+/*
+ * Encode plain segment with SALZ, using dictionary as history
+ *
+ * @param[in]     dict     Prepared dictionary
+ * @param[in]     src      Plain segment to encode with SALZ
+ * @param[in]     src_len  Length of @p src (in bytes)
+ * @param[in]     dst      Preallocated space for encoded segment
+ * @param[in/out] dst_len  Space available in @p dst (in bytes) [in]
+ *                         Length of encoded segment (in bytes) [out]
+ *
+ * @return                 0, if successful
+ *                         -1, otherwise
+ */
+extern int salz_encode_dict_safe(salz_dict *dict, const uint8_t *src,
+    size_t src_len, uint8_t *dst, size_t *dst_len);
+
+/*
+ * Decode SALZ encoded segment, which was encoded using dictionary
+ *
+ * @param[in]     dict     Prepared dictionary used when encoding
+ * @param[in]     src      SALZ encoded segment to decode
+ * @param[in]     src_len  Length of @p src (in bytes)
+ * @param[in]     dst      Preallocated space for decoded segment
+ * @param[in/out] dst_len  Space available in @p dst (in bytes) [in]
+ *                         Length of decoded segment (in bytes) [out]
+ *
+ * @return                 0, if successful
+ *                         -1, otherwise
+ */
+extern int salz_decode_dict_safe(salz_dict *dict, const uint8_t *src,
+    size_t src_len, uint8_t *dst, size_t *dst_len);
+
+/* Maximum number of threads working on a batch */
+#define SALZ_BATCH_THREADS_MAX (64u)
+
+/* Independent segment encoded or decoded as part of a batch */
+struct salz_batch_item {
+    /* Segment to encode or decode */
+    const uint8_t *src;
+    /* Length of @p src (in bytes) */
+    size_t src_len;
+    /* Preallocated space for result */
+    uint8_t *dst;
+    /* Space available in @p dst [in], length of result [out] (in bytes) */
+    size_t dst_len;
+    /* 0, if item was successfully processed, -1 otherwise [out] */
+    int ret;
+};
+
+/*
+ * Encode a batch of independent plain segments with SALZ
+ *
+ * Each worker reuses its workspace for all segments it encodes. Result of
+ * each segment is reported in its item.
+ *
+ * @param[in/out] items      Items of batch
+ * @param[in]     items_cnt  Number of items
+ * @param[in]     threads    Number of threads to use, including the calling
+ *                           one (0 and 1 encode in calling thread only)
+ *
+ * @return                   0, if all items were successfully encoded
+ *                           -1, otherwise
+ */
+extern int salz_encode_batch(struct salz_batch_item *items, size_t items_cnt,
+    unsigned threads);
+
+/*
+ * Decode a batch of independent SALZ encoded segments
+ *
+ * @param[in/out] items      Items of batch
+ * @param[in]     items_cnt  Number of items
+ * @param[in]     threads    Number of threads to use, including the calling
+ *                           one (0 and 1 decode in calling thread only)
+ *
+ * @return                   0, if all items were successfully decoded
+ *                           -1, otherwise
+ */
+extern int salz_decode_batch(struct salz_batch_item *items, size_t items_cnt,
+    unsigned threads);
+
+/* Minimum length of a segment stored plain by adaptive splitting (in bytes) */
+#define SALZ_ADAPTIVE_SEGMENT_LEN_MIN (16384u)
+
+/* Segment split off by adaptive splitting */
+struct salz_split {
+    /* Offset of segment in plain input (in bytes) */
+    size_t offs;
+    /* Length of plain segment (in bytes) */
+    size_t plain_len;
+    /* Length of encoded segment (in bytes) */
+    size_t encoded_len;
+    /* Whether segment is stored plain */
+    bool plain;
+};
+
+/*
+ * Encode plain input with SALZ as one or more consecutive segments
+ *
+ * Costs of optimal parse over whole input tell apart regions, which don't
+ * compress. These are split off into segments of their own and stored plain,
+ * unless rest of the segments would lose more through lost history. Encoded
+ * segments are placed one after another in @p dst, and each of them has to be
+ * decoded on its own.
+ *
+ * @param[in]     src         Plain input to encode
+ * @param[in]     src_len     Length of @p src (in bytes)
+ * @param[in]     dst         Preallocated space for encoded segments, at least
+ *                            salz_encoded_len_max(@p src_len) bytes
+ * @param[in/out] dst_len     Space available in @p dst (in bytes) [in]
+ *                            Length of encoded segments (in bytes) [out]
+ * @param[out]    splits      Segments input was split into
+ * @param[in/out] splits_cnt  Space available in @p splits [in]
+ *                            Number of segments [out]
+ * @param[in]     opts        Encoding options, or NULL for defaults
+ *
+ * @return                    0, if successful
+ *                            -1, otherwise
+ */
+extern int salz_encode_adaptive(const uint8_t *src, size_t src_len,
+    uint8_t *dst, size_t *dst_len, struct salz_split *splits,
+    size_t *splits_cnt, const struct salz_encode_opts *opts);
+
+/*
+ * SALZ file header (all fields little-endian)
+ *
+ *   offset  size  field
+ *        0     4  magic
+ *        4     1  version
+ *        5     1  flags      (SALZ_FILE_FLAG_*)
+ *        6     2  reserved
+ *        8     4  block_len  (plain length of full segments)
+ *       12     4  reserved
+ *       16     8  file_len   (plain length of the whole file)
+ *
+ * Header is followed by segment frames, each of which consists of encoded
+ * length (u32), plain length (u32) and the encoded segment itself.
+ *
+ * With SALZ_FILE_FLAG_SEEK_TABLE, frames end once file_len bytes of plain
+ * segments are covered, and they are followed by a seek table:
+ *
+ *   offset  size  field
+ *        0  16*n  entries, each of which consists of offset of encoded
+ *                 segment in file (u64), encoded length (u32) and plain
+ *                 length (u32) of a segment
+ *     16*n     8  number of entries n
+ *   16*n+8     4  seek table magic
+ *  16*n+12     4  reserved
+ *
+ * Legacy header consists only of magic and block_len, and legacy frames
+ * only of encoded length and the encoded segment. As legacy block_len is
+ * always a power of two of at least 32 KiB, its lowest byte, which is read
+ * as version, is always zero.
+ */
+#define SALZ_FILE_MAGIC           (0x53414C5Au)
+#define SALZ_FILE_VERSION_LEGACY  (0)
+#define SALZ_FILE_VERSION         (2)
+
+/* Segments are encoded using preceding segment as history */
+#define SALZ_FILE_FLAG_LOOKBACK   (1u << 0)
+/* Segments are indexed by a seek table at the end of file */
+#define SALZ_FILE_FLAG_SEEK_TABLE (1u << 1)
+/* Encoded segments have restart points */
+#define SALZ_FILE_FLAG_RESTARTS   (1u << 2)
+#define SALZ_FILE_FLAGS_KNOWN     (SALZ_FILE_FLAG_LOOKBACK | \
+                                   SALZ_FILE_FLAG_SEEK_TABLE | \
+                                   SALZ_FILE_FLAG_RESTARTS)
+
+#define SALZ_FILE_HDR_LEN_LEGACY  (8)
+#define SALZ_FILE_HDR_LEN        (24)
+
+#define SALZ_FRAME_HDR_LEN_LEGACY (4)
+#define SALZ_FRAME_HDR_LEN        (8)
+
+#define SALZ_SEEK_MAGIC           (0x5345454Bu)
+#define SALZ_SEEK_ENTRY_LEN      (16)
+#define SALZ_SEEK_FOOTER_LEN     (16)
+
+/* Reader of SALZ file */
+typedef struct salz_reader salz_reader;
+
+/* Default capacity of cache of decoded segments (in bytes) */
+#define SALZ_READER_CACHE_LEN_DEFAULT (64u << 20)
+
+/* Options of reader */
+struct salz_reader_opts {
+    /* Capacity of cache of decoded segments (in bytes), 0 disables cache */
+    size_t cache_len;
+    /*
+     * Decode next segment in background, when file is read sequentially
+     * (requires cache to hold at least two segments)
+     */
+    bool prefetch;
+};
+
+/* Statistics of reader */
+struct salz_reader_stats {
+    /* Segments found in cache */
+    uint64_t hits;
+    /* Segments decoded for a read */
+    uint64_t misses;
+    /* Segments decoded in background */
+    uint64_t prefetches;
+};
+
+/*
+ * Open SALZ file for reading arbitrary ranges of plain data
+ *
+ * Segments are located through seek table, or by walking through their
+ * frame headers if file has none. Files, whose segments depend on preceding
+ * ones, and legacy files can't be read this way. Decoded segments are kept
+ * in a least recently used cache, which is bounded by their plain length.
+ * Reader may be shared between threads.
+ *
+ * @param[in]  fd    File descriptor of SALZ file, which stays owned by caller
+ * @param[in]  opts  Options of reader, or NULL for defaults
+ *
+ * @return           Reader, if successful
+ *                   NULL, otherwise
+ */
+extern salz_reader *salz_reader_open_opts(int fd,
+    const struct salz_reader_opts *opts);
+
+/*
+ * Open SALZ file for reading arbitrary ranges of plain data with defaults
+ *
+ * @param[in]  fd  File descriptor of SALZ file, which stays owned by caller
+ *
+ * @return         Reader, if successful
+ *                 NULL, otherwise
+ */
+extern salz_reader *salz_reader_open(int fd);
+
+/*
+ * Close reader of SALZ file
+ *
+ * @param[in]  reader  Reader to close
+ */
+extern void salz_reader_close(salz_reader *reader);
+
+/*
+ * Get plain length of SALZ file
+ *
+ * @param[in]  reader  Reader of SALZ file
+ *
+ * @return             Plain length of file (in bytes)
+ */
+extern uint64_t salz_reader_len(const salz_reader *reader);
+
+/*
+ * Get statistics of reader
+ *
+ * @param[in]  reader  Reader of SALZ file
+ * @param[out] res     Current statistics
+ */
+extern void salz_reader_stats_get(salz_reader *reader,
+    struct salz_reader_stats *res);
+
+/*
+ * Read range of plain data from SALZ file
+ *
+ * Only segments covering the range, which aren't found in cache, are
+ * decoded. Segments wanted as a whole are decoded straight into @p dst
+ * without caching them. Part of a segment read out of sequence is decoded
+ * without caching the segment, if it begins the segment or, in files with
+ * restart points, from the nearest restart point. Read ends short at the
+ * end of file.
+ *
+ * @param[in]     reader   Reader of SALZ file
+ * @param[in]     dst      Space for plain data
+ * @param[in/out] dst_len  Length of range to read (in bytes) [in]
+ *                         Length of plain data read (in bytes) [out]
+ * @param[in]     offs     Offset of range in plain data (in bytes)
+ *
+ * @return                 0, if successful
+ *                         -1, otherwise
+ */
+extern int salz_reader_pread(salz_reader *reader, uint8_t *dst,
+    size_t *dst_len, uint64_t offs);
+
 #endif /* !SALZ_H */
@@ -0,0 +1,729 @@
+/*
+ * bitbench.c - Micro-benchmarks of bit-level I/O primitives
+ *
+ * Copyright (c) 2021-2023 Aki Utoslahti. All rights reserved.
+ *
+ * This work is distributed under terms of the MIT license.
+ * See file LICENSE or a copy at <https://opensource.org/licenses/MIT>.
+ */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "salz.h"
+
+/* Context holding just the members primitives of bitio.h operate on */
+struct salz_io_ctx {
+    const uint8_t *src;
+    size_t src_len;
+    size_t src_pos;
+    uint8_t *dst;
+    size_t dst_len;
+    size_t dst_pos;
+    uint64_t bits;
+    size_t bits_avail;
+    size_t bits_pos;
+};
+
+typedef struct salz_io_ctx salz_io_ctx;
+
+#include "bitio.h"
+
+#define OK     (0)
+#define ERROR (-1)
+
+/* Stream header and tokens as written by salz.c */
+#define STREAM_TYPE_SALZ  (1)
+#define STREAM_FLAG_LONG  (0x80u)
+#define TOKEN_LITERAL     (0)
+
+#define ROUNDS_MAX (1000)
+
+static int rounds = 10;
+static size_t block_len = 1u << 20;
+static bool csv = false;
+
+/* Workloads, each of which is a sequence of values taken from real parses */
+enum workload_id {
+    /* Token of each step of parse */
+    WORKLOAD_TOKEN,
+    /* Fixed-width fields: low bits of factor lengths and offset nibbles */
+    WORKLOAD_FIELD,
+    /* Unary part of factor lengths */
+    WORKLOAD_UNARY,
+    /* Factor lengths less minimum length */
+    WORKLOAD_GR3,
+    /* High bits of factor offsets */
+    WORKLOAD_VNIBBLE,
+    /* Whole parse in stream order, as emitted and decoded */
+    WORKLOAD_PARSE,
+    WORKLOAD_MAX,
+};
+
+struct workload {
+    /* Values in the order they are written and read */
+    uint32_t *vals;
+    /* Width of each value (in bits), for fixed-width fields only */
+    uint8_t *widths;
+    /* Number of values */
+    size_t vals_cnt;
+    /* Number of operations, i.e. values or parse steps */
+    size_t ops_cnt;
+    /* Bits taken by encoded values */
+    size_t bits;
+    /* Encoding produced by reference writer */
+    uint8_t *enc;
+    /* Length of encoding (in bytes) */
+    size_t enc_len;
+    /* Space available for encoding (in bytes) */
+    size_t enc_cap;
+};
+
+static struct workload workloads[WORKLOAD_MAX];
+
+/*************************************
+ * Alternative implementations
+ *************************************/
+
+static bool write_unary_fast(salz_io_ctx *ctx, uint32_t val)
+{
+    /* Zeros and the terminating one fit in buffered bitfield at once */
+    if (val + 1 < ctx->bits_avail) {
+        ctx->bits = (ctx->bits << (val + 1)) | 1;
+        ctx->bits_avail -= val + 1;
+        return true;
+    }
+
+    return write_unary(ctx, val);
+}
+
+static bool write_vnibble_loop(salz_io_ctx *ctx, uint32_t val)
+{
+    /* Nibbles are produced least significant first, terminator included */
+    uint64_t nibbles = (val & 0x7u) | 0x8u;
+    size_t nibbles_len = 1;
+
+    for (val >>= 3; val; val >>= 3) {
+        val -= 1;
+        nibbles |= (uint64_t)(val & 0x7u) << (4 * nibbles_len++);
+    }
+
+    return write_bits(ctx, nibbles, nibbles_len * 4);
+}
+
+static bool read_unary_bitwise(salz_io_ctx *ctx, uint32_t *res)
+{
+    uint8_t bit;
+
+    *res = 0;
+    for ( ;; ) {
+        if (unlikely(!read_bit(ctx, &bit)))
+            return false;
+        if (bit)
+            return true;
+        *res += 1;
+    }
+}
+
+static bool read_gr3_peek(salz_io_ctx *ctx, uint32_t *res)
+{
+    /*
+     * Unused bits of buffered bitfield are zeros, so any set bit terminates
+     * the unary part within it.
+     */
+    if (ctx->bits != 0) {
+        uint32_t zeros = __builtin_clzll(ctx->bits);
+
+        if (zeros + 4 <= ctx->bits_avail) {
+            ctx->bits <<= zeros + 1;
+            *res = (zeros << 3) | (uint32_t)(ctx->bits >> 61);
+            ctx->bits <<= 3;
+            ctx->bits_avail -= zeros + 4;
+            return true;
+        }
+    }
+
+    return read_gr3(ctx, res);
+}
+
+static bool read_vnibble_loop(salz_io_ctx *ctx, uint32_t *res)
+{
+    uint8_t nibble;
+
+    if (unlikely(!read_nibble(ctx, &nibble)))
+        return false;
+    *res = nibble & 0x7u;
+
+    for (size_t i = 1; nibble < 0x8u && i < 11; i++) {
+        if (unlikely(!read_nibble(ctx, &nibble)))
+            return false;
+        *res = ((*res + 1) << 3) | (nibble & 0x7u);
+    }
+
+    return true;
+}
+
+/*************************************
+ * Benchmarked loops
+ *************************************/
+
+#define WRITE_LOOP(fn, write) \
+    static bool fn(salz_io_ctx *ctx, const struct workload *wl, \
+        uint32_t *out) \
+    { \
+        unused(out); \
+        for (size_t i = 0; i < wl->vals_cnt; i++) { \
+            if (unlikely(!write(ctx, wl->vals[i]))) \
+                return false; \
+        } \
+        return true; \
+    }
+
+#define READ_LOOP(fn, read, type) \
+    static bool fn(salz_io_ctx *ctx, const struct workload *wl, \
+        uint32_t *out) \
+    { \
+        for (size_t i = 0; i < wl->vals_cnt; i++) { \
+            type val; \
+            if (unlikely(!read(ctx, &val))) \
+                return false; \
+            out[i] = (uint32_t)val; \
+        } \
+        return true; \
+    }
+
+WRITE_LOOP(run_write_bit, write_bit)
+WRITE_LOOP(run_write_unary, write_unary)
+WRITE_LOOP(run_write_unary_fast, write_unary_fast)
+WRITE_LOOP(run_write_gr3, write_gr3)
+WRITE_LOOP(run_write_vnibble, write_vnibble)
+WRITE_LOOP(run_write_vnibble_loop, write_vnibble_loop)
+
+READ_LOOP(run_read_bit, read_bit, uint8_t)
+READ_LOOP(run_read_unary, read_unary, uint32_t)
+READ_LOOP(run_read_unary_bitwise, read_unary_bitwise, uint32_t)
+READ_LOOP(run_read_gr3, read_gr3, uint32_t)
+READ_LOOP(run_read_gr3_peek, read_gr3_peek, uint32_t)
+READ_LOOP(run_read_vnibble, read_vnibble, uint32_t)
+READ_LOOP(run_read_vnibble_loop, read_vnibble_loop, uint32_t)
+
+static bool run_write_bits(salz_io_ctx *ctx, const struct workload *wl,
+    uint32_t *out)
+{
+    unused(out);
+
+    for (size_t i = 0; i < wl->vals_cnt; i++) {
+        if (unlikely(!write_bits(ctx, wl->vals[i], wl->widths[i])))
+            return false;
+    }
+
+    return true;
+}
+
+static bool run_read_bits(salz_io_ctx *ctx, const struct workload *wl,
+    uint32_t *out)
+{
+    for (size_t i = 0; i < wl->vals_cnt; i++) {
+        uint64_t val;
+
+        if (unlikely(!read_bits(ctx, wl->widths[i], &val)))
+            return false;
+        out[i] = (uint32_t)val;
+    }
+
+    return true;
+}
+
+static bool run_emit(salz_io_ctx *ctx, const struct workload *wl,
+    uint32_t *out)
+{
+    /* Literals are written as bytes, as are low bytes of factor offsets */
+
+    const uint32_t *vals = wl->vals;
+    const uint32_t *end = vals + wl->vals_cnt;
+
+    unused(out);
+
+    while (vals < end) {
+        if (*vals++ == TOKEN_LITERAL) {
+            if (unlikely(!write_bit(ctx, 0) || !write_u8(ctx, *vals++)))
+                return false;
+        } else {
+            if (unlikely(!write_bit(ctx, 1) ||
+                         !write_vnibble(ctx, vals[0]) ||
+                         !write_u8(ctx, vals[1]) ||
+                         !write_gr3(ctx, vals[2])))
+                return false;
+            vals += 3;
+        }
+    }
+
+    return true;
+}
+
+static bool run_decode(salz_io_ctx *ctx, const struct workload *wl,
+    uint32_t *out)
+{
+    uint32_t *end = out + wl->vals_cnt;
+
+    while (out < end) {
+        uint8_t token;
+        uint8_t byte;
+
+        if (unlikely(!read_bit(ctx, &token)))
+            return false;
+        *out++ = token;
+
+        if (token == TOKEN_LITERAL) {
+            if (unlikely(!read_u8(ctx, &byte)))
+                return false;
+            *out++ = byte;
+        } else {
+            if (unlikely(!read_vnibble(ctx, &out[0]) ||
+                         !read_u8(ctx, &byte) ||
+                         !read_gr3(ctx, &out[2])))
+                return false;
+            out[1] = byte;
+            out += 3;
+        }
+    }
+
+    return true;
+}
+
+/* Benchmark of one implementation of a primitive on its workload */
+struct bench_case {
+    const char *primitive;
+    const char *impl;
+    enum workload_id workload;
+    bool reads;
+    bool (*run)(salz_io_ctx *ctx, const struct workload *wl, uint32_t *out);
+};
+
+/* First writer of each workload is the reference, which readers read */
+static const struct bench_case cases[] = {
+    { "write_bit", "salz", WORKLOAD_TOKEN, false, run_write_bit },
+    { "read_bit", "salz", WORKLOAD_TOKEN, true, run_read_bit },
+    { "write_bits", "salz", WORKLOAD_FIELD, false, run_write_bits },
+    { "read_bits", "salz", WORKLOAD_FIELD, true, run_read_bits },
+    { "write_unary", "salz", WORKLOAD_UNARY, false, run_write_unary },
+    { "write_unary", "fast", WORKLOAD_UNARY, false, run_write_unary_fast },
+    { "read_unary", "salz", WORKLOAD_UNARY, true, run_read_unary },
+    { "read_unary", "bitwise", WORKLOAD_UNARY, true, run_read_unary_bitwise },
+    { "write_gr3", "salz", WORKLOAD_GR3, false, run_write_gr3 },
+    { "read_gr3", "salz", WORKLOAD_GR3, true, run_read_gr3 },
+    { "read_gr3", "peek", WORKLOAD_GR3, true, run_read_gr3_peek },
+    { "write_vnibble", "salz", WORKLOAD_VNIBBLE, false, run_write_vnibble },
+    { "write_vnibble", "loop", WORKLOAD_VNIBBLE, false,
+      run_write_vnibble_loop },
+    { "read_vnibble", "salz", WORKLOAD_VNIBBLE, true, run_read_vnibble },
+    { "read_vnibble", "loop", WORKLOAD_VNIBBLE, true, run_read_vnibble_loop },
+    { "emit", "salz", WORKLOAD_PARSE, false, run_emit },
+    { "decode", "salz", WORKLOAD_PARSE, true, run_decode },
+};
+
+/*************************************
+ * Workloads
+ *************************************/
+
+static bool push(struct workload *wl, uint32_t val, size_t bits)
+{
+    if ((wl->vals_cnt & (wl->vals_cnt - 1)) == 0 && wl->vals_cnt >= 1024) {
+        uint32_t *vals = realloc(wl->vals, 2 * wl->vals_cnt * sizeof(*vals));
+        uint8_t *widths = realloc(wl->widths, 2 * wl->vals_cnt);
+
+        if (vals != NULL)
+            wl->vals = vals;
+        if (widths != NULL)
+            wl->widths = widths;
+        if (vals == NULL || widths == NULL) {
+            fprintf(stderr, "couldn't allocate memory\n");
+            return false;
+        }
+    }
+
+    wl->widths[wl->vals_cnt] = (uint8_t)bits;
+    wl->vals[wl->vals_cnt++] = val;
+    wl->bits += bits;
+
+    return true;
+}
+
+static bool push_factor(uint32_t offs_hi, uint8_t offs_lo, uint32_t len)
+{
+    uint64_t nibbles = 0;
+    size_t nibbles_len = encode_vnibble_le(offs_hi, &nibbles);
+    size_t vnibble_bits = 4 * nibbles_len;
+    size_t gr3_bits = (len >> 3) + 1 + 3;
+
+    nibbles &= (1ull << vnibble_bits) - 1;
+
+    workloads[WORKLOAD_TOKEN].ops_cnt += 1;
+    workloads[WORKLOAD_FIELD].ops_cnt += 2;
+    workloads[WORKLOAD_UNARY].ops_cnt += 1;
+    workloads[WORKLOAD_GR3].ops_cnt += 1;
+    workloads[WORKLOAD_VNIBBLE].ops_cnt += 1;
+    workloads[WORKLOAD_PARSE].ops_cnt += 1;
+
+    return push(&workloads[WORKLOAD_TOKEN], 1, 1) &&
+           push(&workloads[WORKLOAD_FIELD], (uint32_t)nibbles, vnibble_bits) &&
+           push(&workloads[WORKLOAD_FIELD], len & 0x7u, 3) &&
+           push(&workloads[WORKLOAD_UNARY], len >> 3, (len >> 3) + 1) &&
+           push(&workloads[WORKLOAD_GR3], len, gr3_bits) &&
+           push(&workloads[WORKLOAD_VNIBBLE], offs_hi, vnibble_bits) &&
+           push(&workloads[WORKLOAD_PARSE], 1, 1) &&
+           push(&workloads[WORKLOAD_PARSE], offs_hi, vnibble_bits) &&
+           push(&workloads[WORKLOAD_PARSE], offs_lo, 8) &&
+           push(&workloads[WORKLOAD_PARSE], len, gr3_bits);
+}
+
+static bool push_literal(uint8_t literal)
+{
+    workloads[WORKLOAD_TOKEN].ops_cnt += 1;
+    workloads[WORKLOAD_PARSE].ops_cnt += 1;
+
+    return push(&workloads[WORKLOAD_TOKEN], 0, 1) &&
+           push(&workloads[WORKLOAD_PARSE], 0, 1) &&
+           push(&workloads[WORKLOAD_PARSE], literal, 8);
+}
+
+static int walk_stream(const uint8_t *src, size_t src_len)
+{
+    /* Parse is recovered from encoded stream with the primitives themselves */
+
+    salz_io_ctx ctx;
+    uint32_t hdr;
+    size_t hdr_len = 4;
+
+    if (src_len < hdr_len)
+        return ERROR;
+
+    hdr = (uint32_t)read_u32_raw(src, 0);
+    if ((hdr >> 24) & STREAM_FLAG_LONG)
+        hdr_len = 8;
+
+    /* Segments stored plain have no parse */
+    if (((hdr >> 24) & ~STREAM_FLAG_LONG) != STREAM_TYPE_SALZ)
+        return OK;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.src = src + hdr_len;
+    ctx.src_len = src_len - hdr_len;
+
+    while (ctx.src_pos < ctx.src_len) {
+        uint8_t token;
+        uint8_t byte;
+        uint32_t offs_hi;
+        uint32_t len;
+
+        if (!read_bit(&ctx, &token))
+            return ERROR;
+
+        if (token == TOKEN_LITERAL) {
+            if (!read_u8(&ctx, &byte) || !push_literal(byte))
+                return ERROR;
+            continue;
+        }
+
+        if (!read_vnibble(&ctx, &offs_hi) || !read_u8(&ctx, &byte) ||
+            !read_gr3(&ctx, &len) || !push_factor(offs_hi, byte, len))
+            return ERROR;
+    }
+
+    return OK;
+}
+
+static int load_parses(const char *path)
+{
+    FILE *f;
+    uint8_t *plain = NULL;
+    uint8_t *enc = NULL;
+    size_t enc_cap = salz_encoded_len_max(block_len);
+    struct salz_encode_opts opts = { .plain_entropy_min = 0 };
+    int ret = ERROR;
+
+    if ((f = fopen(path, "rb")) == NULL) {
+        fprintf(stderr, "couldn't open %s\n", path);
+        return ERROR;
+    }
+
+    plain = malloc(block_len);
+    enc = malloc(enc_cap);
+    if (plain == NULL || enc == NULL) {
+        fprintf(stderr, "couldn't allocate memory\n");
+        goto out;
+    }
+
+    for ( ;; ) {
+        size_t plain_len = fread(plain, 1, block_len, f);
+        size_t enc_len = enc_cap;
+
+        if (plain_len == 0)
+            break;
+
+        if (salz_encode_opts_safe(plain, 0, plain_len, enc, &enc_len,
+                                  &opts) != 0 ||
+            walk_stream(enc, enc_len) != OK) {
+            fprintf(stderr, "couldn't parse %s\n", path);
+            goto out;
+        }
+    }
+
+    if (ferror(f)) {
+        fprintf(stderr, "couldn't read %s\n", path);
+        goto out;
+    }
+
+    ret = OK;
+
+out:
+    fclose(f);
+    free(plain);
+    free(enc);
+
+    return ret;
+}
+
+/*************************************
+ * Running benchmarks
+ *************************************/
+
+static void init_writer(salz_io_ctx *ctx, struct workload *wl, uint8_t *buf)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->dst = buf;
+    ctx->dst_len = wl->enc_cap;
+}
+
+static void fini_writer(salz_io_ctx *ctx)
+{
+    /* Flush last bit buffer */
+    ctx->bits <<= ctx->bits_avail;
+    write_u64_raw(ctx->dst, ctx->bits_pos, ctx->bits);
+}
+
+static void init_reader(salz_io_ctx *ctx, struct workload *wl)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->src = wl->enc;
+    ctx->src_len = wl->enc_len;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t val1 = *(const uint64_t *)a;
+    uint64_t val2 = *(const uint64_t *)b;
+
+    return (val1 > val2) - (val1 < val2);
+}
+
+static int run_case(const struct bench_case *bc, uint8_t *buf, uint32_t *out)
+{
+    struct workload *wl = &workloads[bc->workload];
+    uint64_t ns[ROUNDS_MAX];
+    uint64_t median;
+
+    /* Untimed warm-up round verifies implementation against reference */
+    for (int round = -1; round < rounds; round++) {
+        salz_io_ctx ctx;
+        uint64_t begin = 0;
+        uint64_t end = 0;
+        bool ok;
+
+        if (bc->reads)
+            init_reader(&ctx, wl);
+        else
+            init_writer(&ctx, wl, buf);
+
+        get_time_ns(&begin);
+        ok = bc->run(&ctx, wl, out);
+        get_time_ns(&end);
+
+        if (!ok) {
+            fprintf(stderr, "%s/%s failed\n", bc->primitive, bc->impl);
+            return ERROR;
+        }
+
+        if (round >= 0) {
+            ns[round] = end - begin;
+            continue;
+        }
+
+        if (bc->reads) {
+            ok = memcmp(out, wl->vals, wl->vals_cnt * sizeof(*out)) == 0;
+        } else {
+            fini_writer(&ctx);
+            if (wl->enc == NULL) {
+                wl->enc = malloc(max(ctx.dst_pos, 1));
+                if (wl->enc == NULL) {
+                    fprintf(stderr, "couldn't allocate memory\n");
+                    return ERROR;
+                }
+                memcpy(wl->enc, buf, ctx.dst_pos);
+                wl->enc_len = ctx.dst_pos;
+            }
+            ok = ctx.dst_pos == wl->enc_len &&
+                 memcmp(buf, wl->enc, wl->enc_len) == 0;
+        }
+
+        if (!ok) {
+            fprintf(stderr, "%s/%s doesn't match reference\n", bc->primitive,
+                    bc->impl);
+            return ERROR;
+        }
+    }
+
+    qsort(ns, rounds, sizeof(*ns), cmp_u64);
+    median = ns[(rounds - 1) / 2];
+
+    if (csv) {
+        printf("%s,%s,%zu,%zu,%.3f,%.3f\n", bc->primitive, bc->impl,
+               wl->ops_cnt, wl->bits,
+               wl->ops_cnt ? (double)median / wl->ops_cnt : 0.0,
+               median ? (double)wl->bits / median : 0.0);
+    } else {
+        printf("%-16s %-8s %12zu %14zu %10.3f %10.3f\n", bc->primitive,
+               bc->impl, wl->ops_cnt, wl->bits,
+               wl->ops_cnt ? (double)median / wl->ops_cnt : 0.0,
+               median ? (double)wl->bits / median : 0.0);
+    }
+
+    return OK;
+}
+
+static void print_help(const char *execname)
+{
+    printf("bitbench, micro-benchmarks of SALZ bit-level I/O primitives\n");
+    printf("\n");
+    printf("  usage: %s [options] file ...\n", execname);
+    printf("\n");
+    printf("  -h --help             print this message\n");
+    printf("  -r --rounds=N         timed rounds of each benchmark [default: 10]\n");
+    printf("  -b --block-size=N     size of blocks parsed (in KiB) [default: 1024]\n");
+    printf("  -c --csv              print results as CSV\n");
+    printf("\n");
+    printf("  Files are encoded and their parses recovered, so that primitives\n");
+    printf("  are driven with values of real parses. Each primitive is timed\n");
+    printf("  over all values of its workload, and the median round is reported\n");
+    printf("  as ns/op and bits/ns. Alternative implementations are verified\n");
+    printf("  against the ones of salz before timing.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *short_opt = "hr:b:c";
+    const struct option long_opt[] = {
+        { "help", no_argument, NULL, 'h' },
+        { "rounds", required_argument, NULL, 'r' },
+        { "block-size", required_argument, NULL, 'b' },
+        { "csv", no_argument, NULL, 'c' },
+        { NULL, 0, NULL, 0 },
+    };
+    uint8_t *buf = NULL;
+    uint32_t *out = NULL;
+    size_t buf_len = 0;
+    size_t out_len = 0;
+    int ret = ERROR;
+
+    for ( ;; ) {
+        int opt = getopt_long(argc, argv, short_opt, long_opt, NULL);
+        if (opt == -1)
+            break;
+
+        switch (opt) {
+            case 'h':
+                print_help(argv[0]);
+                return OK;
+
+            case 'r':
+                rounds = atoi(optarg);
+                if (rounds <= 0 || rounds > ROUNDS_MAX) {
+                    fprintf(stderr, "invalid number of rounds: %s\n", optarg);
+                    return ERROR;
+                }
+                break;
+
+            case 'b':
+                if (atoi(optarg) <= 0 ||
+                    atoi(optarg) > (int)(SALZ_SEGMENT_LEN_MAX >> 10)) {
+                    fprintf(stderr, "invalid block size: %s\n", optarg);
+                    return ERROR;
+                }
+                block_len = (size_t)atoi(optarg) << 10;
+                break;
+
+            case 'c':
+                csv = true;
+                break;
+
+            case '?':
+            default:
+                fprintf(stderr, "See \"%s --help\" for more information.\n",
+                        argv[0]);
+                return ERROR;
+        }
+    }
+
+    if (optind == argc) {
+        fprintf(stderr, "no files to take parses from\n");
+        return ERROR;
+    }
+
+    for (int i = 0; i < WORKLOAD_MAX; i++) {
+        workloads[i].vals = malloc(1024 * sizeof(uint32_t));
+        workloads[i].widths = malloc(1024);
+        if (workloads[i].vals == NULL || workloads[i].widths == NULL) {
+            fprintf(stderr, "couldn't allocate memory\n");
+            goto out;
+        }
+    }
+
+    for (int i = optind; i < argc; i++) {
+        if (load_parses(argv[i]) != OK)
+            goto out;
+    }
+
+    /* Room for values and a bitfield word reserved ahead of each one */
+    for (int i = 0; i < WORKLOAD_MAX; i++) {
+        struct workload *wl = &workloads[i];
+
+        wl->enc_cap = divup(wl->bits, 8) + 8 * (wl->vals_cnt + 2);
+        buf_len = max(buf_len, wl->enc_cap);
+        out_len = max(out_len, wl->vals_cnt);
+    }
+
+    buf = malloc(buf_len);
+    out = malloc(max(out_len, 1) * sizeof(*out));
+    if (buf == NULL || out == NULL) {
+        fprintf(stderr, "couldn't allocate memory\n");
+        goto out;
+    }
+
+    if (csv)
+        printf("primitive,impl,ops,bits,ns_per_op,bits_per_ns\n");
+    else
+        printf("%-16s %-8s %12s %14s %10s %10s\n", "primitive", "impl", "ops",
+               "bits", "ns/op", "bits/ns");
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        if (run_case(&cases[i], buf, out) != OK)
+            goto out;
+    }
+
+    ret = OK;
+
+out:
+    for (int i = 0; i < WORKLOAD_MAX; i++) {
+        free(workloads[i].vals);
+        free(workloads[i].widths);
+        free(workloads[i].enc);
+    }
+    free(buf);
+    free(out);
+
+    return ret;
+}
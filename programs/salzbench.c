@@ -0,0 +1,850 @@
+/*
+ * salzbench.c - In-memory benchmark of SALZ encoding and decoding
+ *
+ * Copyright (c) 2021-2023 Aki Utoslahti. All rights reserved.
+ *
+ * This work is distributed under terms of the MIT license.
+ * See file LICENSE or a copy at <https://opensource.org/licenses/MIT>.
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef SALZ_PERF_EVENTS
+#   include <linux/perf_event.h>
+#   include <sys/ioctl.h>
+#   include <sys/syscall.h>
+#   include <unistd.h>
+#endif
+
+#include "common.h"
+#include "salz.h"
+
+#define OK     (0)
+#define ERROR (-1)
+
+#define LEVEL_MAX        (9)
+#define BLOCK_LENS_MAX   (16)
+#define ITERATIONS_MAX   (1000)
+
+enum output_format {
+    FORMAT_TEXT,
+    FORMAT_CSV,
+    FORMAT_JSON,
+};
+
+enum long_only_opt {
+    OPT_RESTART = 256,
+    OPT_PLAIN_ENTROPY,
+};
+
+/* Hardware performance counters, which are reported per byte */
+enum counter {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_LLC_MISSES,
+    COUNTER_DTLB_MISSES,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_MAX,
+};
+
+static const char *counter_names[COUNTER_MAX] = {
+    [COUNTER_CYCLES] = "cycles",
+    [COUNTER_INSTRUCTIONS] = "instructions",
+    [COUNTER_LLC_MISSES] = "llc_misses",
+    [COUNTER_DTLB_MISSES] = "dtlb_misses",
+    [COUNTER_BRANCH_MISSES] = "branch_misses",
+};
+
+static int iterations = 5;
+static bool levels[LEVEL_MAX + 1];
+static size_t block_lens[BLOCK_LENS_MAX];
+static size_t block_lens_cnt = 0;
+static enum output_format format = FORMAT_TEXT;
+static bool counters = false;
+/* File descriptor of each counter, or -1 if it is not available */
+static int counter_fds[COUNTER_MAX];
+static struct salz_encode_opts encode_opts = {
+    .plain_entropy_min = SALZ_PLAIN_ENTROPY_MIN_DEFAULT,
+};
+
+/* Timed steps, which are reported */
+enum step {
+    STEP_SUFFIX_ARRAY = SALZ_PHASE_SUFFIX_ARRAY,
+    STEP_PSVNSV_ARRAY = SALZ_PHASE_PSVNSV_ARRAY,
+    STEP_FACTORIZE = SALZ_PHASE_FACTORIZE,
+    STEP_OPTIMIZE = SALZ_PHASE_OPTIMIZE,
+    STEP_EMIT = SALZ_PHASE_EMIT,
+    /* Encoding outside of reported phases */
+    STEP_OTHER = SALZ_PHASE_DONE,
+    STEP_ENCODE,
+    STEP_DECODE,
+    STEP_MAX,
+};
+
+static const char *step_names[STEP_MAX] = {
+    [STEP_SUFFIX_ARRAY] = "build_suffix_array",
+    [STEP_PSVNSV_ARRAY] = "build_psvnsv_array",
+    [STEP_FACTORIZE] = "factorize",
+    [STEP_OPTIMIZE] = "optimize_factorization",
+    [STEP_EMIT] = "emit_encoding",
+    [STEP_OTHER] = "other",
+    [STEP_ENCODE] = "encode",
+    [STEP_DECODE] = "decode",
+};
+
+/*
+ * Time and counted events spent in phases of encoding, accumulated through
+ * phase callback
+ */
+struct phase_clock {
+    /* Phase currently going on, or SALZ_PHASE_DONE between segments */
+    enum salz_phase phase;
+    /* Time current phase began at */
+    uint64_t begin_ns;
+    /* Counter values current phase began at */
+    uint64_t begin_cnt[COUNTER_MAX];
+    /* Time spent in each phase */
+    uint64_t ns[SALZ_PHASE_MAX];
+    /* Events counted in each phase */
+    uint64_t cnt[SALZ_PHASE_MAX][COUNTER_MAX];
+};
+
+/* Results of benchmarking a file with one configuration */
+struct result {
+    const char *path;
+    int level;
+    size_t block_len;
+    size_t plain_len;
+    size_t encoded_len;
+    /* Time of each step in each iteration */
+    uint64_t *ns[STEP_MAX];
+    /* Events counted in each step over all iterations */
+    uint64_t cnt[STEP_MAX][COUNTER_MAX];
+};
+
+#ifdef SALZ_PERF_EVENTS
+static int open_counter(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    /* Counting only own user space is allowed with default settings */
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+static void open_counters(void)
+{
+    size_t opened_cnt = 0;
+
+    for (int i = 0; i < COUNTER_MAX; i++)
+        counter_fds[i] = -1;
+
+#ifdef SALZ_PERF_EVENTS
+    {
+        const uint64_t cache_read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+        counter_fds[COUNTER_CYCLES] =
+            open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        counter_fds[COUNTER_INSTRUCTIONS] =
+            open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        counter_fds[COUNTER_LLC_MISSES] =
+            open_counter(PERF_TYPE_HW_CACHE,
+                         PERF_COUNT_HW_CACHE_LL | cache_read_miss);
+        counter_fds[COUNTER_DTLB_MISSES] =
+            open_counter(PERF_TYPE_HW_CACHE,
+                         PERF_COUNT_HW_CACHE_DTLB | cache_read_miss);
+        counter_fds[COUNTER_BRANCH_MISSES] =
+            open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    }
+#endif
+
+    for (int i = 0; i < COUNTER_MAX; i++)
+        opened_cnt += counter_fds[i] != -1;
+
+    if (opened_cnt == 0) {
+        fprintf(stderr, "performance counters not available, "
+                "reporting time only\n");
+        return;
+    }
+
+    for (int i = 0; i < COUNTER_MAX; i++) {
+        if (counter_fds[i] == -1)
+            fprintf(stderr, "performance counter %s not available\n",
+                    counter_names[i]);
+    }
+}
+
+static void close_counters(void)
+{
+#ifdef SALZ_PERF_EVENTS
+    for (int i = 0; i < COUNTER_MAX; i++) {
+        if (counter_fds[i] != -1)
+            close(counter_fds[i]);
+    }
+#endif
+}
+
+static void read_counters(uint64_t *vals)
+{
+    /* Counters run all the time, so that steps are measured as differences */
+
+    for (int i = 0; i < COUNTER_MAX; i++) {
+        vals[i] = 0;
+
+#ifdef SALZ_PERF_EVENTS
+        {
+            uint64_t buf[3];
+
+            if (counter_fds[i] == -1 ||
+                read(counter_fds[i], buf, sizeof(buf)) != sizeof(buf))
+                continue;
+
+            /* Scale estimate, if counter was multiplexed with others */
+            if (buf[2] != 0 && buf[2] < buf[1])
+                buf[0] = (uint64_t)((double)buf[0] * buf[1] / buf[2]);
+            vals[i] = buf[0];
+        }
+#endif
+    }
+}
+
+static void phase_cb(enum salz_phase phase, void *arg)
+{
+    struct phase_clock *clock = arg;
+    uint64_t now = 0;
+    uint64_t cnt[COUNTER_MAX];
+
+    if (counters)
+        read_counters(cnt);
+    get_time_ns(&now);
+
+    if (clock->phase != SALZ_PHASE_DONE) {
+        clock->ns[clock->phase] += now - clock->begin_ns;
+        for (int i = 0; counters && i < COUNTER_MAX; i++)
+            clock->cnt[clock->phase][i] += cnt[i] - clock->begin_cnt[i];
+    }
+
+    clock->phase = phase;
+    clock->begin_ns = now;
+    if (counters)
+        memcpy(clock->begin_cnt, cnt, sizeof(cnt));
+}
+
+static uint8_t *load_file(const char *path, size_t *len)
+{
+    FILE *f;
+    uint8_t *buf = NULL;
+    long size;
+
+    if ((f = fopen(path, "rb")) == NULL) {
+        fprintf(stderr, "couldn't open %s\n", path);
+        return NULL;
+    }
+
+    if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 ||
+        fseek(f, 0, SEEK_SET) != 0) {
+        fprintf(stderr, "couldn't determine size of %s\n", path);
+        goto out;
+    }
+
+    /* Empty file still gets a buffer of its own */
+    if ((buf = malloc((size_t)size + 1)) == NULL) {
+        fprintf(stderr, "couldn't allocate memory (%ld bytes)\n", size);
+        goto out;
+    }
+
+    if (fread(buf, 1, (size_t)size, f) != (size_t)size) {
+        fprintf(stderr, "couldn't read %s\n", path);
+        free(buf);
+        buf = NULL;
+        goto out;
+    }
+
+    *len = (size_t)size;
+
+out:
+    fclose(f);
+
+    return buf;
+}
+
+static int encode_blocks(const uint8_t *in, size_t len, size_t block_len,
+    uint8_t *out, size_t *enc_lens, struct phase_clock *clock)
+{
+    size_t blocks_cnt = divup(len, block_len);
+    size_t out_cap = salz_encoded_len_max(block_len);
+    struct salz_encode_opts opts = encode_opts;
+
+    opts.phase_cb = phase_cb;
+    opts.phase_arg = clock;
+
+    for (size_t i = 0; i < blocks_cnt; i++) {
+        size_t plain_len = min(block_len, len - i * block_len);
+
+        enc_lens[i] = out_cap;
+        if (salz_encode_opts_safe(in + i * block_len, 0, plain_len,
+                                  out + i * out_cap, &enc_lens[i],
+                                  &opts) != 0) {
+            fprintf(stderr, "encoding failed\n");
+            return ERROR;
+        }
+    }
+
+    return OK;
+}
+
+static int decode_blocks(const uint8_t *in, const size_t *enc_lens,
+    size_t len, size_t block_len, uint8_t *out)
+{
+    size_t blocks_cnt = divup(len, block_len);
+    size_t in_cap = salz_encoded_len_max(block_len);
+
+    for (size_t i = 0; i < blocks_cnt; i++) {
+        size_t plain_len = min(block_len, len - i * block_len);
+        size_t dst_len = plain_len;
+
+        if (salz_decode_safe(in + i * in_cap, enc_lens[i],
+                             out + i * block_len, &dst_len) != 0 ||
+            dst_len != plain_len) {
+            fprintf(stderr, "decoding failed\n");
+            return ERROR;
+        }
+    }
+
+    return OK;
+}
+
+static int bench(const uint8_t *in, size_t len, struct result *res)
+{
+    size_t block_len = res->block_len;
+    size_t blocks_cnt = max(divup(len, block_len), 1);
+    uint8_t *enc = NULL;
+    uint8_t *dec = NULL;
+    size_t *enc_lens = NULL;
+    int ret = ERROR;
+
+    enc = malloc(blocks_cnt * salz_encoded_len_max(block_len));
+    dec = malloc(blocks_cnt * block_len);
+    enc_lens = calloc(blocks_cnt, sizeof(*enc_lens));
+    if (enc == NULL || dec == NULL || enc_lens == NULL) {
+        fprintf(stderr, "couldn't allocate memory\n");
+        goto out;
+    }
+
+    /* Warm-up round also verifies, that data makes a round trip */
+    {
+        struct phase_clock clock = { .phase = SALZ_PHASE_DONE };
+
+        if (encode_blocks(in, len, block_len, enc, enc_lens, &clock) != OK ||
+            decode_blocks(enc, enc_lens, len, block_len, dec) != OK)
+            goto out;
+
+        if (memcmp(in, dec, len) != 0) {
+            fprintf(stderr, "decoded data differs from original\n");
+            goto out;
+        }
+
+        res->encoded_len = 0;
+        for (size_t i = 0; i < divup(len, block_len); i++)
+            res->encoded_len += enc_lens[i];
+    }
+
+    for (int iter = 0; iter < iterations; iter++) {
+        struct phase_clock clock = { .phase = SALZ_PHASE_DONE };
+        uint64_t begin = 0;
+        uint64_t end = 0;
+        uint64_t phases_ns = 0;
+        uint64_t begin_cnt[COUNTER_MAX] = { 0 };
+        uint64_t end_cnt[COUNTER_MAX] = { 0 };
+
+        if (counters)
+            read_counters(begin_cnt);
+        get_time_ns(&begin);
+        if (encode_blocks(in, len, block_len, enc, enc_lens, &clock) != OK)
+            goto out;
+        get_time_ns(&end);
+        if (counters)
+            read_counters(end_cnt);
+
+        for (int step = 0; step < STEP_OTHER; step++) {
+            res->ns[step][iter] = clock.ns[step];
+            phases_ns += clock.ns[step];
+        }
+        res->ns[STEP_ENCODE][iter] = end - begin;
+        res->ns[STEP_OTHER][iter] = end - begin - min(phases_ns, end - begin);
+
+        for (int i = 0; counters && i < COUNTER_MAX; i++) {
+            uint64_t total = end_cnt[i] - begin_cnt[i];
+            uint64_t phases_cnt = 0;
+
+            for (int step = 0; step < STEP_OTHER; step++) {
+                res->cnt[step][i] += clock.cnt[step][i];
+                phases_cnt += clock.cnt[step][i];
+            }
+            res->cnt[STEP_ENCODE][i] += total;
+            res->cnt[STEP_OTHER][i] += total - min(phases_cnt, total);
+        }
+
+        if (counters)
+            read_counters(begin_cnt);
+        get_time_ns(&begin);
+        if (decode_blocks(enc, enc_lens, len, block_len, dec) != OK)
+            goto out;
+        get_time_ns(&end);
+        if (counters)
+            read_counters(end_cnt);
+
+        res->ns[STEP_DECODE][iter] = end - begin;
+        for (int i = 0; counters && i < COUNTER_MAX; i++)
+            res->cnt[STEP_DECODE][i] += end_cnt[i] - begin_cnt[i];
+    }
+
+    ret = OK;
+
+out:
+    free(enc);
+    free(dec);
+    free(enc_lens);
+
+    return ret;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t val1 = *(const uint64_t *)a;
+    uint64_t val2 = *(const uint64_t *)b;
+
+    return (val1 > val2) - (val1 < val2);
+}
+
+static uint64_t percentile(const uint64_t *ns, int pct)
+{
+    uint64_t sorted[ITERATIONS_MAX];
+    /* Nearest rank */
+    size_t rank = divup((size_t)iterations * pct, 100);
+
+    memcpy(sorted, ns, iterations * sizeof(*ns));
+    qsort(sorted, iterations, sizeof(*sorted), cmp_u64);
+
+    return sorted[max(rank, 1) - 1];
+}
+
+static double ms(uint64_t ns)
+{
+    return ns / 1e6;
+}
+
+static double mb_per_s(size_t len, uint64_t ns)
+{
+    return ns ? len / (ns / 1e3) : 0.0;
+}
+
+static double per_byte(const struct result *res, int step, int counter)
+{
+    size_t len = res->plain_len * iterations;
+
+    return len ? (double)res->cnt[step][counter] / len : 0.0;
+}
+
+static bool counter_valid(int counter)
+{
+    return counters && counter_fds[counter] != -1;
+}
+
+static double ratio(const struct result *res)
+{
+    return res->encoded_len ? (double)res->plain_len / res->encoded_len : 0.0;
+}
+
+/* Prints string as a JSON string */
+static void print_json_str(const char *str)
+{
+    putchar('"');
+    for ( ; *str != '\0'; str++) {
+        unsigned char c = *str;
+
+        if (c == '"' || c == '\\')
+            printf("\\%c", c);
+        else if (c < 0x20)
+            printf("\\u%04x", c);
+        else
+            putchar(c);
+    }
+    putchar('"');
+}
+
+/* Prints string as a quoted CSV field, whose quotes are doubled */
+static void print_csv_str(const char *str)
+{
+    putchar('"');
+    for ( ; *str != '\0'; str++) {
+        if (*str == '"')
+            putchar('"');
+        putchar(*str);
+    }
+    putchar('"');
+}
+
+static void print_header(void)
+{
+    if (format == FORMAT_CSV) {
+        printf("file,level,block_len,plain_len,encoded_len,ratio,iterations,"
+               "encode_mbs,decode_mbs");
+        for (int step = 0; step < STEP_MAX; step++) {
+            printf(",%s_median_ms,%s_p95_ms", step_names[step],
+                   step_names[step]);
+            for (int i = 0; counters && i < COUNTER_MAX; i++)
+                printf(",%s_%s_per_byte", step_names[step], counter_names[i]);
+        }
+        printf("\n");
+    } else if (format == FORMAT_JSON) {
+        printf("[");
+    }
+}
+
+static void print_footer(void)
+{
+    if (format == FORMAT_JSON)
+        printf("\n]\n");
+}
+
+static void print_result(const struct result *res, bool first)
+{
+    uint64_t median[STEP_MAX];
+    uint64_t p95[STEP_MAX];
+
+    for (int step = 0; step < STEP_MAX; step++) {
+        median[step] = percentile(res->ns[step], 50);
+        p95[step] = percentile(res->ns[step], 95);
+    }
+
+    switch (format) {
+        case FORMAT_TEXT:
+            printf("%s -%d, block %zu KiB: %zu -> %zu bytes (ratio %.3f)\n",
+                   res->path, res->level, res->block_len >> 10,
+                   res->plain_len, res->encoded_len, ratio(res));
+            printf("    %-24s %12s %12s", "step", "median ms", "p95 ms");
+            for (int i = 0; counters && i < COUNTER_MAX; i++)
+                printf(" %14s", counter_names[i]);
+            printf("\n");
+            for (int step = 0; step < STEP_MAX; step++) {
+                printf("    %-24s %12.3f %12.3f", step_names[step],
+                       ms(median[step]), ms(p95[step]));
+                for (int i = 0; counters && i < COUNTER_MAX; i++) {
+                    if (counter_valid(i))
+                        printf(" %14.4f", per_byte(res, step, i));
+                    else
+                        printf(" %14s", "n/a");
+                }
+                printf("\n");
+            }
+            if (counters)
+                printf("    counters are events per plain byte\n");
+            printf("    encode %.1f MB/s, decode %.1f MB/s (median)\n\n",
+                   mb_per_s(res->plain_len, median[STEP_ENCODE]),
+                   mb_per_s(res->plain_len, median[STEP_DECODE]));
+            break;
+
+        case FORMAT_CSV:
+            print_csv_str(res->path);
+            printf(",%d,%zu,%zu,%zu,%.4f,%d,%.2f,%.2f",
+                   res->level, res->block_len, res->plain_len,
+                   res->encoded_len, ratio(res), iterations,
+                   mb_per_s(res->plain_len, median[STEP_ENCODE]),
+                   mb_per_s(res->plain_len, median[STEP_DECODE]));
+            for (int step = 0; step < STEP_MAX; step++) {
+                printf(",%.4f,%.4f", ms(median[step]), ms(p95[step]));
+                for (int i = 0; counters && i < COUNTER_MAX; i++) {
+                    if (counter_valid(i))
+                        printf(",%.6f", per_byte(res, step, i));
+                    else
+                        printf(",");
+                }
+            }
+            printf("\n");
+            break;
+
+        case FORMAT_JSON:
+            printf("%s\n  {\"file\": ", first ? "" : ",");
+            print_json_str(res->path);
+            printf(", \"level\": %d, \"block_len\": %zu, "
+                   "\"plain_len\": %zu, \"encoded_len\": %zu, "
+                   "\"ratio\": %.4f, \"iterations\": %d, "
+                   "\"encode_mbs\": %.2f, \"decode_mbs\": %.2f, \"steps\": {",
+                   res->level, res->block_len,
+                   res->plain_len, res->encoded_len, ratio(res), iterations,
+                   mb_per_s(res->plain_len, median[STEP_ENCODE]),
+                   mb_per_s(res->plain_len, median[STEP_DECODE]));
+            for (int step = 0; step < STEP_MAX; step++) {
+                printf("%s\"%s\": {\"median_ms\": %.4f, \"p95_ms\": %.4f",
+                       step ? ", " : "", step_names[step], ms(median[step]),
+                       ms(p95[step]));
+                for (int i = 0; counters && i < COUNTER_MAX; i++) {
+                    if (counter_valid(i))
+                        printf(", \"%s_per_byte\": %.6f", counter_names[i],
+                               per_byte(res, step, i));
+                    else
+                        printf(", \"%s_per_byte\": null", counter_names[i]);
+                }
+                printf("}");
+            }
+            printf("}}");
+            break;
+    }
+}
+
+static int parse_levels(const char *arg)
+{
+    /* Comma separated list of levels and ranges of levels, e.g. "1,5-9" */
+    while (*arg) {
+        char *end;
+        long lo = strtol(arg, &end, 10);
+        long hi = lo;
+
+        if (end == arg)
+            return ERROR;
+
+        if (*end == '-') {
+            arg = end + 1;
+            hi = strtol(arg, &end, 10);
+            if (end == arg)
+                return ERROR;
+        }
+
+        if (lo < 0 || hi > LEVEL_MAX || lo > hi)
+            return ERROR;
+
+        for (long lvl = lo; lvl <= hi; lvl++)
+            levels[lvl] = true;
+
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return ERROR;
+        arg = end;
+    }
+
+    return OK;
+}
+
+static int parse_block_lens(const char *arg)
+{
+    /* Comma separated list of block lengths in KiB */
+    while (*arg) {
+        char *end;
+        long kib = strtol(arg, &end, 10);
+
+        if (end == arg || kib <= 0 || kib > (long)(SALZ_SEGMENT_LEN_MAX >> 10) ||
+            block_lens_cnt == BLOCK_LENS_MAX)
+            return ERROR;
+
+        block_lens[block_lens_cnt++] = (size_t)kib << 10;
+
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return ERROR;
+        arg = end;
+    }
+
+    return OK;
+}
+
+static void print_help(const char *execname)
+{
+    printf("salzbench, in-memory benchmark of SALZ encoding and decoding\n");
+    printf("\n");
+    printf("  usage: %s [options] file ...\n", execname);
+    printf("\n");
+    printf("  -h --help             print this message\n");
+    printf("  -i --iterations=N     timed iterations of each configuration [default: 5]\n");
+    printf("  -l --levels=LIST      compression levels, e.g. \"1,5-9\" [default: 5]\n");
+    printf("  -b --block-size=LIST  block sizes in KiB, e.g. \"64,1024\"\n");
+    printf("                        [default: block size of each level]\n");
+    printf("  -f --format=FMT       output format: text, csv or json [default: text]\n");
+    printf("  -c --counters         count cycles, instructions, LLC and dTLB misses and\n");
+    printf("                        branch misses of each step with perf events\n");
+    printf("  --restart=N           let decoding begin every N KiB within segments\n");
+    printf("  --plain-entropy=N     store segments with entropy of at least N millibits\n");
+    printf("                        per byte and little repetition plain, 0 disables\n");
+    printf("                        [default: %u]\n", SALZ_PLAIN_ENTROPY_MIN_DEFAULT);
+    printf("\n");
+    printf("  Files are loaded into memory and cut into blocks, which are encoded\n");
+    printf("  and decoded one after another. Median and 95th percentile of each\n");
+    printf("  step are taken over iterations, after an untimed warm-up round.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *short_opt = "hi:l:b:f:c";
+    const struct option long_opt[] = {
+        { "help", no_argument, NULL, 'h' },
+        { "iterations", required_argument, NULL, 'i' },
+        { "levels", required_argument, NULL, 'l' },
+        { "block-size", required_argument, NULL, 'b' },
+        { "format", required_argument, NULL, 'f' },
+        { "counters", no_argument, NULL, 'c' },
+        { "restart", required_argument, NULL, OPT_RESTART },
+        { "plain-entropy", required_argument, NULL, OPT_PLAIN_ENTROPY },
+        { NULL, 0, NULL, 0 },
+    };
+    bool levels_given = false;
+    bool first = true;
+    int ret = OK;
+
+    for ( ;; ) {
+        int opt = getopt_long(argc, argv, short_opt, long_opt, NULL);
+        if (opt == -1)
+            break;
+
+        switch (opt) {
+            case 'h':
+                print_help(argv[0]);
+                return OK;
+
+            case 'i':
+                iterations = atoi(optarg);
+                if (iterations <= 0 || iterations > ITERATIONS_MAX) {
+                    fprintf(stderr, "invalid number of iterations: %s\n", optarg);
+                    return ERROR;
+                }
+                break;
+
+            case 'l':
+                if (parse_levels(optarg) != OK) {
+                    fprintf(stderr, "invalid levels: %s\n", optarg);
+                    return ERROR;
+                }
+                levels_given = true;
+                break;
+
+            case 'b':
+                if (parse_block_lens(optarg) != OK) {
+                    fprintf(stderr, "invalid block sizes: %s\n", optarg);
+                    return ERROR;
+                }
+                break;
+
+            case 'f':
+                if (strcmp(optarg, "text") == 0) {
+                    format = FORMAT_TEXT;
+                } else if (strcmp(optarg, "csv") == 0) {
+                    format = FORMAT_CSV;
+                } else if (strcmp(optarg, "json") == 0) {
+                    format = FORMAT_JSON;
+                } else {
+                    fprintf(stderr, "invalid format: %s\n", optarg);
+                    return ERROR;
+                }
+                break;
+
+            case 'c':
+                counters = true;
+                break;
+
+            case OPT_RESTART:
+                if (atoi(optarg) < (int)(SALZ_RESTART_LEN_MIN >> 10) ||
+                    atoi(optarg) > (int)(SALZ_SEGMENT_LEN_MAX >> 10)) {
+                    fprintf(stderr, "invalid distance between restart points: %s\n",
+                            optarg);
+                    return ERROR;
+                }
+                encode_opts.restart_len = atoi(optarg) << 10;
+                break;
+
+            case OPT_PLAIN_ENTROPY:
+                if (atoi(optarg) < 0) {
+                    fprintf(stderr, "invalid entropy threshold: %s\n", optarg);
+                    return ERROR;
+                }
+                encode_opts.plain_entropy_min = atoi(optarg);
+                break;
+
+            case '?':
+            default:
+                fprintf(stderr, "See \"%s --help\" for more information.\n",
+                        argv[0]);
+                return ERROR;
+        }
+    }
+
+    if (optind == argc) {
+        fprintf(stderr, "no files to benchmark\n");
+        return ERROR;
+    }
+
+    if (!levels_given)
+        levels[5] = true;
+
+    if (counters)
+        open_counters();
+
+    print_header();
+
+    for (int i = optind; i < argc && ret == OK; i++) {
+        size_t len = 0;
+        uint8_t *buf = load_file(argv[i], &len);
+
+        if (buf == NULL) {
+            ret = ERROR;
+            break;
+        }
+
+        for (int lvl = 0; lvl <= LEVEL_MAX && ret == OK; lvl++) {
+            if (!levels[lvl])
+                continue;
+
+            /* Level selects effort, and block size unless sizes are given */
+            encode_opts.effort = max(lvl, (int)SALZ_EFFORT_MIN);
+            for (size_t j = 0; j < max(block_lens_cnt, 1) && ret == OK; j++) {
+                struct result res = {
+                    .path = argv[i],
+                    .level = lvl,
+                    .block_len = block_lens_cnt ? block_lens[j] :
+                                 (size_t)1 << (15 + lvl),
+                    .plain_len = len,
+                };
+
+                for (int step = 0; step < STEP_MAX && ret == OK; step++) {
+                    res.ns[step] = calloc(iterations, sizeof(uint64_t));
+                    if (res.ns[step] == NULL)
+                        ret = ERROR;
+                }
+
+                if (ret == OK)
+                    ret = bench(buf, len, &res);
+                if (ret == OK) {
+                    print_result(&res, first);
+                    first = false;
+                }
+
+                for (int step = 0; step < STEP_MAX; step++)
+                    free(res.ns[step]);
+            }
+        }
+
+        free(buf);
+    }
+
+    print_footer();
+
+    if (counters)
+        close_counters();
+
+    return ret;
+}
@@ -7,10 +7,13 @@
  * See file LICENSE or a copy at <https://opensource.org/licenses/MIT>.
  */
 
+#define _GNU_SOURCE
+
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -18,202 +21,1784 @@
 #include <string.h>
 #include <unistd.h>
 
-#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include <linux/limits.h>
+
+#ifdef SALZ_IO_URING
+#   include <pthread.h>
+#   include <sys/eventfd.h>
+#endif
+
+#include "common.h"
+#include "salz.h"
+
+#ifdef SALZ_IO_URING
+#   include "uring.h"
+#endif
+
+static const uint32_t salz_magic = SALZ_FILE_MAGIC;
+
+struct file_hdr {
+    uint8_t version;
+    uint8_t flags;
+    uint32_t block_len;
+    uint64_t file_len;
+};
+
+#define OK             (0)
+#define ERROR         (-1)
+#define NOT_SUPPORTED  (1)
+
+static const char *suffix = ".salz";
+static const char *unsalz = "unsalz";
+static const char *salzcat = "salzcat";
+
+enum operation_mode {
+    COMPRESS,
+    DECOMPRESS,
+    PRINT_INFO,
+    EXPLAIN,
+};
+static int operation_mode = COMPRESS;
+
+enum long_only_opt {
+    OPT_NO_MMAP = 256,
+    OPT_IO_URING,
+    OPT_DIRECT,
+    OPT_LOOKBACK,
+    OPT_PLAIN_ENTROPY,
+    OPT_ADAPTIVE,
+    OPT_SEEK_TABLE,
+    OPT_RESTART,
+    OPT_EXPLAIN,
+    OPT_STATS_JSON,
+    OPT_MEMORY_LIMIT,
+    OPT_BLOCK_SIZE,
+};
+
+enum log_lvl {
+    LOG_LVL_NONE,
+    LOG_LVL_CRITICAL,
+    LOG_LVL_ERROR,
+    LOG_LVL_INFO,
+};
+static int log_lvl = LOG_LVL_INFO;
+
+static bool overwrite_output = false;
+static bool keep_input = false;
+static int compression_level = 5;
+/* Length of blocks encoded as segments (in bytes), or 0 to follow level */
+static size_t block_len = 0;
+static bool use_mmap = true;
+static bool use_lookback = false;
+static bool use_adaptive = false;
+static bool use_seek_table = false;
+#ifdef SALZ_IO_URING
+static bool use_uring = false;
+#endif
+static bool use_direct_io = false;
+static int threads = 0;
+static bool use_stats_json = false;
+/* Memory compression is fit into (in bytes), or 0 without limit */
+static uint64_t memory_limit = 0;
+/* Threads encoding or decoding segments of current file */
+static size_t threads_used = 1;
+/* Segments encoded, decoded and stored plain by all threads */
+static uint64_t segments_encoded = 0;
+static uint64_t segments_decoded = 0;
+static uint64_t segments_plain = 0;
+static struct salz_encode_opts encode_opts = {
+    .plain_entropy_min = SALZ_PLAIN_ENTROPY_MIN_DEFAULT,
+};
+
+#define log(lvl, fmt, ...) \
+    do { \
+        if (lvl <= log_lvl) \
+            fprintf(stderr, fmt "\n", ## __VA_ARGS__);\
+    } while (0)
+
+#define log_crit(fmt, ...) log(LOG_LVL_CRITICAL, fmt, ## __VA_ARGS__)
+#define log_err(fmt, ...) log(LOG_LVL_ERROR, fmt, ## __VA_ARGS__)
+#define log_info(fmt, ...) log(LOG_LVL_INFO, fmt, ## __VA_ARGS__)
+
+/* Parses a size in units of 2^shift bytes, or with suffix K, M or G */
+static int parse_size(const char *str, unsigned shift, uint64_t *res)
+{
+    char *end;
+    unsigned long long val;
+
+    errno = 0;
+    val = strtoull(str, &end, 10);
+    if (errno != 0 || end == str || *str == '-')
+        return ERROR;
+
+    switch (*end) {
+        case 'K': case 'k': shift = 10; end++; break;
+        case 'M': case 'm': shift = 20; end++; break;
+        case 'G': case 'g': shift = 30; end++; break;
+        case '\0': break;
+        default: return ERROR;
+    }
+
+    if (*end != '\0' || val == 0 || val > (UINT64_MAX >> shift))
+        return ERROR;
+
+    *res = (uint64_t)val << shift;
+
+    return OK;
+}
+
+static size_t get_block_len(void)
+{
+    return block_len ? block_len : (size_t)1 << (15 + compression_level);
+}
+
+static const char *get_filename(const char *path)
+{
+    const char *name;
+    if ((name = strrchr(path, '/')) != NULL)
+        return name + 1;
+
+    return path;
+}
+
+static void fill_outpath(const char *path, char buf[PATH_MAX])
+{
+    size_t path_len = strlen(path);
+    size_t suffix_len = strlen(suffix);
+
+    if (operation_mode == DECOMPRESS) {
+        size_t copy_len = path_len - suffix_len;
+        memcpy(buf, path, copy_len);
+        buf[copy_len] = '\0';
+    } else {
+        /* @todo: check this with fresh eyes */
+        const char *filename = get_filename(path);
+        size_t filename_len = strlen(filename);
+        size_t copy_len = path_len;
+
+        if (filename_len + suffix_len + 1 > NAME_MAX)
+            copy_len = path_len - filename_len + (NAME_MAX - (suffix_len + 1));
+
+        if (path_len + suffix_len + 1 > PATH_MAX)
+            copy_len = PATH_MAX - (suffix_len + 1);
+
+        memcpy(buf, path, copy_len);
+        memcpy(buf + copy_len, suffix, suffix_len);
+        buf[copy_len + suffix_len] = '\0';
+    }
+}
+
+static void *map_input(FILE *stream, size_t *len)
+{
+    struct stat st;
+    void *addr;
+    int fd = fileno(stream);
+
+    if (!use_mmap)
+        return NULL;
+
+    /*
+     * Only regular files reach here, as process_path() refuses other paths.
+     * Empty ones can't be mapped and are read with read().
+     */
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+        return NULL;
+
+    addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+        log_info("Couldn't map input, falling back to read() (err: %d)", errno);
+        return NULL;
+    }
+
+    madvise(addr, st.st_size, MADV_SEQUENTIAL);
+
+    *len = st.st_size;
+    return addr;
+}
+
+static void advise_range(const uint8_t *base, size_t base_len, size_t pos,
+    size_t len, int advice)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t begin = pos - pos % page_size;
+    size_t end = min(pos + len, base_len);
+
+    if (begin < end)
+        madvise((void *)(base + begin), end - begin, advice);
+}
+
+static void pack_header(const struct file_hdr *hdr,
+    uint8_t buf[SALZ_FILE_HDR_LEN])
+{
+    memset(buf, 0, SALZ_FILE_HDR_LEN);
+    memcpy(buf + 0, &salz_magic, sizeof(salz_magic));
+    buf[4] = hdr->version;
+    buf[5] = hdr->flags;
+    memcpy(buf + 8, &hdr->block_len, sizeof(hdr->block_len));
+    memcpy(buf + 16, &hdr->file_len, sizeof(hdr->file_len));
+}
+
+static int unpack_header(const uint8_t *buf, size_t len, struct file_hdr *hdr)
+{
+    if (len < SALZ_FILE_HDR_LEN_LEGACY) {
+        log_err("Couldn't read SALZ header from input");
+        return ERROR;
+    }
+
+    if (memcmp(buf, &salz_magic, sizeof(salz_magic)) != 0) {
+        log_err("Not a SALZ header, unexpected magic number");
+        return ERROR;
+    }
+
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->version = buf[4];
+
+    if (hdr->version == SALZ_FILE_VERSION_LEGACY) {
+        memcpy(&hdr->block_len, buf + 4, sizeof(hdr->block_len));
+        goto check_block_len;
+    }
+
+    if (hdr->version != SALZ_FILE_VERSION) {
+        log_err("Unsupported SALZ file version (%u)", hdr->version);
+        return ERROR;
+    }
+
+    if (len < SALZ_FILE_HDR_LEN) {
+        log_err("Couldn't read SALZ header from input");
+        return ERROR;
+    }
+
+    hdr->flags = buf[5];
+    memcpy(&hdr->block_len, buf + 8, sizeof(hdr->block_len));
+    memcpy(&hdr->file_len, buf + 16, sizeof(hdr->file_len));
+
+    if (hdr->flags & ~SALZ_FILE_FLAGS_KNOWN) {
+        log_err("Unsupported SALZ file flags (0x%02x)", hdr->flags);
+        return ERROR;
+    }
+
+check_block_len:
+    if (hdr->block_len == 0 || hdr->block_len > SALZ_SEGMENT_LEN_MAX) {
+        log_err("Invalid block length in SALZ header (%u)", hdr->block_len);
+        return ERROR;
+    }
+
+    return OK;
+}
+
+static size_t header_len(const struct file_hdr *hdr)
+{
+    if (hdr->version == SALZ_FILE_VERSION_LEGACY)
+        return SALZ_FILE_HDR_LEN_LEGACY;
+
+    return SALZ_FILE_HDR_LEN;
+}
+
+static size_t frame_hdr_len(const struct file_hdr *hdr)
+{
+    if (hdr->version == SALZ_FILE_VERSION_LEGACY)
+        return SALZ_FRAME_HDR_LEN_LEGACY;
+
+    return SALZ_FRAME_HDR_LEN;
+}
+
+static bool frames_end(const struct file_hdr *hdr, uint64_t plain_pos)
+{
+    /* Seek table follows, once frames cover the whole file */
+    return (hdr->flags & SALZ_FILE_FLAG_SEEK_TABLE) &&
+           plain_pos == hdr->file_len;
+}
+
+static void unpack_frame_hdr(const uint8_t *buf, const struct file_hdr *hdr,
+    uint32_t *encoded_len, uint32_t *plain_len)
+{
+    memcpy(encoded_len, buf, sizeof(*encoded_len));
+
+    /* Legacy frames don't record plain length, only its upper bound is known */
+    if (hdr->version == SALZ_FILE_VERSION_LEGACY)
+        *plain_len = hdr->block_len;
+    else
+        memcpy(plain_len, buf + 4, sizeof(*plain_len));
+}
+
+static int write_header(FILE *out, const struct file_hdr *hdr)
+{
+    uint8_t buf[SALZ_FILE_HDR_LEN];
+
+    pack_header(hdr, buf);
+
+    if (fwrite(buf, 1, sizeof(buf), out) != sizeof(buf)) {
+        log_err("Couldn't write SALZ header to output");
+        return ERROR;
+    }
+
+    return OK;
+}
+
+/* Seek table collected while segment frames are written */
+struct seek_table {
+    /* Packed seek table entries */
+    uint8_t *entries;
+    size_t entries_cnt;
+    size_t entries_cap;
+    /* Offset in output, where next frames are written */
+    uint64_t frames_end;
+};
+
+static size_t splits_max(size_t block_len)
+{
+    /* Plain segments split off are separated by at least one encoded one */
+    return 2 * (block_len / SALZ_ADAPTIVE_SEGMENT_LEN_MIN) + 1;
+}
+
+static size_t frames_len_max(size_t block_len)
+{
+    size_t frames_cnt = use_adaptive ? splits_max(block_len) : 1;
+
+    return frames_cnt * SALZ_FRAME_HDR_LEN + salz_encoded_len_max(block_len);
+}
+
+static void pack_frame_hdr(uint8_t *buf, size_t encoded_len, size_t plain_len)
+{
+    uint32_t frame_encoded_len = encoded_len;
+    uint32_t frame_plain_len = plain_len;
+
+    memcpy(buf + 0, &frame_encoded_len, sizeof(frame_encoded_len));
+    memcpy(buf + 4, &frame_plain_len, sizeof(frame_plain_len));
+}
+
+/* Counts segments of a call, which may run on any thread */
+static void count_encoded(const struct salz_encode_opts *opts,
+    size_t segments_cnt)
+{
+    __atomic_fetch_add(&segments_encoded, segments_cnt, __ATOMIC_RELAXED);
+#ifdef SALZ_STATS
+    if (opts->stats != NULL)
+        __atomic_fetch_add(&segments_plain, opts->stats->plain_early +
+                           opts->stats->plain_late, __ATOMIC_RELAXED);
+#else
+    unused(opts);
+#endif
+}
+
+static int encode_frames(const uint8_t *in, size_t prefix_len,
+    size_t plain_len, uint8_t *out, size_t out_cap, size_t *out_len)
+{
+    struct salz_encode_opts opts = encode_opts;
+    struct salz_split *splits;
+    size_t splits_cnt;
+    size_t encoded_len;
+    size_t hdrs_len;
+    size_t src_pos;
+    size_t dst_pos = 0;
+#ifdef SALZ_STATS
+    struct salz_stats stats;
+
+    /* Statistics are collected per call, as workers encode at the same time */
+    if (use_stats_json && opts.stats == NULL)
+        opts.stats = &stats;
+#endif
+
+    if (!use_adaptive) {
+        encoded_len = out_cap - SALZ_FRAME_HDR_LEN;
+        if (salz_encode_opts_safe(in, prefix_len, plain_len,
+                                  out + SALZ_FRAME_HDR_LEN, &encoded_len,
+                                  &opts) != 0)
+            return ERROR;
+
+        pack_frame_hdr(out, encoded_len, plain_len);
+        *out_len = SALZ_FRAME_HDR_LEN + encoded_len;
+        count_encoded(&opts, 1);
+
+        return OK;
+    }
+
+    assert(prefix_len == 0);
+
+    splits_cnt = splits_max(plain_len);
+    if ((splits = malloc(splits_cnt * sizeof(*splits))) == NULL)
+        return ERROR;
+
+    /* Segments are encoded behind room for their frame headers */
+    hdrs_len = splits_cnt * SALZ_FRAME_HDR_LEN;
+    encoded_len = out_cap - hdrs_len;
+    if (salz_encode_adaptive(in, plain_len, out + hdrs_len, &encoded_len,
+                             splits, &splits_cnt, &opts) != 0) {
+        free(splits);
+        return ERROR;
+    }
+    count_encoded(&opts, splits_cnt);
+
+    /* Frame headers never catch up with segments yet to be moved */
+    src_pos = hdrs_len;
+    for (size_t i = 0; i < splits_cnt; i++) {
+        pack_frame_hdr(out + dst_pos, splits[i].encoded_len,
+                       splits[i].plain_len);
+        dst_pos += SALZ_FRAME_HDR_LEN;
+
+        memmove(out + dst_pos, out + src_pos, splits[i].encoded_len);
+        dst_pos += splits[i].encoded_len;
+        src_pos += splits[i].encoded_len;
+    }
+    *out_len = dst_pos;
+
+    free(splits);
+
+    return OK;
+}
+
+static int seek_table_add(struct seek_table *table, const uint8_t *frames,
+    size_t frames_len)
+{
+    for (size_t pos = 0; pos < frames_len; ) {
+        uint8_t *entry;
+        uint64_t encoded_off = table->frames_end + pos + SALZ_FRAME_HDR_LEN;
+        uint32_t encoded_len;
+        uint32_t plain_len;
+
+        if (table->entries_cnt == table->entries_cap) {
+            size_t cap = table->entries_cap ? 2 * table->entries_cap : 64;
+            uint8_t *tmp = realloc(table->entries, cap * SALZ_SEEK_ENTRY_LEN);
+
+            if (tmp == NULL) {
+                log_err("Couldn't allocate memory (%zu bytes)",
+                        cap * SALZ_SEEK_ENTRY_LEN);
+                return ERROR;
+            }
+
+            table->entries = tmp;
+            table->entries_cap = cap;
+        }
+
+        memcpy(&encoded_len, frames + pos + 0, sizeof(encoded_len));
+        memcpy(&plain_len, frames + pos + 4, sizeof(plain_len));
+
+        entry = table->entries + table->entries_cnt++ * SALZ_SEEK_ENTRY_LEN;
+        memcpy(entry + 0, &encoded_off, sizeof(encoded_off));
+        memcpy(entry + 8, &encoded_len, sizeof(encoded_len));
+        memcpy(entry + 12, &plain_len, sizeof(plain_len));
+
+        pos += SALZ_FRAME_HDR_LEN + encoded_len;
+    }
+
+    table->frames_end += frames_len;
+
+    return OK;
+}
+
+static void pack_seek_footer(const struct seek_table *table,
+    uint8_t buf[SALZ_SEEK_FOOTER_LEN])
+{
+    uint64_t entries_cnt = table->entries_cnt;
+    uint32_t magic = SALZ_SEEK_MAGIC;
+
+    memset(buf, 0, SALZ_SEEK_FOOTER_LEN);
+    memcpy(buf + 0, &entries_cnt, sizeof(entries_cnt));
+    memcpy(buf + 8, &magic, sizeof(magic));
+}
+
+static int write_seek_table(FILE *out, const struct seek_table *table)
+{
+    uint8_t footer[SALZ_SEEK_FOOTER_LEN];
+    size_t len = table->entries_cnt * SALZ_SEEK_ENTRY_LEN;
+
+    pack_seek_footer(table, footer);
+
+    if (fwrite(table->entries, 1, len, out) != len ||
+        fwrite(footer, 1, sizeof(footer), out) != sizeof(footer)) {
+        log_err("Couldn't write seek table to output stream");
+        return ERROR;
+    }
+
+    return OK;
+}
+
+static int write_frames(FILE *out, const uint8_t *buf, size_t len,
+    struct seek_table *table)
+{
+    if (fwrite(buf, 1, len, out) != len) {
+        log_err("Couldn't write encoded segment to output stream");
+        return ERROR;
+    }
+
+    if (table != NULL)
+        return seek_table_add(table, buf, len);
+
+    return OK;
+}
+
+static int compress_mapped(const uint8_t *in, size_t in_len, FILE *out,
+    uint8_t *outbuf, size_t outbuf_cap, const struct file_hdr *hdr,
+    struct seek_table *table)
+{
+    size_t block_len = hdr->block_len;
+    size_t prefix_len = 0;
+
+    for (size_t pos = 0; pos < in_len; pos += block_len) {
+        size_t inbuf_len = min(block_len, in_len - pos);
+        size_t outbuf_len = outbuf_cap;
+
+        /* Have the kernel read ahead next segment while current is encoded */
+        advise_range(in, in_len, pos + inbuf_len, block_len, MADV_WILLNEED);
+
+        /* Preceding segment is history already in place in front of segment */
+        if (encode_frames(in + pos - prefix_len, prefix_len, inbuf_len,
+                          outbuf, outbuf_cap, &outbuf_len) != OK) {
+            log_err("Couldn't encode segment");
+            return ERROR;
+        }
+
+        if (write_frames(out, outbuf, outbuf_len, table) != OK)
+            return ERROR;
+
+        if (hdr->flags & SALZ_FILE_FLAG_LOOKBACK)
+            prefix_len = inbuf_len;
+    }
+
+    return OK;
+}
+
+static int compress_stream(FILE *in, FILE *out, uint8_t *outbuf,
+    size_t outbuf_cap, const struct file_hdr *hdr, struct seek_table *table,
+    uint64_t *file_len)
+{
+    uint8_t *inbuf;
+    size_t inbuf_cap;
+    size_t block_len = hdr->block_len;
+    size_t prefix_len = 0;
+
+    int ret = OK;
+
+    /* Room for preceding segment as history in front of current one */
+    inbuf_cap = hdr->flags & SALZ_FILE_FLAG_LOOKBACK ? 2 * block_len : block_len;
+    if ((inbuf = malloc(inbuf_cap)) == NULL) {
+        log_err("Couldn't allocate memory: (%zu bytes)", inbuf_cap);
+        return ERROR;
+    }
+
+    *file_len = 0;
+    for ( ;; ) {
+        size_t inbuf_len;
+        size_t outbuf_len = outbuf_cap;
+
+        if ((inbuf_len = fread(inbuf + prefix_len, 1, block_len, in)) != block_len) {
+            if (ferror(in)) {
+                log_err("Couldn't read from input stream");
+                ret = ERROR;
+                break;
+            }
+        }
+
+        /* Input ending at a block boundary leaves no segment to write */
+        if (inbuf_len == 0 && feof(in))
+            break;
+
+        if (encode_frames(inbuf, prefix_len, inbuf_len, outbuf, outbuf_cap,
+                          &outbuf_len) != OK) {
+            log_err("Couldn't encode segment");
+            ret = ERROR;
+            break;
+        }
+
+        if (write_frames(out, outbuf, outbuf_len, table) != OK) {
+            ret = ERROR;
+            break;
+        }
+        *file_len += inbuf_len;
+
+        if (hdr->flags & SALZ_FILE_FLAG_LOOKBACK) {
+            memmove(inbuf, inbuf + prefix_len, inbuf_len);
+            prefix_len = inbuf_len;
+        }
+
+        if (inbuf_len != block_len && feof(in)) {
+            ret = OK;
+            break;
+        }
+    }
+
+    free(inbuf);
+
+    return ret;
+}
+
+#ifdef SALZ_IO_URING
+
+/* Alignment of buffers, file offsets and lengths of O_DIRECT reads */
+#define DIRECT_ALIGN (4096)
+
+/* Completion tag of eventfd read, through which workers wake up I/O loop */
+#define URING_WAKEUP_TAG UINT64_MAX
+
+enum slot_state {
+    SLOT_FREE,
+    SLOT_READING,
+    SLOT_READY,
+    SLOT_WORKING,
+    SLOT_DONE,
+    SLOT_FAILED,
+    SLOT_WRITING,
+};
+
+/* Segment to be processed by the pipeline */
+struct uring_job {
+    /* Offset of segment in input file */
+    uint64_t in_off;
+    /* Length of segment in input file (in bytes) */
+    size_t in_len;
+    /* Length of history read in front of plain segment (in bytes) */
+    size_t prefix_len;
+    /* Plain length of segment (in bytes) */
+    size_t plain_len;
+};
+
+/* Buffers of a single segment travelling through the pipeline */
+struct uring_slot {
+    enum slot_state state;
+    /* Index of job occupying the slot */
+    size_t job;
+
+    /* Input buffer, segment begins at in_skew when reads are aligned */
+    uint8_t *inbuf;
+    size_t in_skew;
+    size_t in_len;
+
+    /* Output buffer */
+    uint8_t *outbuf;
+    size_t out_len;
+
+    /* Progress of read or write currently in flight (in bytes) */
+    size_t io_done;
+};
+
+struct uring_pipeline {
+    struct uring ring;
+    int in_fd;
+    int out_fd;
+    bool direct;
+
+    /* Workers signal completed slots through event_fd */
+    int event_fd;
+    uint64_t event_val;
+
+    const struct uring_job *jobs;
+    size_t jobs_len;
+
+    struct uring_slot *slots;
+    size_t slots_len;
+    size_t inbuf_cap;
+    size_t outbuf_cap;
+
+    pthread_t *workers;
+    size_t workers_len;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool stop;
+
+    /* Turn input of a job into output */
+    bool (*work)(const struct uring_job *job, const uint8_t *in,
+                 uint8_t *out, size_t out_cap, size_t *out_len);
+
+    /* Seek table collecting frames written, if any */
+    struct seek_table *seek_table;
+};
+
+static bool encode_job(const struct uring_job *job, const uint8_t *in,
+    uint8_t *out, size_t out_cap, size_t *out_len)
+{
+    return encode_frames(in, job->prefix_len, job->plain_len, out, out_cap,
+                         out_len) == OK;
+}
+
+static bool decode_job(const struct uring_job *job, const uint8_t *in,
+    uint8_t *out, size_t out_cap, size_t *out_len)
+{
+    *out_len = out_cap;
+
+    if (salz_decode_safe(in, job->in_len, out, out_len) != 0)
+        return false;
+    __atomic_fetch_add(&segments_decoded, 1, __ATOMIC_RELAXED);
+
+    return *out_len == job->plain_len;
+}
+
+static void *uring_worker(void *arg)
+{
+    struct uring_pipeline *pl = arg;
+    const uint64_t one = 1;
+
+    pthread_mutex_lock(&pl->lock);
+    for ( ;; ) {
+        struct uring_slot *slot = NULL;
+        bool ok;
+
+        /* Pick the oldest segment waiting to be processed */
+        for (size_t i = 0; i < pl->slots_len; i++) {
+            struct uring_slot *cur = &pl->slots[i];
+            if (cur->state == SLOT_READY && (slot == NULL || cur->job < slot->job))
+                slot = cur;
+        }
+
+        if (slot == NULL) {
+            if (pl->stop)
+                break;
+            pthread_cond_wait(&pl->cond, &pl->lock);
+            continue;
+        }
+
+        slot->state = SLOT_WORKING;
+        pthread_mutex_unlock(&pl->lock);
+
+        ok = pl->work(&pl->jobs[slot->job], slot->inbuf + slot->in_skew,
+                      slot->outbuf, pl->outbuf_cap, &slot->out_len);
+
+        pthread_mutex_lock(&pl->lock);
+        slot->state = ok ? SLOT_DONE : SLOT_FAILED;
+        if (write(pl->event_fd, &one, sizeof(one)) != sizeof(one))
+            log_crit("Couldn't wake up I/O loop (err: %d)", errno);
+    }
+    pthread_mutex_unlock(&pl->lock);
+
+    return NULL;
+}
+
+static uint64_t slot_tag(const struct uring_pipeline *pl,
+    const struct uring_slot *slot)
+{
+    return (uint64_t)(slot - pl->slots);
+}
+
+static bool queue_read(struct uring_pipeline *pl, struct uring_slot *slot)
+{
+    const struct uring_job *job = &pl->jobs[slot->job];
+    uint64_t off = job->in_off;
+
+    /* O_DIRECT requires aligned offsets and lengths */
+    if (pl->direct)
+        off -= off % DIRECT_ALIGN;
+
+    slot->in_skew = job->in_off - off;
+    slot->in_len = slot->in_skew + job->in_len;
+    if (pl->direct)
+        slot->in_len = roundup(slot->in_len, DIRECT_ALIGN);
+
+    return uring_prep_rw(&pl->ring, IORING_OP_READ, pl->in_fd,
+                         slot->inbuf + slot->io_done,
+                         slot->in_len - slot->io_done, off + slot->io_done,
+                         slot_tag(pl, slot));
+}
+
+static bool queue_write(struct uring_pipeline *pl, struct uring_slot *slot,
+    uint64_t off)
+{
+    return uring_prep_rw(&pl->ring, IORING_OP_WRITE, pl->out_fd,
+                         slot->outbuf + slot->io_done,
+                         slot->out_len - slot->io_done, off + slot->io_done,
+                         slot_tag(pl, slot));
+}
+
+static bool queue_wakeup(struct uring_pipeline *pl)
+{
+    return uring_prep_rw(&pl->ring, IORING_OP_READ, pl->event_fd,
+                         &pl->event_val, sizeof(pl->event_val), 0,
+                         URING_WAKEUP_TAG);
+}
+
+static int uring_pipeline_run(struct uring_pipeline *pl, uint64_t out_off)
+{
+    /* Output offsets of segments whose writes are in flight */
+    uint64_t *write_offs;
+    size_t next_read = 0;
+    size_t next_write = 0;
+    size_t written = 0;
+    size_t inflight = 0;
+
+    int ret = OK;
+
+    if ((write_offs = calloc(pl->slots_len, sizeof(*write_offs))) == NULL) {
+        log_err("Couldn't allocate memory (%zu bytes)",
+                pl->slots_len * sizeof(*write_offs));
+        return ERROR;
+    }
+
+    if (!queue_wakeup(pl)) {
+        free(write_offs);
+        return ERROR;
+    }
+
+    while (written < pl->jobs_len) {
+        struct io_uring_cqe cqe;
+
+        pthread_mutex_lock(&pl->lock);
+
+        /* Keep reads in flight for all free slots */
+        while (next_read < pl->jobs_len) {
+            struct uring_slot *slot = &pl->slots[next_read % pl->slots_len];
+
+            if (slot->state != SLOT_FREE)
+                break;
+
+            slot->job = next_read;
+            slot->io_done = 0;
+            if (!queue_read(pl, slot))
+                break;
+            slot->state = SLOT_READING;
+            inflight++;
+            next_read++;
+        }
+
+        /* Write processed segments in order */
+        while (next_write < next_read) {
+            size_t idx = next_write % pl->slots_len;
+            struct uring_slot *slot = &pl->slots[idx];
+
+            if (slot->state == SLOT_FAILED) {
+                log_err("Couldn't process segment %zu", slot->job);
+                ret = ERROR;
+            }
+
+            if (slot->state != SLOT_DONE)
+                break;
+
+            slot->io_done = 0;
+            if (!queue_write(pl, slot, out_off))
+                break;
+            if (pl->seek_table != NULL &&
+                seek_table_add(pl->seek_table, slot->outbuf,
+                               slot->out_len) != OK)
+                ret = ERROR;
+            slot->state = SLOT_WRITING;
+            write_offs[idx] = out_off;
+            out_off += slot->out_len;
+            inflight++;
+            next_write++;
+        }
+
+        pthread_mutex_unlock(&pl->lock);
+
+        if (ret != OK)
+            break;
+
+        if (uring_submit_and_wait(&pl->ring, 1) != 0) {
+            log_err("Couldn't submit I/O (err: %d)", errno);
+            ret = ERROR;
+            break;
+        }
+
+        while (ret == OK && uring_reap(&pl->ring, &cqe)) {
+            struct uring_slot *slot;
+            size_t need;
+
+            if (cqe.user_data == URING_WAKEUP_TAG) {
+                if (!queue_wakeup(pl))
+                    ret = ERROR;
+                continue;
+            }
+
+            slot = &pl->slots[cqe.user_data];
+            inflight--;
+
+            if (cqe.res < 0) {
+                log_err("Couldn't %s segment %zu (err: %d)",
+                        slot->state == SLOT_READING ? "read" : "write",
+                        slot->job, -cqe.res);
+                ret = ERROR;
+                break;
+            }
+            slot->io_done += cqe.res;
+
+            if (slot->state == SLOT_READING) {
+                /* Aligned reads may legitimately end short at end of file */
+                need = slot->in_skew + pl->jobs[slot->job].in_len;
+                if (slot->io_done >= need) {
+                    pthread_mutex_lock(&pl->lock);
+                    slot->state = SLOT_READY;
+                    pthread_cond_signal(&pl->cond);
+                    pthread_mutex_unlock(&pl->lock);
+                    continue;
+                }
+
+                if (cqe.res == 0) {
+                    log_err("Input ended unexpectedly");
+                    ret = ERROR;
+                } else if (queue_read(pl, slot)) {
+                    inflight++;
+                } else {
+                    ret = ERROR;
+                }
+            } else {
+                if (slot->io_done == slot->out_len) {
+                    pthread_mutex_lock(&pl->lock);
+                    slot->state = SLOT_FREE;
+                    pthread_mutex_unlock(&pl->lock);
+                    written++;
+                    continue;
+                }
+
+                if (cqe.res == 0) {
+                    log_err("Couldn't write segment %zu", slot->job);
+                    ret = ERROR;
+                } else if (queue_write(pl, slot, write_offs[cqe.user_data])) {
+                    inflight++;
+                } else {
+                    ret = ERROR;
+                }
+            }
+        }
+
+        if (ret != OK)
+            break;
+    }
+
+    /* Buffers must outlive all reads and writes still owned by the kernel */
+    while (inflight > 0) {
+        struct io_uring_cqe cqe;
+
+        if (uring_submit_and_wait(&pl->ring, 1) != 0)
+            break;
+
+        while (uring_reap(&pl->ring, &cqe)) {
+            if (cqe.user_data != URING_WAKEUP_TAG)
+                inflight--;
+        }
+    }
+
+    free(write_offs);
+
+    return ret;
+}
+
+static void uring_pipeline_destroy(struct uring_pipeline *pl)
+{
+    if (pl->workers != NULL) {
+        pthread_mutex_lock(&pl->lock);
+        pl->stop = true;
+        pthread_cond_broadcast(&pl->cond);
+        pthread_mutex_unlock(&pl->lock);
+
+        for (size_t i = 0; i < pl->workers_len; i++)
+            pthread_join(pl->workers[i], NULL);
+        free(pl->workers);
+    }
+
+    if (pl->slots != NULL) {
+        for (size_t i = 0; i < pl->slots_len; i++) {
+            free(pl->slots[i].inbuf);
+            free(pl->slots[i].outbuf);
+        }
+        free(pl->slots);
+    }
+
+    if (pl->event_fd >= 0)
+        close(pl->event_fd);
+
+    uring_exit(&pl->ring);
+    pthread_cond_destroy(&pl->cond);
+    pthread_mutex_destroy(&pl->lock);
+}
+
+/* Number of worker threads of pipeline */
+static size_t uring_workers_len(void)
+{
+    long cpus;
+
+    if (threads > 0)
+        return threads;
+
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return cpus > 0 ? cpus : 1;
+}
+
+/* Number of segments in flight, enough to keep workers and device busy */
+static size_t uring_slots_len(size_t workers_len)
+{
+    return 2 * workers_len + 2;
+}
+
+/* Capacity of input buffer of slot, which direct I/O reads align within */
+static size_t uring_inbuf_cap(size_t in_len_max)
+{
+    return roundup(in_len_max + DIRECT_ALIGN, DIRECT_ALIGN) + DIRECT_ALIGN;
+}
+
+/*
+ * @return  OK, if pipeline was set up
+ *          NOT_SUPPORTED, if io_uring is not available
+ *          ERROR, otherwise
+ */
+static int uring_pipeline_create(struct uring_pipeline *pl, int in_fd,
+    int out_fd, size_t in_len_max, size_t outbuf_cap)
+{
+    size_t workers_len = uring_workers_len();
+
+    memset(pl, 0, sizeof(*pl));
+    pl->in_fd = in_fd;
+    pl->out_fd = out_fd;
+    pl->event_fd = -1;
+    pthread_mutex_init(&pl->lock, NULL);
+    pthread_cond_init(&pl->cond, NULL);
+
+    pl->slots_len = uring_slots_len(workers_len);
+
+    if (uring_init(&pl->ring, 2 * pl->slots_len + 2) != 0) {
+        log_info("Couldn't set up io_uring, falling back to default I/O (err: %d)",
+                 errno);
+        uring_pipeline_destroy(pl);
+        return NOT_SUPPORTED;
+    }
+
+    if ((pl->event_fd = eventfd(0, EFD_CLOEXEC)) < 0) {
+        log_err("Couldn't create eventfd (err: %d)", errno);
+        goto fail;
+    }
+
+    if (use_direct_io) {
+        int flags = fcntl(in_fd, F_GETFL);
+        pl->direct = flags >= 0 && fcntl(in_fd, F_SETFL, flags | O_DIRECT) == 0;
+        if (!pl->direct)
+            log_info("Couldn't enable O_DIRECT, using buffered reads (err: %d)",
+                     errno);
+    }
+
+    pl->inbuf_cap = uring_inbuf_cap(in_len_max);
+    pl->outbuf_cap = outbuf_cap;
+
+    if ((pl->slots = calloc(pl->slots_len, sizeof(*pl->slots))) == NULL) {
+        log_err("Couldn't allocate memory (%zu bytes)",
+                pl->slots_len * sizeof(*pl->slots));
+        goto fail;
+    }
+
+    for (size_t i = 0; i < pl->slots_len; i++) {
+        struct uring_slot *slot = &pl->slots[i];
+
+        if (posix_memalign((void **)&slot->inbuf, DIRECT_ALIGN, pl->inbuf_cap) != 0 ||
+            posix_memalign((void **)&slot->outbuf, DIRECT_ALIGN, pl->outbuf_cap) != 0) {
+            log_err("Couldn't allocate memory (%zu bytes)",
+                    pl->inbuf_cap + pl->outbuf_cap);
+            goto fail;
+        }
+    }
+
+    if ((pl->workers = calloc(workers_len, sizeof(*pl->workers))) == NULL) {
+        log_err("Couldn't allocate memory (%zu bytes)",
+                workers_len * sizeof(*pl->workers));
+        goto fail;
+    }
+
+    for ( ; pl->workers_len < workers_len; pl->workers_len++) {
+        if (pthread_create(&pl->workers[pl->workers_len], NULL, uring_worker,
+                           pl) != 0) {
+            log_err("Couldn't create worker thread");
+            goto fail;
+        }
+    }
+    threads_used = pl->workers_len;
+
+    return OK;
+
+fail:
+    uring_pipeline_destroy(pl);
+    return ERROR;
+}
+
+static int compress_uring(FILE *in, FILE *out, const struct file_hdr *tmpl)
+{
+    struct uring_pipeline pl;
+    struct uring_job *jobs;
+    size_t jobs_len;
+    struct file_hdr hdr = *tmpl;
+    uint8_t salz_hdr[SALZ_FILE_HDR_LEN];
+    uint8_t footer[SALZ_SEEK_FOOTER_LEN];
+    struct seek_table table = {
+        .frames_end = SALZ_FILE_HDR_LEN,
+    };
+    size_t table_len;
+    struct stat st;
+
+    int ret;
+
+    if (fstat(fileno(in), &st) != 0) {
+        log_err("Couldn't stat input (err: %d)", errno);
+        return ERROR;
+    }
+    hdr.file_len = st.st_size;
+
+    jobs_len = divup(hdr.file_len, hdr.block_len);
+    if ((jobs = calloc(jobs_len + 1, sizeof(*jobs))) == NULL) {
+        log_err("Couldn't allocate memory (%zu bytes)", jobs_len * sizeof(*jobs));
+        return ERROR;
+    }
+
+    /* With lookback, preceding segment is read again as history */
+    for (size_t i = 0; i < jobs_len; i++) {
+        uint64_t off = (uint64_t)i * hdr.block_len;
+
+        jobs[i].plain_len = min(hdr.block_len, hdr.file_len - off);
+        jobs[i].prefix_len = i && (hdr.flags & SALZ_FILE_FLAG_LOOKBACK) ?
+                             hdr.block_len : 0;
+        jobs[i].in_off = off - jobs[i].prefix_len;
+        jobs[i].in_len = jobs[i].prefix_len + jobs[i].plain_len;
+    }
+
+    ret = uring_pipeline_create(&pl, fileno(in), fileno(out),
+                                2 * hdr.block_len,
+                                frames_len_max(hdr.block_len));
+    if (ret != OK) {
+        free(jobs);
+        return ret;
+    }
+
+    pl.jobs = jobs;
+    pl.jobs_len = jobs_len;
+    pl.work = encode_job;
+    if (hdr.flags & SALZ_FILE_FLAG_SEEK_TABLE)
+        pl.seek_table = &table;
+
+    ret = uring_pipeline_run(&pl, SALZ_FILE_HDR_LEN);
+
+    uring_pipeline_destroy(&pl);
+    free(jobs);
+
+    /* Seek table follows the last frame written */
+    if (ret == OK && (hdr.flags & SALZ_FILE_FLAG_SEEK_TABLE)) {
+        table_len = table.entries_cnt * SALZ_SEEK_ENTRY_LEN;
+        pack_seek_footer(&table, footer);
+
+        if (pwrite(fileno(out), table.entries, table_len,
+                   table.frames_end) != (ssize_t)table_len ||
+            pwrite(fileno(out), footer, sizeof(footer),
+                   table.frames_end + table_len) != sizeof(footer)) {
+            log_err("Couldn't write seek table to output");
+            ret = ERROR;
+        }
+    }
+    free(table.entries);
+
+    if (ret != OK)
+        return ret;
+
+    pack_header(&hdr, salz_hdr);
+    if (pwrite(fileno(out), salz_hdr, sizeof(salz_hdr), 0) != sizeof(salz_hdr)) {
+        log_err("Couldn't write SALZ header to output");
+        return ERROR;
+    }
+
+    return OK;
+}
+
+static int decompress_uring(FILE *in, FILE *out)
+{
+    struct uring_pipeline pl;
+    struct uring_job *jobs = NULL;
+    size_t jobs_len = 0;
+    size_t jobs_cap = 0;
+    struct file_hdr hdr;
+    uint8_t salz_hdr[SALZ_FILE_HDR_LEN];
+    uint64_t pos;
+    uint64_t plain_pos = 0;
+    struct stat st;
+    int fd = fileno(in);
+
+    int ret;
+
+    if (fstat(fd, &st) != 0) {
+        log_err("Couldn't stat input (err: %d)", errno);
+        return ERROR;
+    }
+
+    if (pread(fd, salz_hdr, SALZ_FILE_HDR_LEN_LEGACY, 0) != SALZ_FILE_HDR_LEN_LEGACY) {
+        log_err("Couldn't read SALZ header from input");
+        return ERROR;
+    }
+
+    /* Locating legacy segments would require decoding them */
+    if (salz_hdr[4] == SALZ_FILE_VERSION_LEGACY)
+        return NOT_SUPPORTED;
+
+    if (pread(fd, salz_hdr, SALZ_FILE_HDR_LEN, 0) != SALZ_FILE_HDR_LEN) {
+        log_err("Couldn't read SALZ header from input");
+        return ERROR;
+    }
+
+    if (unpack_header(salz_hdr, sizeof(salz_hdr), &hdr) != OK)
+        return ERROR;
+
+    /* Segments depending on preceding ones can't be decoded in parallel */
+    if (hdr.flags & SALZ_FILE_FLAG_LOOKBACK)
+        return NOT_SUPPORTED;
+
+    /* Index segments through their frame headers */
+    for (pos = SALZ_FILE_HDR_LEN; pos < (uint64_t)st.st_size; ) {
+        if (frames_end(&hdr, plain_pos))
+            break;
+
+        uint8_t frame_hdr[SALZ_FRAME_HDR_LEN];
+        uint32_t encoded_len;
+        uint32_t plain_len;
+
+        if (pread(fd, frame_hdr, sizeof(frame_hdr), pos) != sizeof(frame_hdr)) {
+            log_err("Couldn't read segment frame header from input stream");
+            ret = ERROR;
+            goto out;
+        }
+        unpack_frame_hdr(frame_hdr, &hdr, &encoded_len, &plain_len);
+        pos += SALZ_FRAME_HDR_LEN;
+
+        if (encoded_len > salz_encoded_len_max(hdr.block_len) ||
+            encoded_len > st.st_size - pos ||
+            plain_len > hdr.block_len || plain_len > hdr.file_len - plain_pos) {
+            log_err("Malformed segment frame at offset %lu", pos);
+            ret = ERROR;
+            goto out;
+        }
+
+        if (jobs_len == jobs_cap) {
+            struct uring_job *tmp;
+
+            jobs_cap = jobs_cap ? 2 * jobs_cap : 64;
+            if ((tmp = realloc(jobs, jobs_cap * sizeof(*jobs))) == NULL) {
+                log_err("Couldn't allocate memory (%zu bytes)",
+                        jobs_cap * sizeof(*jobs));
+                ret = ERROR;
+                goto out;
+            }
+            jobs = tmp;
+        }
+
+        jobs[jobs_len].in_off = pos;
+        jobs[jobs_len].in_len = encoded_len;
+        jobs[jobs_len].plain_len = plain_len;
+        jobs_len++;
+
+        pos += encoded_len;
+        plain_pos += plain_len;
+    }
+
+    if (plain_pos != hdr.file_len) {
+        log_err("Input is truncated (expected: %lu, have: %lu bytes)",
+                hdr.file_len, plain_pos);
+        ret = ERROR;
+        goto out;
+    }
+
+    ret = uring_pipeline_create(&pl, fd, fileno(out),
+                                salz_encoded_len_max(hdr.block_len),
+                                hdr.block_len);
+    if (ret != OK)
+        goto out;
+
+    pl.jobs = jobs;
+    pl.jobs_len = jobs_len;
+    pl.work = decode_job;
+
+    ret = uring_pipeline_run(&pl, 0);
+
+    uring_pipeline_destroy(&pl);
+
+out:
+    free(jobs);
+
+    return ret;
+}
+
+#endif /* SALZ_IO_URING */
+
+static int compress(FILE *in, FILE *out)
+{
+    uint8_t *inmap;
+    size_t inmap_len = 0;
+    uint8_t *outbuf;
+    size_t outbuf_cap;
+
+    struct seek_table table = {
+        .frames_end = SALZ_FILE_HDR_LEN,
+    };
+    struct seek_table *tablep = use_seek_table ? &table : NULL;
+
+    struct file_hdr hdr = {
+        .version = SALZ_FILE_VERSION,
+        .flags = (use_lookback ? SALZ_FILE_FLAG_LOOKBACK : 0) |
+                 (use_seek_table ? SALZ_FILE_FLAG_SEEK_TABLE : 0) |
+                 (encode_opts.restart_len ? SALZ_FILE_FLAG_RESTARTS : 0),
+        .block_len = get_block_len(),
+        .file_len = 0,
+    };
+
+    int ret;
+
+#ifdef SALZ_IO_URING
+    if (use_uring) {
+        ret = compress_uring(in, out, &hdr);
+        if (ret != NOT_SUPPORTED)
+            return ret;
+    }
+#endif
+
+    outbuf_cap = frames_len_max(hdr.block_len);
+    if ((outbuf = malloc(outbuf_cap)) == NULL) {
+        log_err("Couldn't allocate memory: (%zu bytes)", outbuf_cap);
+        return ERROR;
+    }
+
+    /* Header is rewritten once the length of input is known for sure */
+    if (write_header(out, &hdr) != OK) {
+        free(outbuf);
+        return ERROR;
+    }
+
+    inmap = map_input(in, &inmap_len);
+    if (inmap != NULL) {
+        ret = compress_mapped(inmap, inmap_len, out, outbuf, outbuf_cap, &hdr,
+                              tablep);
+        hdr.file_len = inmap_len;
+        munmap(inmap, inmap_len);
+    } else {
+        ret = compress_stream(in, out, outbuf, outbuf_cap, &hdr, tablep,
+                              &hdr.file_len);
+    }
+
+    free(outbuf);
+
+    if (ret == OK && tablep != NULL)
+        ret = write_seek_table(out, tablep);
+    free(table.entries);
 
-#include <linux/limits.h>
+    if (ret != OK)
+        return ret;
 
-#include "common.h"
-#include "salz.h"
+    if (fseek(out, 0, SEEK_SET) != 0) {
+        log_err("Couldn't rewind output stream (err: %d)", errno);
+        return ERROR;
+    }
 
-static const uint32_t salz_magic = 0x53414C5A;
+    return write_header(out, &hdr);
+}
 
-#define OK     (0)
-#define ERROR (-1)
+/*
+ * Estimates peak memory of compression, short of input mapped from page
+ * cache
+ */
+static uint64_t compress_memory_len(size_t block_len, size_t workers_len)
+{
+    size_t prefix_len = use_lookback ? block_len : 0;
+    uint64_t workspace_len = salz_encode_workspace_len(prefix_len, block_len,
+                                                       use_adaptive);
+
+#ifdef SALZ_IO_URING
+    /* Each slot holds room for history besides segment */
+    if (use_uring)
+        return uring_slots_len(workers_len) *
+               (uring_inbuf_cap(2 * block_len) + frames_len_max(block_len)) +
+               workers_len * workspace_len;
+#else
+    unused(workers_len);
+#endif
+
+    return prefix_len + block_len + frames_len_max(block_len) + workspace_len;
+}
 
-static const char *suffix = ".salz";
-static const char *unsalz = "unsalz";
-static const char *salzcat = "salzcat";
+/* Blocks aren't halved below this length to fit into memory limit */
+#define BLOCK_LEN_FIT_MIN (32768u)
 
-enum operation_mode {
-    COMPRESS,
-    DECOMPRESS,
-    PRINT_INFO,
-};
-static int operation_mode = COMPRESS;
+/*
+ * Fits compression into memory limit by giving up worker threads first and
+ * then halving block length
+ */
+static int fit_memory_limit(void)
+{
+    size_t workers_len = 1;
+    size_t workers_len_max;
+    size_t len = get_block_len();
+
+#ifdef SALZ_IO_URING
+    if (use_uring)
+        workers_len = uring_workers_len();
+#endif
+    workers_len_max = workers_len;
+
+    while (compress_memory_len(len, workers_len) > memory_limit) {
+        if (workers_len > 1) {
+            workers_len--;
+        } else if (len / 2 >= BLOCK_LEN_FIT_MIN) {
+            len /= 2;
+        } else {
+            log_err("Memory limit of %" PRIu64 " bytes is below %" PRIu64
+                    " bytes needed", memory_limit,
+                    compress_memory_len(len, 1));
+            return ERROR;
+        }
+    }
 
-enum log_lvl {
-    LOG_LVL_NONE,
-    LOG_LVL_CRITICAL,
-    LOG_LVL_ERROR,
-    LOG_LVL_INFO,
-};
-static int log_lvl = LOG_LVL_INFO;
+    if (workers_len != workers_len_max || len != get_block_len())
+        log_info("Compressing blocks of %zu bytes with %zu thread(s) to stay "
+                 "within %" PRIu64 " bytes", len, workers_len, memory_limit);
+    threads = workers_len;
+    block_len = len;
 
-static bool overwrite_output = false;
-static bool keep_input = false;
-static int compression_level = 5;
+    return OK;
+}
 
-#define log(lvl, fmt, ...) \
-    do { \
-        if (lvl <= log_lvl) \
-            fprintf(stderr, fmt "\n", ## __VA_ARGS__);\
-    } while (0)
+#ifdef SALZ_STATS
 
-#define log_crit(fmt, ...) log(LOG_LVL_CRITICAL, fmt, ## __VA_ARGS__)
-#define log_err(fmt, ...) log(LOG_LVL_ERROR, fmt, ## __VA_ARGS__)
-#define log_info(fmt, ...) log(LOG_LVL_INFO, fmt, ## __VA_ARGS__)
+static const char *phase_names[SALZ_PHASE_MAX] = {
+    [SALZ_PHASE_SUFFIX_ARRAY] = "suffix array",
+    [SALZ_PHASE_PSVNSV_ARRAY] = "psv/nsv",
+    [SALZ_PHASE_FACTORIZE] = "factorize",
+    [SALZ_PHASE_OPTIMIZE] = "optimize",
+    [SALZ_PHASE_EMIT] = "emit",
+};
 
-static const char *get_filename(const char *path)
+static void stats_add(struct salz_stats *total, const struct salz_stats *stats)
 {
-    const char *name;
-    if ((name = strrchr(path, '/')) != NULL)
-        return name + 1;
-
-    return path;
+    total->segments += stats->segments;
+    total->plain_early += stats->plain_early;
+    total->plain_late += stats->plain_late;
+    total->plain_len += stats->plain_len;
+    total->encoded_len += stats->encoded_len;
+    total->literals_cnt += stats->literals_cnt;
+    total->factors_cnt += stats->factors_cnt;
+    total->factors_len += stats->factors_len;
+    total->factor_len_max = max(total->factor_len_max, stats->factor_len_max);
+    for (size_t i = 0; i < SALZ_STATS_OFFS_BUCKETS; i++)
+        total->offs_hist[i] += stats->offs_hist[i];
+    for (size_t i = 0; i < SALZ_STATS_LEN_BUCKETS; i++)
+        total->len_hist[i] += stats->len_hist[i];
+    total->token_bits += stats->token_bits;
+    total->literal_bits += stats->literal_bits;
+    total->offs_bits += stats->offs_bits;
+    total->len_bits += stats->len_bits;
+    total->cost_bits += stats->cost_bits;
+    total->parsed_len += stats->parsed_len;
+    for (size_t i = 0; i < SALZ_PHASE_MAX; i++)
+        total->phase_ns[i] += stats->phase_ns[i];
+    total->workspace_len = max(total->workspace_len, stats->workspace_len);
 }
 
-static void fill_outpath(const char *path, char buf[PATH_MAX])
+static double percent(uint64_t part, uint64_t whole)
 {
-    size_t path_len = strlen(path);
-    size_t suffix_len = strlen(suffix);
-
-    if (operation_mode == DECOMPRESS) {
-        size_t copy_len = path_len - suffix_len;
-        memcpy(buf, path, copy_len);
-        buf[copy_len] = '\0';
-    } else {
-        /* @todo: check this with fresh eyes */
-        const char *filename = get_filename(path);
-        size_t filename_len = strlen(filename);
-        size_t copy_len = path_len;
+    return whole ? 100.0 * part / whole : 0.0;
+}
 
-        if (filename_len + suffix_len + 1 > NAME_MAX)
-            copy_len = path_len - filename_len + (NAME_MAX - (suffix_len + 1));
+static uint64_t hist_cnt(const uint64_t *hist, size_t buckets_cnt, size_t i)
+{
+    return i < buckets_cnt ? hist[i] : 0;
+}
 
-        if (path_len + suffix_len + 1 > PATH_MAX)
-            copy_len = PATH_MAX - (suffix_len + 1);
+static void print_hist(const struct salz_stats *stats)
+{
+    size_t buckets_cnt = max(SALZ_STATS_OFFS_BUCKETS, SALZ_STATS_LEN_BUCKETS);
+    size_t first = SIZE_MAX;
+    size_t last = 0;
+
+    for (size_t i = 0; i < buckets_cnt; i++) {
+        if (hist_cnt(stats->offs_hist, SALZ_STATS_OFFS_BUCKETS, i) ||
+            hist_cnt(stats->len_hist, SALZ_STATS_LEN_BUCKETS, i)) {
+            first = min(first, i);
+            last = i;
+        }
+    }
 
-        memcpy(buf, path, copy_len);
-        memcpy(buf + copy_len, suffix, suffix_len);
-        buf[copy_len + suffix_len] = '\0';
+    if (first == SIZE_MAX)
+        return;
+
+    printf("  %-24s %19s %19s\n", "factors by", "offset", "length");
+    for (size_t i = first; i <= last; i++) {
+        uint64_t offs_cnt = hist_cnt(stats->offs_hist, SALZ_STATS_OFFS_BUCKETS,
+                                     i);
+        uint64_t len_cnt = hist_cnt(stats->len_hist, SALZ_STATS_LEN_BUCKETS, i);
+        char range[48];
+
+        snprintf(range, sizeof(range), "[%" PRIu64 ", %" PRIu64 ")",
+                 UINT64_C(1) << i, UINT64_C(1) << (i + 1));
+        printf("  %-24s %10" PRIu64 " %7.2f%% %10" PRIu64 " %7.2f%%\n", range,
+               offs_cnt, percent(offs_cnt, stats->factors_cnt),
+               len_cnt, percent(len_cnt, stats->factors_cnt));
     }
 }
 
-static int compress(FILE *in, FILE *out)
+static void print_stats(const char *name, const struct salz_stats *stats)
+{
+    uint64_t bits = stats->token_bits + stats->literal_bits +
+                    stats->offs_bits + stats->len_bits;
+    uint64_t cost_len = divup(stats->cost_bits, 8);
+
+    printf("%s: %" PRIu64 " bytes to %" PRIu64 " bytes (ratio: %.3f)\n", name,
+           stats->plain_len, stats->encoded_len,
+           stats->encoded_len ? 1.0 * stats->plain_len / stats->encoded_len : 0.0);
+    printf("  segments     %" PRIu64 ", stored plain %" PRIu64 " (%" PRIu64
+           " detected before encoding)\n", stats->segments,
+           stats->plain_early + stats->plain_late, stats->plain_early);
+    printf("  tokens       %" PRIu64 " literals, %" PRIu64 " factors "
+           "(length mean: %.2f, max: %" PRIu64 ")\n", stats->literals_cnt,
+           stats->factors_cnt, stats->factors_cnt ?
+           1.0 * stats->factors_len / stats->factors_cnt : 0.0,
+           stats->factor_len_max);
+    printf("  bits         tokens %.2f%%, literals %.2f%%, offsets %.2f%%, "
+           "lengths %.2f%% of %" PRIu64 "\n",
+           percent(stats->token_bits, bits), percent(stats->literal_bits, bits),
+           percent(stats->offs_bits, bits), percent(stats->len_bits, bits),
+           bits);
+    printf("  parse cost   %" PRIu64 " bytes, emitted as %" PRIu64 " bytes "
+           "(overhead: %.2f%%)\n", cost_len, stats->parsed_len,
+           percent(stats->parsed_len - min(cost_len, stats->parsed_len),
+                   cost_len));
+    printf("  phases      ");
+    for (size_t i = 0; i < SALZ_PHASE_DONE; i++)
+        printf(" %s %.3f ms%s", phase_names[i], stats->phase_ns[i] / 1e6,
+               i + 1 < SALZ_PHASE_DONE ? "," : "\n");
+    print_hist(stats);
+}
+
+static int explain(FILE *in, const char *path)
 {
     uint8_t *inbuf;
     uint8_t *outbuf;
     size_t inbuf_cap;
     size_t outbuf_cap;
+    size_t block_len = get_block_len();
+    size_t prefix_len = 0;
+    uint64_t pos = 0;
+    size_t segments_cnt = 0;
+    struct salz_stats stats;
+    struct salz_stats total;
+    int ret = OK;
 
-    uint32_t plain_len = 1 << (15 + compression_level);
-    /*
-     * @todo: create more substantial file header which contais
-     * magic number, version, flags, original size, original
-     * timestamp(s), original filename and checksum (optional)
-     */
-    uint8_t salz_hdr[8];
+    /* Room for preceding segment as history in front of current one */
+    inbuf_cap = use_lookback ? 2 * block_len : block_len;
+    outbuf_cap = frames_len_max(block_len);
+    inbuf = malloc(inbuf_cap);
+    outbuf = malloc(outbuf_cap);
+    if (inbuf == NULL || outbuf == NULL) {
+        log_err("Couldn't allocate memory: (%zu bytes)", inbuf_cap + outbuf_cap);
+        free(inbuf);
+        free(outbuf);
+        return ERROR;
+    }
 
-    int ret = OK;
+    memset(&total, 0, sizeof(total));
+    encode_opts.stats = &stats;
 
-    static_assert(sizeof(salz_magic) + sizeof(plain_len) == sizeof(salz_hdr));
-    memcpy(salz_hdr, &salz_magic, sizeof(salz_magic));
-    memcpy(salz_hdr + sizeof(salz_magic), &plain_len, sizeof(plain_len));
+    for ( ;; ) {
+        size_t inbuf_len = fread(inbuf + prefix_len, 1, block_len, in);
+        size_t outbuf_len = outbuf_cap;
+        char name[PATH_MAX + 64];
 
-    inbuf_cap = plain_len;
-    if ((inbuf = malloc(inbuf_cap)) == NULL) {
-        log_err("Couldn't allocate memory: (%zu bytes)", inbuf_cap);
-        return ERROR;
+        if (ferror(in)) {
+            log_err("Couldn't read from input stream");
+            ret = ERROR;
+            break;
+        }
+
+        if (inbuf_len == 0)
+            break;
+
+        /* Encoding goes nowhere, it is only taken apart */
+        if (encode_frames(inbuf, prefix_len, inbuf_len, outbuf, outbuf_cap,
+                          &outbuf_len) != OK) {
+            log_err("Couldn't encode segment");
+            ret = ERROR;
+            break;
+        }
+
+        snprintf(name, sizeof(name), "%s: segment %zu at %" PRIu64, path,
+                 segments_cnt++, pos);
+        print_stats(name, &stats);
+        stats_add(&total, &stats);
+        pos += inbuf_len;
+
+        if (use_lookback) {
+            memmove(inbuf, inbuf + prefix_len, inbuf_len);
+            prefix_len = inbuf_len;
+        }
     }
 
-    outbuf_cap = salz_encoded_len_max(inbuf_cap);
-    if ((outbuf = malloc(outbuf_cap)) == NULL) {
-        log_err("Couldn't allocate memory: (%zu bytes)", outbuf_cap);
-        free(inbuf);
-        return ERROR;
+    if (ret == OK && segments_cnt > 1)
+        print_stats(path, &total);
+
+    encode_opts.stats = NULL;
+    free(inbuf);
+    free(outbuf);
+
+    return ret;
+}
+
+#endif /* SALZ_STATS */
+
+static uint8_t *map_output(FILE *stream, uint64_t len)
+{
+    void *addr;
+    int fd = fileno(stream);
+    int rc;
+
+    if (!use_mmap || len == 0 || len > SIZE_MAX)
+        return NULL;
+
+    /* Reserve space upfront, running out of it later would raise SIGBUS */
+    if ((rc = posix_fallocate(fd, 0, len)) != 0) {
+        log_info("Couldn't allocate output, falling back to write() (err: %d)", rc);
+        return NULL;
     }
 
-    if (fwrite(salz_hdr, 1, sizeof(salz_hdr), out) != sizeof(salz_hdr)) {
-        log_err("Couldn't write SALZ header to output");
-        free(outbuf);
-        free(inbuf);
+    addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        log_info("Couldn't map output, falling back to write() (err: %d)", errno);
+        return NULL;
+    }
+
+    return addr;
+}
+
+static int decompress_mapped(const uint8_t *in, size_t in_len,
+    const struct file_hdr *hdr, FILE *out)
+{
+    uint8_t *outmap = NULL;
+    uint8_t *outbuf = NULL;
+    size_t outbuf_cap = hdr->block_len;
+    uint64_t out_pos = 0;
+    size_t prefix_len = 0;
+    size_t pos = header_len(hdr);
+
+    int ret = OK;
+
+    /*
+     * When length of original file is known, segments are decoded straight
+     * into their final place in a mapping of the output file.
+     */
+    if (hdr->version != SALZ_FILE_VERSION_LEGACY)
+        outmap = map_output(out, hdr->file_len);
+
+    /* Room for preceding segment as history in front of current one */
+    if (hdr->flags & SALZ_FILE_FLAG_LOOKBACK)
+        outbuf_cap *= 2;
+
+    if (outmap == NULL && (outbuf = malloc(outbuf_cap)) == NULL) {
+        log_err("Couldn't allocate memory (%zu bytes)", outbuf_cap);
         return ERROR;
     }
 
-    for ( ;; ) {
-        size_t inbuf_len;
-        size_t outbuf_len = outbuf_cap;
+    while (pos < in_len && !frames_end(hdr, out_pos)) {
+        uint8_t *dst;
+        size_t dst_len;
         uint32_t encoded_len;
+        uint32_t plain_len;
 
-        if ((inbuf_len = fread(inbuf, 1, inbuf_cap, in)) != inbuf_cap) {
-            if (ferror(in)) {
-                log_err("Couldn't read from input stream");
-                ret = ERROR;
-                break;
-            }
+        if (in_len - pos < frame_hdr_len(hdr)) {
+            log_err("Couldn't read segment frame header from input stream");
+            ret = ERROR;
+            break;
         }
+        unpack_frame_hdr(in + pos, hdr, &encoded_len, &plain_len);
+        pos += frame_hdr_len(hdr);
 
-        if (salz_encode_safe(inbuf, inbuf_len, outbuf, &outbuf_len) != 0) {
-            log_err("Couldn't encode segment");
+        if (encoded_len > in_len - pos) {
+            log_err("Couldn't read encoded segment from input stream");
             ret = ERROR;
             break;
         }
 
-        encoded_len = outbuf_len;
-        if (fwrite(&encoded_len, 1, sizeof(encoded_len), out) != sizeof(encoded_len)) {
-            log_err("Couldn't write encoded segments length to output stream");
+        if (hdr->version != SALZ_FILE_VERSION_LEGACY &&
+            (plain_len > hdr->block_len || plain_len > hdr->file_len - out_pos)) {
+            log_err("Segment exceeds length recorded in SALZ header");
             ret = ERROR;
             break;
         }
 
-        if (fwrite(outbuf, 1, outbuf_len, out) != outbuf_len) {
-            log_err("Couldn't write encoded segment to output stream");
+        advise_range(in, in_len, pos + encoded_len,
+                     salz_encoded_len_max(hdr->block_len), MADV_WILLNEED);
+
+        dst = outmap != NULL ? outmap + out_pos - prefix_len : outbuf;
+        dst_len = outmap != NULL ? plain_len : outbuf_cap - prefix_len;
+
+        if (salz_decode_prefix_safe(in + pos, encoded_len, dst, prefix_len,
+                                    &dst_len) != 0) {
+            log_err("Couldn't decode segment");
             ret = ERROR;
             break;
         }
+        __atomic_fetch_add(&segments_decoded, 1, __ATOMIC_RELAXED);
+        pos += encoded_len;
 
-        if (inbuf_len != inbuf_cap && feof(in)) {
-            ret = OK;
+        if (hdr->version != SALZ_FILE_VERSION_LEGACY && dst_len != plain_len) {
+            log_err("Decoded segment length differs from recorded one");
+            ret = ERROR;
+            break;
+        }
+
+        if (outmap == NULL && fwrite(outbuf + prefix_len, 1, dst_len, out) != dst_len) {
+            log_err("Couldn't write decoded segment to output stream");
+            ret = ERROR;
             break;
         }
+        out_pos += dst_len;
+
+        if (hdr->flags & SALZ_FILE_FLAG_LOOKBACK) {
+            if (outmap == NULL)
+                memmove(outbuf, outbuf + prefix_len, dst_len);
+            prefix_len = dst_len;
+        }
+    }
+
+    if (ret == OK && hdr->version != SALZ_FILE_VERSION_LEGACY &&
+        out_pos != hdr->file_len) {
+        log_err("Input is truncated (expected: %lu, have: %lu bytes)",
+                hdr->file_len, out_pos);
+        ret = ERROR;
     }
 
+    if (outmap != NULL)
+        munmap(outmap, hdr->file_len);
     free(outbuf);
-    free(inbuf);
 
     return ret;
 }
 
-static int decompress(FILE *in, FILE *out)
+static int decompress_stream(FILE *in, FILE *out)
 {
     uint8_t *inbuf;
     uint8_t *outbuf;
     size_t inbuf_cap;
     size_t outbuf_cap;
 
-    uint8_t salz_hdr[8];
-    uint32_t plain_len;
+    uint8_t salz_hdr[SALZ_FILE_HDR_LEN];
+    struct file_hdr hdr;
+    uint64_t out_pos = 0;
+    size_t prefix_len = 0;
 
     int ret = OK;
 
-    if (fread(salz_hdr, 1, sizeof(salz_hdr), in) != sizeof(salz_hdr)) {
+    if (fread(salz_hdr, 1, SALZ_FILE_HDR_LEN_LEGACY, in) != SALZ_FILE_HDR_LEN_LEGACY) {
         log_err("Couldn't read SALZ header from input");
         return ERROR;
     }
 
-    if (memcmp(salz_hdr, &salz_magic, sizeof(salz_magic)) != 0) {
-        log_err("Not a SALZ header, unexpected magic number");
+    if (salz_hdr[4] != SALZ_FILE_VERSION_LEGACY &&
+        fread(salz_hdr + SALZ_FILE_HDR_LEN_LEGACY, 1,
+              SALZ_FILE_HDR_LEN - SALZ_FILE_HDR_LEN_LEGACY, in) !=
+        SALZ_FILE_HDR_LEN - SALZ_FILE_HDR_LEN_LEGACY) {
+        log_err("Couldn't read SALZ header from input");
         return ERROR;
     }
-    memcpy(&plain_len, salz_hdr + sizeof(salz_magic), sizeof(plain_len));
 
-    inbuf_cap = salz_encoded_len_max(plain_len);
+    if (unpack_header(salz_hdr, sizeof(salz_hdr), &hdr) != OK)
+        return ERROR;
+
+    inbuf_cap = salz_encoded_len_max(hdr.block_len);
     if ((inbuf = malloc(inbuf_cap)) == NULL) {
         log_err("Couldn't allocate memory (%zu bytes)", inbuf_cap);
         return ERROR;
     }
 
-    outbuf_cap = plain_len;
+    /* Room for preceding segment as history in front of current one */
+    outbuf_cap = hdr.block_len;
+    if (hdr.flags & SALZ_FILE_FLAG_LOOKBACK)
+        outbuf_cap *= 2;
+
     if ((outbuf = malloc(outbuf_cap)) == NULL) {
         log_err("Couldn't allocate memory (%zu bytes)", outbuf_cap);
         free(inbuf);
@@ -221,13 +1806,18 @@ static int decompress(FILE *in, FILE *out)
     }
 
     for ( ;; ) {
+        uint8_t frame_hdr[SALZ_FRAME_HDR_LEN];
         size_t inbuf_len;
-        size_t outbuf_len = outbuf_cap;
+        size_t outbuf_len = outbuf_cap - prefix_len;
         uint32_t encoded_len;
+        uint32_t plain_len;
+
+        if (frames_end(&hdr, out_pos))
+            break;
 
-        if (fread(&encoded_len, 1, sizeof(encoded_len), in) != sizeof(encoded_len)) {
+        if (fread(frame_hdr, 1, frame_hdr_len(&hdr), in) != frame_hdr_len(&hdr)) {
             if (ferror(in)) {
-                log_err("Couldn't read encoded segments length from input stream");
+                log_err("Couldn't read segment frame header from input stream");
                 ret = ERROR;
                 break;
             }
@@ -237,6 +1827,7 @@ static int decompress(FILE *in, FILE *out)
                 break;
             }
         }
+        unpack_frame_hdr(frame_hdr, &hdr, &encoded_len, &plain_len);
 
         if (encoded_len > inbuf_cap) {
             log_err("Encoded segment too large to fit into input buffer");
@@ -250,17 +1841,38 @@ static int decompress(FILE *in, FILE *out)
             break;
         }
 
-        if (salz_decode_safe(inbuf, inbuf_len, outbuf, &outbuf_len) != 0) {
+        if (salz_decode_prefix_safe(inbuf, inbuf_len, outbuf, prefix_len,
+                                    &outbuf_len) != 0) {
             log_err("Couldn't decode segment");
             ret = ERROR;
             break;
         }
+        __atomic_fetch_add(&segments_decoded, 1, __ATOMIC_RELAXED);
+
+        if (hdr.version != SALZ_FILE_VERSION_LEGACY && outbuf_len != plain_len) {
+            log_err("Decoded segment length differs from recorded one");
+            ret = ERROR;
+            break;
+        }
 
-        if (fwrite(outbuf, 1, outbuf_len, out) != outbuf_len) {
+        if (fwrite(outbuf + prefix_len, 1, outbuf_len, out) != outbuf_len) {
             log_err("Couldn't write decoded segment to output stream");
             ret = ERROR;
             break;
         }
+        out_pos += outbuf_len;
+
+        if (hdr.flags & SALZ_FILE_FLAG_LOOKBACK) {
+            memmove(outbuf, outbuf + prefix_len, outbuf_len);
+            prefix_len = outbuf_len;
+        }
+    }
+
+    if (ret == OK && hdr.version != SALZ_FILE_VERSION_LEGACY &&
+        out_pos != hdr.file_len) {
+        log_err("Input is truncated (expected: %lu, have: %lu bytes)",
+                hdr.file_len, out_pos);
+        ret = ERROR;
     }
 
     free(outbuf);
@@ -269,6 +1881,105 @@ static int decompress(FILE *in, FILE *out)
     return ret;
 }
 
+static int decompress(FILE *in, FILE *out)
+{
+    uint8_t *inmap;
+    size_t inmap_len = 0;
+    struct file_hdr hdr;
+    int ret;
+
+#ifdef SALZ_IO_URING
+    if (use_uring) {
+        ret = decompress_uring(in, out);
+        if (ret != NOT_SUPPORTED)
+            return ret;
+    }
+#endif
+
+    inmap = map_input(in, &inmap_len);
+    if (inmap == NULL)
+        return decompress_stream(in, out);
+
+    if ((ret = unpack_header(inmap, inmap_len, &hdr)) == OK)
+        ret = decompress_mapped(inmap, inmap_len, &hdr, out);
+
+    munmap(inmap, inmap_len);
+
+    return ret;
+}
+
+static double timeval_sec(const struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec * 1e-6;
+}
+
+static void print_json_str(const char *str)
+{
+    putchar('"');
+    for ( ; *str != '\0'; str++) {
+        unsigned char c = *str;
+
+        if (c == '"' || c == '\\')
+            printf("\\%c", c);
+        else if (c < 0x20)
+            printf("\\u%04x", c);
+        else
+            putchar(c);
+    }
+    putchar('"');
+}
+
+/*
+ * Prints statistics of processing a file as a JSON object of its own line.
+ * CPU time covers all threads, and peak RSS is that of process so far.
+ */
+static void print_stats_json(const char *path, uint64_t plain_len,
+    uint64_t encoded_len, uint64_t wall_ns, const struct rusage *ru_begin,
+    const struct rusage *ru_end, uint64_t segments, uint64_t plain_segments)
+{
+    double cpu_sec = timeval_sec(&ru_end->ru_utime) +
+                     timeval_sec(&ru_end->ru_stime) -
+                     timeval_sec(&ru_begin->ru_utime) -
+                     timeval_sec(&ru_begin->ru_stime);
+    double wall_sec = wall_ns * 1.0 / NS_IN_SEC;
+
+    printf("{\"file\": ");
+    print_json_str(path);
+    printf(", \"operation\": \"%s\", "
+           "\"plain_len\": %" PRIu64 ", \"encoded_len\": %" PRIu64 ", "
+           "\"ratio\": %.4f, \"wall_ms\": %.3f, \"cpu_ms\": %.3f, "
+           "\"mbs\": %.2f, \"segments\": %" PRIu64 ", ",
+           operation_mode == COMPRESS ? "compress" : "decompress",
+           plain_len, encoded_len,
+           encoded_len ? 1.0 * plain_len / encoded_len : 0.0,
+           wall_sec * 1e3, cpu_sec * 1e3,
+           wall_sec > 0 ? plain_len / wall_sec / 1e6 : 0.0, segments);
+
+    /*
+     * Level and plain segments are only known while compressing, the latter
+     * from statistics of each call
+     */
+#ifdef SALZ_STATS
+    if (operation_mode == COMPRESS)
+        printf("\"plain_segments\": %" PRIu64 ", ", plain_segments);
+    else
+        printf("\"plain_segments\": null, ");
+#else
+    unused(plain_segments);
+    printf("\"plain_segments\": null, ");
+#endif
+
+    if (operation_mode == COMPRESS)
+        printf("\"level\": %d, \"block_len\": %zu, ", compression_level,
+               get_block_len());
+    else
+        printf("\"level\": null, \"block_len\": null, ");
+
+    printf("\"peak_rss\": %" PRIu64 ", \"threads\": %zu}\n",
+           (uint64_t)ru_end->ru_maxrss * 1024, threads_used);
+    fflush(stdout);
+}
+
 static int process_path(const char *path)
 {
     FILE *instream;
@@ -278,13 +1989,21 @@ static int process_path(const char *path)
     char outpath[PATH_MAX];
     bool has_suffix;
     uint64_t ns_begin = 0;
+    struct salz_counters counters_begin;
+    struct salz_counters counters_end;
+    uint64_t encoded_begin;
+    uint64_t decoded_begin;
+    uint64_t plain_begin;
+    struct rusage ru_begin;
+    struct rusage ru_end;
     uint64_t ns_end = 0;
     int rc;
 
     struct stat st;
 
     has_suffix = strstr(path, suffix) != NULL;
-    if (has_suffix && operation_mode == COMPRESS) {
+    if (has_suffix &&
+        (operation_mode == COMPRESS || operation_mode == EXPLAIN)) {
         log_err("\"%s\" path already has \".salz\" suffix", path);
         return ERROR;
     }
@@ -311,7 +2030,7 @@ static int process_path(const char *path)
         return ERROR;
     }
 
-    if (operation_mode == PRINT_INFO) {
+    if (operation_mode == PRINT_INFO || operation_mode == EXPLAIN) {
         outstream = NULL;
     } else {
         fill_outpath(path, outpath);
@@ -320,7 +2039,8 @@ static int process_path(const char *path)
             fclose(instream);
             return ERROR;
         }
-        outstream = fopen(outpath, "w");
+        /* Mapping output for writing requires it to be readable, too */
+        outstream = fopen(outpath, "w+");
         if (outstream == NULL) {
             log_err("Couldn't open \"%s\" path (err: %d)", outpath, errno);
             fclose(instream);
@@ -328,6 +2048,12 @@ static int process_path(const char *path)
         }
     }
 
+    threads_used = 1;
+    encoded_begin = __atomic_load_n(&segments_encoded, __ATOMIC_RELAXED);
+    decoded_begin = __atomic_load_n(&segments_decoded, __ATOMIC_RELAXED);
+    plain_begin = __atomic_load_n(&segments_plain, __ATOMIC_RELAXED);
+    salz_counters_get(&counters_begin);
+    getrusage(RUSAGE_SELF, &ru_begin);
     get_time_ns(&ns_begin);
     if (operation_mode == COMPRESS) {
         rc = compress(instream, outstream);
@@ -337,16 +2063,31 @@ static int process_path(const char *path)
         /* @todo: support this */
         log_err("Operation not supported");
         rc = ERROR;
+#ifdef SALZ_STATS
+    } else if (operation_mode == EXPLAIN) {
+        rc = explain(instream, path);
+#endif
     } else {
         log_crit("Unknown operation mode");
         abort();
     }
     get_time_ns(&ns_end);
+    getrusage(RUSAGE_SELF, &ru_end);
+    salz_counters_get(&counters_end);
 
     if (outstream != NULL)
         fclose(outstream);
     fclose(instream);
 
+    /* Explaining compression leaves files as they are */
+    if (operation_mode == EXPLAIN) {
+        if (rc != 0) {
+            log_err("Operation failed");
+            return ERROR;
+        }
+        return OK;
+    }
+
     if (rc != 0) {
         log_err("Operation failed");
         unlink(outpath);
@@ -360,10 +2101,31 @@ static int process_path(const char *path)
     }
     outsize = st.st_size;
 
-    if (operation_mode == COMPRESS)
+    if (use_stats_json && operation_mode == COMPRESS)
+        print_stats_json(path, insize, outsize, ns_end - ns_begin, &ru_begin,
+                         &ru_end, __atomic_load_n(&segments_encoded,
+                                                  __ATOMIC_RELAXED) -
+                         encoded_begin, __atomic_load_n(&segments_plain,
+                                                        __ATOMIC_RELAXED) -
+                         plain_begin);
+    else if (use_stats_json && operation_mode == DECOMPRESS)
+        print_stats_json(path, outsize, insize, ns_end - ns_begin, &ru_begin,
+                         &ru_end, __atomic_load_n(&segments_decoded,
+                                                  __ATOMIC_RELAXED) -
+                         decoded_begin, 0);
+
+    if (operation_mode == COMPRESS) {
         log_info("%s: compressed %ld bytes to %ld bytes (ratio: %.3f) in %.3f seconds",
                  path, insize, outsize, 1.0 * insize / outsize,
                  (ns_end - ns_begin) * 1.0 / NS_IN_SEC);
+
+        log_info("%s: stored %" PRIu64 " of %" PRIu64 " segments plain "
+                 "(%" PRIu64 " detected before encoding)", path,
+                 counters_end.plain_early + counters_end.plain_late -
+                 counters_begin.plain_early - counters_begin.plain_late,
+                 counters_end.segments - counters_begin.segments,
+                 counters_end.plain_early - counters_begin.plain_early);
+    }
     else if (operation_mode == DECOMPRESS)
         log_info("%s: decompressed %ld bytes in %.3f seconds",
                  path, insize, (ns_end - ns_begin) * 1.0 / NS_IN_SEC);
@@ -374,7 +2136,7 @@ static int process_path(const char *path)
 int main(int argc, char *argv[])
 {
     const char *execname = get_filename(argv[0]);
-    const char *short_opt = "cdfhklq0123456789";
+    const char *short_opt = "cdfhklqT:0123456789";
     const struct option long_opt[] = {
         { "stdout", no_argument, NULL, 'c' },
         { "decompress", no_argument, NULL, 'd' },
@@ -383,10 +2145,24 @@ int main(int argc, char *argv[])
         { "keep", no_argument, NULL, 'k' },
         { "list", no_argument, NULL, 'l' },
         { "quiet", no_argument, NULL, 'q' },
+        { "threads", required_argument, NULL, 'T' },
         { "fast", no_argument, NULL, '1' },
         { "best", no_argument, NULL, '9' },
+        { "no-mmap", no_argument, NULL, OPT_NO_MMAP },
+        { "io-uring", no_argument, NULL, OPT_IO_URING },
+        { "direct", no_argument, NULL, OPT_DIRECT },
+        { "lookback", no_argument, NULL, OPT_LOOKBACK },
+        { "plain-entropy", required_argument, NULL, OPT_PLAIN_ENTROPY },
+        { "adaptive", no_argument, NULL, OPT_ADAPTIVE },
+        { "seek-table", no_argument, NULL, OPT_SEEK_TABLE },
+        { "restart", required_argument, NULL, OPT_RESTART },
+        { "explain", no_argument, NULL, OPT_EXPLAIN },
+        { "stats-json", no_argument, NULL, OPT_STATS_JSON },
+        { "memory-limit", required_argument, NULL, OPT_MEMORY_LIMIT },
+        { "block-size", required_argument, NULL, OPT_BLOCK_SIZE },
         { NULL, 0, NULL, 0 },
     };
+    uint64_t size;
     int ret = 0;
 
     for ( ;; ) {
@@ -421,10 +2197,36 @@ int main(int argc, char *argv[])
                 printf("  -l --list          print information about salz-compressed file\n");
                 printf("  -q --quiet         suppress output\n");
                 printf("                     (specify twice to all but non-critical errors)\n");
-                printf("  -0 ... -9          compression level [default: 5]\n");
+                printf("  -T --threads=N     number of worker threads of io_uring backend\n");
+                printf("                     [default: 0, one per online CPU]\n");
+                printf("  -0 ... -9          compression level, which sets effort of matching and\n");
+                printf("                     parsing, and blocks of 2^(15 + level) bytes unless\n");
+                printf("                     --block-size is given [default: 5]\n");
                 printf("                     (note that memory usage grows exponentially)\n");
+                printf("  --block-size=N     compress blocks of N KiB (or N with suffix K, M or G)\n");
+                printf("                     each, up to %u MiB\n", SALZ_SEGMENT_LEN_MAX >> 20);
+                printf("  --memory-limit=N   compress within about N MiB (or N with suffix K, M\n");
+                printf("                     or G) by lowering threads and then block size\n");
                 printf("  --fast             alias of \"-1\"\n");
                 printf("  --best             alias of \"-9\"\n");
+                printf("  --adaptive         split off incompressible parts of blocks into segments\n");
+                printf("                     of their own, which are stored plain\n");
+                printf("  --lookback         let segments refer to preceding segment\n");
+                printf("                     (better ratio, but segments depend on each other)\n");
+                printf("  --no-mmap          read input with read() instead of mapping it\n");
+                printf("  --seek-table       append a table of segments for random access\n");
+                printf("  --restart=N        let decoding begin every N KiB within segments\n");
+                printf("                     (finer random access, but worse ratio)\n");
+                printf("  --plain-entropy=N  store segments with entropy of at least N millibits\n");
+                printf("                     per byte and little repetition plain without\n");
+                printf("                     encoding them, 0 disables [default: %u]\n",
+                       SALZ_PLAIN_ENTROPY_MIN_DEFAULT);
+                printf("  --io-uring         use io_uring for I/O and process segments in parallel\n");
+                printf("  --direct           bypass page cache on reads of io_uring backend\n");
+                printf("  --explain          compress without writing output and print how\n");
+                printf("                     segments were encoded\n");
+                printf("  --stats-json       print sizes, times, segments, peak RSS and threads\n");
+                printf("                     of each file as a line of JSON to standard output\n");
                 printf("\n");
                 printf("  Default action is to compress.\n");
                 printf("  If invoked as \"unsalz\", default action is to decompress.\n");
@@ -461,6 +2263,90 @@ int main(int argc, char *argv[])
                 compression_level = opt - '0';
                 break;
 
+            case 'T':
+                threads = atoi(optarg);
+                if (threads < 0) {
+                    fprintf(stderr, "invalid number of threads: %s\n", optarg);
+                    return ERROR;
+                }
+                break;
+
+            case OPT_NO_MMAP:
+                use_mmap = false;
+                break;
+
+            case OPT_IO_URING:
+#ifdef SALZ_IO_URING
+                use_uring = true;
+                break;
+#else
+                fprintf(stderr, "io_uring backend not available in this build\n");
+                return ERROR;
+#endif
+
+            case OPT_DIRECT:
+                use_direct_io = true;
+                break;
+
+            case OPT_LOOKBACK:
+                use_lookback = true;
+                break;
+
+            case OPT_ADAPTIVE:
+                use_adaptive = true;
+                break;
+
+            case OPT_SEEK_TABLE:
+                use_seek_table = true;
+                break;
+
+            case OPT_RESTART:
+                if (atoi(optarg) < (int)(SALZ_RESTART_LEN_MIN >> 10) ||
+                    atoi(optarg) > (int)(SALZ_SEGMENT_LEN_MAX >> 10)) {
+                    fprintf(stderr, "invalid distance between restart points: %s\n",
+                            optarg);
+                    return ERROR;
+                }
+                encode_opts.restart_len = atoi(optarg) << 10;
+                break;
+
+            case OPT_EXPLAIN:
+#ifdef SALZ_STATS
+                operation_mode = EXPLAIN;
+                break;
+#else
+                fprintf(stderr, "explaining compression not available in this build\n");
+                return ERROR;
+#endif
+
+            case OPT_MEMORY_LIMIT:
+                if (parse_size(optarg, 20, &memory_limit) != OK) {
+                    fprintf(stderr, "invalid memory limit: %s\n", optarg);
+                    return ERROR;
+                }
+                break;
+
+            case OPT_BLOCK_SIZE:
+                if (parse_size(optarg, 10, &size) != OK ||
+                    size > SALZ_SEGMENT_LEN_MAX) {
+                    fprintf(stderr, "invalid block size: %s\n", optarg);
+                    return ERROR;
+                }
+                block_len = size;
+                break;
+
+            case OPT_STATS_JSON:
+                use_stats_json = true;
+                break;
+
+            case OPT_PLAIN_ENTROPY:
+                if (atoi(optarg) < 0) {
+                    fprintf(stderr, "invalid entropy threshold: %s\n", optarg);
+                    return ERROR;
+                }
+                encode_opts.plain_entropy_min = atoi(optarg);
+                break;
+
             case '?':
             default:
                 fprintf(stderr, "See \"%s --help\" for more information.\n", execname);
@@ -468,6 +2354,12 @@ int main(int argc, char *argv[])
         }
     }
 
+    /* Split segments have no history to refer to */
+    if (use_adaptive && use_lookback) {
+        fprintf(stderr, "--adaptive and --lookback are mutually exclusive\n");
+        return ERROR;
+    }
+
     if (strncmp(execname, unsalz, strlen(unsalz)) == 0) {
         operation_mode = DECOMPRESS;
     }
@@ -478,6 +2370,14 @@ int main(int argc, char *argv[])
         return ERROR;
     }
 
+    /* Level 0 differs from level 1 only by its blocks */
+    encode_opts.effort = max(compression_level, (int)SALZ_EFFORT_MIN);
+
+    if (memory_limit &&
+        (operation_mode == COMPRESS || operation_mode == EXPLAIN) &&
+        fit_memory_limit() != OK)
+        return ERROR;
+
     argv += optind;
     argc -= optind;
 
@@ -0,0 +1,528 @@
+/*
+ * salzgen.c - Deterministic generator of benchmark corpus
+ *
+ * Copyright (c) 2021-2023 Aki Utoslahti. All rights reserved.
+ *
+ * This work is distributed under terms of the MIT license.
+ * See file LICENSE or a copy at <https://opensource.org/licenses/MIT>.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+
+#include "common.h"
+
+#define OK     (0)
+#define ERROR (-1)
+
+#define SIZE_DEFAULT (8u << 20)
+#define SEED_DEFAULT (1)
+
+enum long_only_opt {
+    OPT_SEED = 256,
+};
+
+/* Generator of a single file */
+struct gen {
+    /* Output buffer */
+    uint8_t *buf;
+    /* Length of output */
+    size_t len;
+    /* Current position in output */
+    size_t pos;
+    /* State of pseudorandom number generator */
+    uint64_t rng;
+};
+
+/*************************************
+ * Helpers
+ *************************************/
+
+static uint64_t rnd(struct gen *gen)
+{
+    /* SplitMix64, so that output only depends on seed */
+    uint64_t z = (gen->rng += 0x9e3779b97f4a7c15u);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+
+    return z ^ (z >> 31);
+}
+
+static uint64_t rnd_below(struct gen *gen, uint64_t n)
+{
+    return n ? rnd(gen) % n : 0;
+}
+
+static uint64_t rnd_skewed(struct gen *gen, uint64_t n)
+{
+    /* Small values are much more likely, as in most real distributions */
+    return rnd_below(gen, 1 + rnd_below(gen, n));
+}
+
+static const char *pick(struct gen *gen, const char *const *strs, size_t cnt)
+{
+    return strs[rnd_skewed(gen, cnt)];
+}
+
+static bool full(struct gen *gen)
+{
+    return gen->pos >= gen->len;
+}
+
+static void put(struct gen *gen, const void *data, size_t len)
+{
+    /* Output is cut at exactly the requested length */
+    len = min(len, gen->len - gen->pos);
+    memcpy(gen->buf + gen->pos, data, len);
+    gen->pos += len;
+}
+
+static void put_fmt(struct gen *gen, const char *fmt, ...)
+{
+    char line[1024];
+    va_list args;
+    int len;
+
+    va_start(args, fmt);
+    len = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+
+    if (len > 0)
+        put(gen, line, min((size_t)len, sizeof(line) - 1));
+}
+
+/*************************************
+ * Generators
+ *************************************/
+
+static const char *const log_levels[] = {
+    "INFO", "DEBUG", "WARN", "ERROR", "TRACE",
+};
+
+static const char *const log_components[] = {
+    "http", "db", "cache", "auth", "scheduler", "worker", "storage", "gc",
+};
+
+static const char *const log_paths[] = {
+    "/api/v1/items", "/api/v1/users", "/api/v1/orders", "/health",
+    "/api/v2/search", "/static/app.js", "/api/v1/items/batch", "/login",
+};
+
+static const char *const log_messages[] = {
+    "request completed", "cache miss", "connection reset by peer",
+    "retrying after timeout", "slow query", "session expired",
+};
+
+static void gen_log(struct gen *gen)
+{
+    /* Timestamped lines of a service, which mostly differ in their numbers */
+
+    uint64_t ms = 1678795200000u + rnd_below(gen, 86400000);
+
+    while (!full(gen)) {
+        uint64_t secs = ms / 1000;
+
+        ms += rnd_skewed(gen, 250);
+
+        put_fmt(gen, "2023-03-%02" PRIu64 "T%02" PRIu64 ":%02" PRIu64 ":%02"
+                PRIu64 ".%03" PRIu64 "Z %-5s [%s-%" PRIu64 "] ",
+                14 + secs / 86400 % 14, secs / 3600 % 24, secs / 60 % 60,
+                secs % 60, ms % 1000, pick(gen, log_levels, 5),
+                pick(gen, log_components, 8), rnd_skewed(gen, 16));
+
+        if (rnd_below(gen, 4)) {
+            put_fmt(gen, "%s %s/%" PRIu64 " status=%d latency_ms=%" PRIu64
+                    " id=%016" PRIx64 "\n",
+                    rnd_below(gen, 5) ? "GET" : "POST",
+                    pick(gen, log_paths, 8), rnd_skewed(gen, 100000),
+                    rnd_below(gen, 20) ? 200 : 404 + (int)rnd_below(gen, 100),
+                    rnd_skewed(gen, 2000), rnd(gen));
+        } else {
+            put_fmt(gen, "%s (attempt %" PRIu64 ")\n",
+                    pick(gen, log_messages, 6), 1 + rnd_skewed(gen, 5));
+        }
+    }
+}
+
+static const char *const json_names[] = {
+    "alice", "bob", "carol", "dave", "erin", "frank", "grace", "heidi",
+    "ivan", "judy", "mallory", "niaj", "olivia", "peggy", "rupert", "sybil",
+};
+
+static const char *const json_tags[] = {
+    "new", "sale", "featured", "clearance", "limited", "bundle", "gift",
+};
+
+static void gen_json(struct gen *gen)
+{
+    /* Newline delimited records sharing keys, with values of varying kind */
+
+    uint64_t id = rnd_below(gen, 1000000);
+
+    while (!full(gen)) {
+        const char *name = pick(gen, json_names, 16);
+        uint64_t tags_cnt = rnd_skewed(gen, 4);
+
+        id += 1 + rnd_skewed(gen, 10);
+
+        put_fmt(gen, "{\"id\":%" PRIu64 ",\"user\":\"%s%" PRIu64 "\","
+                "\"email\":\"%s@example.com\",\"active\":%s,"
+                "\"score\":%" PRIu64 ".%02" PRIu64 ",\"tags\":[",
+                id, name, rnd_skewed(gen, 1000), name,
+                rnd_below(gen, 3) ? "true" : "false", rnd_skewed(gen, 1000),
+                rnd_below(gen, 100));
+
+        for (uint64_t i = 0; i < tags_cnt; i++)
+            put_fmt(gen, "%s\"%s\"", i ? "," : "", pick(gen, json_tags, 7));
+
+        put_fmt(gen, "],\"created\":\"2023-%02" PRIu64 "-%02" PRIu64
+                "T%02" PRIu64 ":%02" PRIu64 ":00Z\"}\n",
+                1 + rnd_below(gen, 12), 1 + rnd_below(gen, 28),
+                rnd_below(gen, 24), rnd_below(gen, 60));
+    }
+}
+
+#define COLUMNAR_ROWS (4096)
+
+static void gen_columnar(struct gen *gen)
+{
+    /*
+     * Chunks of rows stored column by column: sorted identifiers,
+     * increasing timestamps, a random walk of floats, a low-cardinality
+     * category and noisy small integers.
+     */
+
+    uint32_t id = (uint32_t)rnd_below(gen, 1u << 20);
+    uint64_t ts = 1678795200000000u;
+    float walk = 100.0f;
+
+    while (!full(gen)) {
+        uint32_t ids[COLUMNAR_ROWS];
+        uint64_t tss[COLUMNAR_ROWS];
+        float vals[COLUMNAR_ROWS];
+        uint8_t cats[COLUMNAR_ROWS];
+        int16_t nums[COLUMNAR_ROWS];
+
+        for (size_t i = 0; i < COLUMNAR_ROWS; i++) {
+            id += 1 + (uint32_t)rnd_skewed(gen, 4);
+            ts += 1000 + rnd_skewed(gen, 50000);
+            walk += ((float)rnd_below(gen, 2001) - 1000.0f) / 1000.0f;
+
+            ids[i] = id;
+            tss[i] = ts;
+            vals[i] = walk;
+            cats[i] = (uint8_t)rnd_skewed(gen, 12);
+            nums[i] = (int16_t)(rnd_skewed(gen, 512) - 64);
+        }
+
+        put(gen, ids, sizeof(ids));
+        put(gen, tss, sizeof(tss));
+        put(gen, vals, sizeof(vals));
+        put(gen, cats, sizeof(cats));
+        put(gen, nums, sizeof(nums));
+    }
+}
+
+static void gen_repetitive(struct gen *gen)
+{
+    /*
+     * Runs of a single byte and of short periods yield factors with tiny
+     * offsets, and long copies of earlier output with sparse mutations
+     * yield long matches, which stress LCP comparisons.
+     */
+
+    uint8_t seed[256];
+
+    for (size_t i = 0; i < sizeof(seed); i++)
+        seed[i] = (uint8_t)rnd(gen);
+    put(gen, seed, sizeof(seed));
+
+    while (!full(gen)) {
+        size_t len = 16 + rnd_below(gen, 4096);
+        uint64_t kind = rnd_below(gen, 8);
+
+        len = min(len, gen->len - gen->pos);
+
+        if (kind < 2) {
+            /* Run of a single byte */
+            memset(gen->buf + gen->pos, (int)rnd(gen), len);
+        } else if (kind < 4) {
+            /* Short period */
+            size_t period = 2 + rnd_below(gen, 7);
+
+            for (size_t i = 0; i < len; i++) {
+                gen->buf[gen->pos + i] = i < period ? (uint8_t)rnd(gen) :
+                                         gen->buf[gen->pos + i - period];
+            }
+        } else {
+            /* Long copy of earlier output with sparse mutations */
+            size_t from = rnd_below(gen, gen->pos);
+
+            len = min(len * 16, gen->len - gen->pos);
+            for (size_t i = 0; i < len; i++) {
+                gen->buf[gen->pos + i] = rnd_below(gen, 4096) ?
+                                         gen->buf[from + i] : (uint8_t)rnd(gen);
+            }
+        }
+
+        gen->pos += len;
+    }
+}
+
+static void gen_random(struct gen *gen)
+{
+    /* Incompressible, so that everything is a literal */
+
+    while (!full(gen)) {
+        uint64_t val = rnd(gen);
+
+        put(gen, &val, sizeof(val));
+    }
+}
+
+static void gen_mixed(struct gen *gen);
+
+/* Kinds of generated data */
+static const struct kind {
+    const char *name;
+    const char *desc;
+    void (*gen)(struct gen *gen);
+} kinds[] = {
+    { "log", "log-like text lines", gen_log },
+    { "json", "newline delimited JSON records", gen_json },
+    { "columnar", "columnar binary of typed rows", gen_columnar },
+    { "repetitive", "byte runs, short periods and long near-copies",
+      gen_repetitive },
+    { "random", "incompressible random bytes", gen_random },
+    { "mixed", "chunks of all of the above", gen_mixed },
+};
+
+#define KINDS_CNT (sizeof(kinds) / sizeof(kinds[0]))
+
+static void gen_mixed(struct gen *gen)
+{
+    /* Chunks of other kinds one after another, as in archives and images */
+
+    while (!full(gen)) {
+        size_t len = (64u << 10) + rnd_below(gen, 192u << 10);
+        struct gen sub = {
+            .buf = gen->buf + gen->pos,
+            .len = min(len, gen->len - gen->pos),
+            .pos = 0,
+            .rng = rnd(gen),
+        };
+
+        kinds[rnd_below(gen, KINDS_CNT - 1)].gen(&sub);
+        gen->pos += sub.len;
+    }
+}
+
+/*************************************
+ * Command line
+ *************************************/
+
+static int generate(const struct kind *kind, size_t len, uint64_t seed,
+    FILE *f)
+{
+    struct gen gen = {
+        .buf = malloc(max(len, 1)),
+        .len = len,
+        .pos = 0,
+        /* Each kind has a stream of its own, regardless of others */
+        .rng = seed ^ ((uint64_t)(kind - kinds) << 56),
+    };
+    int ret = OK;
+
+    if (gen.buf == NULL) {
+        fprintf(stderr, "couldn't allocate memory (%zu bytes)\n", len);
+        return ERROR;
+    }
+
+    kind->gen(&gen);
+
+    if (fwrite(gen.buf, 1, len, f) != len) {
+        fprintf(stderr, "couldn't write %s: %s\n", kind->name,
+                strerror(errno));
+        ret = ERROR;
+    }
+
+    free(gen.buf);
+
+    return ret;
+}
+
+static int parse_size(const char *arg, size_t *res)
+{
+    char *end;
+    unsigned long long val = strtoull(arg, &end, 10);
+    unsigned shift = 0;
+
+    if (end == arg)
+        return ERROR;
+
+    switch (*end) {
+        case 'k': case 'K': shift = 10; end++; break;
+        case 'm': case 'M': shift = 20; end++; break;
+        case 'g': case 'G': shift = 30; end++; break;
+        default: break;
+    }
+
+    if (*end != '\0' || val == 0 || val > (SIZE_MAX >> shift))
+        return ERROR;
+
+    *res = (size_t)val << shift;
+
+    return OK;
+}
+
+static void print_help(const char *execname)
+{
+    printf("salzgen, deterministic generator of benchmark corpus\n");
+    printf("\n");
+    printf("  usage: %s [options] [kind ...]\n", execname);
+    printf("\n");
+    printf("  -h --help             print this message\n");
+    printf("  -s --size=N           size of each file, optionally suffixed with\n");
+    printf("                        K, M or G [default: %uM]\n", SIZE_DEFAULT >> 20);
+    printf("  -o --output=DIR       directory to write files named after kinds to\n");
+    printf("                        [default: .]\n");
+    printf("  -c --stdout           write a single kind to stdout\n");
+    printf("  --seed=N              seed of generated data [default: %d]\n",
+           SEED_DEFAULT);
+    printf("\n");
+    printf("  Kinds (all, if none given):\n");
+    for (size_t i = 0; i < KINDS_CNT; i++)
+        printf("    %-12s %s\n", kinds[i].name, kinds[i].desc);
+    printf("\n");
+    printf("  Same size and seed give the same files on every machine.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *short_opt = "hs:o:c";
+    const struct option long_opt[] = {
+        { "help", no_argument, NULL, 'h' },
+        { "size", required_argument, NULL, 's' },
+        { "output", required_argument, NULL, 'o' },
+        { "stdout", no_argument, NULL, 'c' },
+        { "seed", required_argument, NULL, OPT_SEED },
+        { NULL, 0, NULL, 0 },
+    };
+    size_t len = SIZE_DEFAULT;
+    uint64_t seed = SEED_DEFAULT;
+    const char *dir = ".";
+    bool to_stdout = false;
+    bool selected[KINDS_CNT] = { false };
+    size_t selected_cnt = 0;
+
+    for ( ;; ) {
+        int opt = getopt_long(argc, argv, short_opt, long_opt, NULL);
+        if (opt == -1)
+            break;
+
+        switch (opt) {
+            case 'h':
+                print_help(argv[0]);
+                return OK;
+
+            case 's':
+                if (parse_size(optarg, &len) != OK) {
+                    fprintf(stderr, "invalid size: %s\n", optarg);
+                    return ERROR;
+                }
+                break;
+
+            case 'o':
+                dir = optarg;
+                break;
+
+            case 'c':
+                to_stdout = true;
+                break;
+
+            case OPT_SEED:
+                seed = strtoull(optarg, NULL, 0);
+                break;
+
+            case '?':
+            default:
+                fprintf(stderr, "See \"%s --help\" for more information.\n",
+                        argv[0]);
+                return ERROR;
+        }
+    }
+
+    for (int i = optind; i < argc; i++) {
+        size_t k;
+
+        for (k = 0; k < KINDS_CNT; k++) {
+            if (strcmp(argv[i], kinds[k].name) == 0)
+                break;
+        }
+
+        if (k == KINDS_CNT) {
+            fprintf(stderr, "unknown kind: %s\n", argv[i]);
+            return ERROR;
+        }
+
+        selected_cnt += !selected[k];
+        selected[k] = true;
+    }
+
+    if (selected_cnt == 0) {
+        for (size_t k = 0; k < KINDS_CNT; k++)
+            selected[k] = true;
+        selected_cnt = KINDS_CNT;
+    }
+
+    if (to_stdout) {
+        if (selected_cnt != 1) {
+            fprintf(stderr, "choose a single kind to write to stdout\n");
+            return ERROR;
+        }
+
+        for (size_t k = 0; k < KINDS_CNT; k++) {
+            if (selected[k])
+                return generate(&kinds[k], len, seed, stdout);
+        }
+    }
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "couldn't create %s: %s\n", dir, strerror(errno));
+        return ERROR;
+    }
+
+    for (size_t k = 0; k < KINDS_CNT; k++) {
+        char path[4096];
+        FILE *f;
+        int ret;
+
+        if (!selected[k])
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", dir, kinds[k].name);
+        if ((f = fopen(path, "wb")) == NULL) {
+            fprintf(stderr, "couldn't open %s: %s\n", path, strerror(errno));
+            return ERROR;
+        }
+
+        ret = generate(&kinds[k], len, seed, f);
+        if (fclose(f) != 0)
+            ret = ERROR;
+        if (ret != OK)
+            return ERROR;
+
+        printf("%s: %zu bytes\n", path, len);
+    }
+
+    return OK;
+}
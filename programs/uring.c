@@ -0,0 +1,173 @@
+/*
+ * uring.c - Minimal io_uring interface on top of raw system calls
+ *
+ * Copyright (c) 2021-2023 Aki Utoslahti. All rights reserved.
+ *
+ * This work is distributed under terms of the MIT license.
+ * See file LICENSE or a copy at <https://opensource.org/licenses/MIT>.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit,
+    unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                        flags, NULL, 0);
+}
+
+int uring_init(struct uring *ring, unsigned entries)
+{
+    struct io_uring_params p;
+    uint8_t *sq_ptr;
+    uint8_t *cq_ptr;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+
+    ring->fd = sys_io_uring_setup(entries, &p);
+    if (ring->fd < 0)
+        return -1;
+
+    ring->sq_ptr_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_ptr_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    /* Both rings may live in a single mapping */
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ptr_len > ring->sq_ptr_len)
+            ring->sq_ptr_len = ring->cq_ptr_len;
+        ring->cq_ptr_len = ring->sq_ptr_len;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_ptr_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED)
+        goto fail;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_ptr_len, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->fd,
+                            IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            ring->cq_ptr = NULL;
+            goto fail;
+        }
+    }
+
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto fail;
+    }
+
+    sq_ptr = ring->sq_ptr;
+    ring->sq_head = (unsigned *)(sq_ptr + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq_ptr + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq_ptr + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq_ptr + p.sq_off.array);
+
+    cq_ptr = ring->cq_ptr;
+    ring->cq_head = (unsigned *)(cq_ptr + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq_ptr + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq_ptr + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq_ptr + p.cq_off.cqes);
+
+    return 0;
+
+fail:
+    uring_exit(ring);
+    return -1;
+}
+
+void uring_exit(struct uring *ring)
+{
+    int saved_errno = errno;
+
+    if (ring->sqes != NULL)
+        munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_ptr != NULL && ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_ptr_len);
+    if (ring->sq_ptr != NULL && ring->sq_ptr != MAP_FAILED)
+        munmap(ring->sq_ptr, ring->sq_ptr_len);
+    if (ring->fd >= 0)
+        close(ring->fd);
+
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+
+    errno = saved_errno;
+}
+
+bool uring_prep_rw(struct uring *ring, uint8_t op, int fd, void *buf,
+    size_t len, uint64_t off, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe;
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring->sq_tail + ring->sq_pending;
+    unsigned idx;
+
+    if (tail - head > *ring->sq_mask)
+        return false;
+
+    idx = tail & *ring->sq_mask;
+    sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->user_data = user_data;
+
+    ring->sq_array[idx] = idx;
+    ring->sq_pending++;
+
+    return true;
+}
+
+int uring_submit_and_wait(struct uring *ring, unsigned wait_nr)
+{
+    unsigned to_submit = ring->sq_pending;
+    int rc;
+
+    /* Publish prepared entries before kernel gets to see the new tail */
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + to_submit,
+                     __ATOMIC_RELEASE);
+    ring->sq_pending = 0;
+
+    do {
+        rc = sys_io_uring_enter(ring->fd, to_submit, wait_nr,
+                                wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    } while (rc < 0 && errno == EINTR);
+
+    return rc < 0 ? -1 : 0;
+}
+
+bool uring_reap(struct uring *ring, struct io_uring_cqe *cqe)
+{
+    unsigned head = *ring->cq_head;
+
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return false;
+
+    *cqe = ring->cqes[head & *ring->cq_mask];
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
@@ -0,0 +1,104 @@
+/*
+ * uring.h - Minimal io_uring interface on top of raw system calls
+ *
+ * Copyright (c) 2021-2023 Aki Utoslahti. All rights reserved.
+ *
+ * This work is distributed under terms of the MIT license.
+ * See file LICENSE or a copy at <https://opensource.org/licenses/MIT>.
+ */
+
+#ifndef SALZ_URING_H
+#define SALZ_URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <linux/io_uring.h>
+
+/* Submission and completion rings shared with the kernel */
+struct uring {
+    /* Ring file descriptor */
+    int fd;
+
+    /* Submission queue ring */
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    /* Submission queue entries prepared, but not yet submitted */
+    unsigned sq_pending;
+
+    /* Completion queue ring */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* Mappings of rings and submission queue entries */
+    void *sq_ptr;
+    size_t sq_ptr_len;
+    void *cq_ptr;
+    size_t cq_ptr_len;
+    size_t sqes_len;
+};
+
+/*
+ * Set up io_uring instance
+ *
+ * @param[out] ring     Ring to set up
+ * @param[in]  entries  Depth of submission queue
+ *
+ * @return              0, if successful
+ *                      -1, otherwise (errno is set)
+ */
+extern int uring_init(struct uring *ring, unsigned entries);
+
+/*
+ * Tear down io_uring instance
+ *
+ * @param[in]  ring  Ring to tear down
+ */
+extern void uring_exit(struct uring *ring);
+
+/*
+ * Prepare read or write to be submitted
+ *
+ * @param[in]  ring       Ring to queue submission into
+ * @param[in]  op         IORING_OP_READ or IORING_OP_WRITE
+ * @param[in]  fd         File descriptor to operate on
+ * @param[in]  buf        Buffer to read into or write from
+ * @param[in]  len        Length of @p buf (in bytes)
+ * @param[in]  off        Offset in file (in bytes)
+ * @param[in]  user_data  Value passed back in matching completion
+ *
+ * @return                true, if submission was queued
+ *                        false, if submission queue is full
+ */
+extern bool uring_prep_rw(struct uring *ring, uint8_t op, int fd, void *buf,
+    size_t len, uint64_t off, uint64_t user_data);
+
+/*
+ * Submit prepared submissions and wait for completions
+ *
+ * @param[in]  ring     Ring to submit to
+ * @param[in]  wait_nr  Number of completions to wait for
+ *
+ * @return              0, if successful
+ *                      -1, otherwise (errno is set)
+ */
+extern int uring_submit_and_wait(struct uring *ring, unsigned wait_nr);
+
+/*
+ * Reap a single completion
+ *
+ * @param[in]  ring  Ring to reap from
+ * @param[out] cqe   Completion reaped
+ *
+ * @return           true, if completion was reaped
+ *                   false, if no completions are available
+ */
+extern bool uring_reap(struct uring *ring, struct io_uring_cqe *cqe);
+
+#endif /* !SALZ_URING_H */
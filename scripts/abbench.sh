@@ -0,0 +1,347 @@
+#!/bin/bash
+#
+# abbench.sh - A/B comparison of encoding speed, decoding speed and ratio
+# of two revisions with in-memory benchmark (salzbench)
+#
+# Revisions are built side by side in git worktrees, and their benchmark
+# runs are interleaved on a pinned CPU, alternating which one goes first, so
+# that drift of the machine hits both alike. Nothing needs root.
+#
+set -e
+
+script=$0
+
+levels=5
+reps=10
+iterations=3
+cpu=
+speed_threshold=5
+ratio_threshold=0.5
+bench_args=
+keep=0
+
+usage()
+{
+    echo "Usage: $(basename $script) [options] [base revision] [test revision] [bench file(s)]"
+    echo
+    echo "  Revision is a commit hash, branch name or '.' for the working tree."
+    echo
+    echo "  -l LIST   compression levels, e.g. \"1,5-9\" [default: $levels]"
+    echo "  -n N      interleaved repetitions of each revision [default: $reps]"
+    echo "  -i N      iterations within each repetition [default: $iterations]"
+    echo "  -c CPU    CPU to pin benchmark to [default: last online CPU]"
+    echo "  -t PCT    speed regression threshold (in %) [default: $speed_threshold]"
+    echo "  -r PCT    ratio regression threshold (in %) [default: $ratio_threshold]"
+    echo "  -a ARGS   further arguments for salzbench, e.g. \"--restart=64\""
+    echo "  -k        keep worktrees, builds and results in build-abbench"
+    echo "  -h        print this message"
+    echo
+    echo "  Exits with status 1, if test revision is slower or compresses worse"
+    echo "  than base revision by more than threshold, and speed difference is"
+    echo "  larger than its 95% confidence interval."
+}
+
+while getopts "l:n:i:c:t:r:a:kh" opt
+do
+    case $opt in
+        l) levels=$OPTARG ;;
+        n) reps=$OPTARG ;;
+        i) iterations=$OPTARG ;;
+        c) cpu=$OPTARG ;;
+        t) speed_threshold=$OPTARG ;;
+        r) ratio_threshold=$OPTARG ;;
+        a) bench_args=$OPTARG ;;
+        k) keep=1 ;;
+        h) usage; exit 0 ;;
+        *) usage; exit 2 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+if [ "$#" -lt 3 ]
+then
+    usage
+    exit 2
+fi
+
+if [ "$reps" -lt 2 ]
+then
+    echo "At least 2 repetitions are needed for confidence intervals"
+    exit 2
+fi
+
+rev_a=$1
+rev_b=$2
+shift 2
+
+files=()
+for file in "$@"
+do
+    files+=("$(realpath "$file")")
+done
+
+repo=$(git -C "$(dirname "$(realpath "$script")")" rev-parse --show-toplevel)
+work=$repo/build-abbench
+results=$work/results.csv
+
+cleanup()
+{
+    for side in a b
+    do
+        if [ -d "$work/$side/src" ]
+        then
+            git -C "$repo" worktree remove --force "$work/$side/src" &> /dev/null || true
+        fi
+    done
+
+    if [ "$keep" -eq 0 ]
+    then
+        rm -rf "$work"
+    fi
+}
+
+checkout()
+{
+    local rev=$1
+    local src=$2
+
+    git -C "$repo" worktree add --detach --force "$src" "$rev" &> /dev/null
+
+    # Submodules come from their remotes, or failing that from working tree
+    git -C "$src" submodule update --init --recursive &> /dev/null || true
+
+    for path in $(git -C "$src" config -f .gitmodules --get-regexp path | cut -d' ' -f2)
+    do
+        if [ -n "$(ls -A "$src/$path" 2> /dev/null)" ]
+        then
+            continue
+        fi
+
+        if [ -z "$(ls -A "$repo/$path" 2> /dev/null)" ]
+        then
+            echo "Couldn't check out submodule $path"
+            return 1
+        fi
+
+        echo "    submodule $path taken from working tree"
+        mkdir -p "$src/$path"
+        cp -a "$repo/$path/." "$src/$path/"
+    done
+}
+
+build()
+{
+    local side=$1
+    local rev=$2
+    local src=$work/$side/src
+    local bin=$work/$side/build
+
+    if [ "$rev" = "." ]
+    then
+        src=$repo
+    else
+        checkout "$rev" "$src"
+    fi
+
+    if ! { cmake -S "$src" -B "$bin" -DCMAKE_BUILD_TYPE=Release &&
+           cmake --build "$bin" --target salzbench -j"$(nproc)"; } &> "$work/$side/build.log"
+    then
+        echo "Couldn't build '$rev', see $work/$side/build.log"
+        keep=1
+        return 1
+    fi
+
+    if [ ! -x "$bin/programs/salzbench" ]
+    then
+        echo "Revision '$rev' has no salzbench"
+        return 1
+    fi
+}
+
+run()
+{
+    local side=$1
+    local rep=$2
+
+    $pin "$work/$side/build/programs/salzbench" -f csv -i "$iterations" \
+        -l "$levels" $bench_args "${files[@]}" > "$work/run.csv"
+
+    if [ ! -s "$results" ]
+    then
+        echo "side,rep,$(head -n 1 "$work/run.csv")" > "$results"
+    fi
+    tail -n +2 "$work/run.csv" | sed "s/^/$side,$rep,/" >> "$results"
+}
+
+trap cleanup EXIT
+
+rm -rf "$work"
+mkdir -p "$work/a" "$work/b"
+
+if [ -z "$cpu" ]
+then
+    cpu=$(($(nproc) - 1))
+fi
+
+pin=
+if command -v taskset &> /dev/null
+then
+    pin="taskset -c $cpu"
+else
+    echo "taskset not found, benchmark runs unpinned"
+fi
+
+governor=/sys/devices/system/cpu/cpu$cpu/cpufreq/scaling_governor
+if [ -r "$governor" ] && [ "$(cat "$governor")" != "performance" ]
+then
+    echo "CPU $cpu uses '$(cat "$governor")' governor, expect more variance"
+fi
+
+echo "1. Building base revision '$rev_a'"
+build a "$rev_a"
+
+echo "2. Building test revision '$rev_b'"
+build b "$rev_b"
+
+echo "3. Running $reps interleaved repetitions on CPU $cpu"
+for ((rep = 1; rep <= reps; rep++))
+do
+    if ((rep % 2))
+    then
+        run a $rep
+        run b $rep
+    else
+        run b $rep
+        run a $rep
+    fi
+    echo -n "."
+done
+echo
+
+echo -e "4. Comparing test revision against base revision\n"
+status=0
+awk -v speed_threshold="$speed_threshold" \
+    -v ratio_threshold="$ratio_threshold" '
+function parse_csv(line, f,    i, c, quoted, field, nf)
+{
+    # Splits CSV line into f, whose fields may be quoted with quotes doubled
+    field = ""
+    quoted = 0
+    nf = 0
+    for (i = 1; i <= length(line); i++) {
+        c = substr(line, i, 1)
+        if (quoted && c == "\"" && substr(line, i + 1, 1) == "\"") {
+            field = field c
+            i++
+        } else if (c == "\"") {
+            quoted = !quoted
+        } else if (c == "," && !quoted) {
+            f[++nf] = field
+            field = ""
+        } else {
+            field = field c
+        }
+    }
+    f[++nf] = field
+    return nf
+}
+
+function t95(df)
+{
+    # Two-sided 95% critical values of Student t distribution
+    split("12.706 4.303 3.182 2.776 2.571 2.447 2.365 2.306 2.262 2.228 " \
+          "2.201 2.179 2.160 2.145 2.131 2.120 2.110 2.101 2.093 2.086 " \
+          "2.080 2.074 2.069 2.064 2.060 2.056 2.052 2.048 2.045 2.042", t, " ")
+    if (df < 1)
+        df = 1
+    return df <= 30 ? t[int(df)] : 1.960
+}
+
+function compare(key, metric,    na, nb, ma, mb, va, vb, se, df, ci, delta, verdict)
+{
+    na = n[key, "a"]
+    nb = n[key, "b"]
+    ma = sum[key, metric, "a"] / na
+    mb = sum[key, metric, "b"] / nb
+    va = (sumsq[key, metric, "a"] - na * ma * ma) / (na - 1)
+    vb = (sumsq[key, metric, "b"] - nb * mb * mb) / (nb - 1)
+    va = va > 0 ? va : 0
+    vb = vb > 0 ? vb : 0
+
+    # Welch-Satterthwaite degrees of freedom of difference of means
+    se = sqrt(va / na + vb / nb)
+    df = se > 0 ? (va / na + vb / nb) ^ 2 / \
+         ((va / na) ^ 2 / (na - 1) + (vb / nb) ^ 2 / (nb - 1)) : 1000
+
+    delta = ma > 0 ? 100 * (mb - ma) / ma : 0
+    ci = ma > 0 ? 100 * t95(df) * se / ma : 0
+
+    verdict = ""
+    if (delta < -speed_threshold && -delta > ci) {
+        verdict = "REGRESSION"
+        regressions += 1
+    } else if (delta > speed_threshold && delta > ci) {
+        verdict = "improvement"
+    }
+
+    printf("%-32s %-6s %12.2f %12.2f %+9.2f%% %8.2f%%  %s\n", label[key],
+           substr(metric, 1, 6), ma, mb, delta, ci, verdict)
+}
+
+NR == 1 {
+    nf = parse_csv($0, f)
+    for (i = 1; i <= nf; i++)
+        col[f[i]] = i
+    next
+}
+
+{
+    parse_csv($0, f)
+    key = f[col["file"]] SUBSEP f[col["level"]] SUBSEP f[col["block_len"]]
+    side = f[col["side"]]
+
+    if (!(key in label)) {
+        keys[++keys_cnt] = key
+        file = f[col["file"]]
+        sub(".*/", "", file)
+        label[key] = sprintf("%s -%s %dK", file, f[col["level"]],
+                             f[col["block_len"]] / 1024)
+    }
+
+    n[key, side] += 1
+    ratio[key, side] = f[col["ratio"]]
+    for (m = 1; m <= 2; m++) {
+        metric = m == 1 ? "encode_mbs" : "decode_mbs"
+        sum[key, metric, side] += f[col[metric]]
+        sumsq[key, metric, side] += f[col[metric]] ^ 2
+    }
+}
+
+END {
+    printf("%-32s %-6s %12s %12s %10s %9s\n", "file", "metric", "base",
+           "test", "delta", "+-ci95")
+
+    for (k = 1; k <= keys_cnt; k++) {
+        key = keys[k]
+        compare(key, "encode_mbs")
+        compare(key, "decode_mbs")
+
+        ra = ratio[key, "a"]
+        rb = ratio[key, "b"]
+        delta = ra > 0 ? 100 * (rb - ra) / ra : 0
+        verdict = ""
+        if (delta < -ratio_threshold) {
+            verdict = "REGRESSION"
+            regressions += 1
+        }
+        printf("%-32s %-6s %12.4f %12.4f %+9.2f%% %9s  %s\n", label[key],
+               "ratio", ra, rb, delta, "", verdict)
+    }
+
+    printf("\nspeed in MB/s, %d regression(s) past thresholds of %s%% (speed) " \
+           "and %s%% (ratio)\n", regressions, speed_threshold, ratio_threshold)
+
+    exit regressions > 0
+}' "$results" || status=$?
+
+exit $status
@@ -0,0 +1,84 @@
+/*
+ * test.h - Helpers shared by tests
+ *
+ * Copyright (c) 2021-2023 Aki Utoslahti. All rights reserved.
+ *
+ * This work is distributed under terms of the MIT license.
+ * See file LICENSE or a copy at <https://opensource.org/licenses/MIT>.
+ */
+
+#ifndef SALZ_TEST_H
+#define SALZ_TEST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common.h"
+
+static int test_failures = 0;
+
+/* Reports failed check without stopping the test */
+#define check(cond, ...)                                                     \
+    do {                                                                     \
+        if (!(cond)) {                                                       \
+            fprintf(stderr, "%s:%d: check failed: %s: ", __FILE__, __LINE__, \
+                    #cond);                                                  \
+            fprintf(stderr, __VA_ARGS__);                                    \
+            fprintf(stderr, "\n");                                           \
+            test_failures++;                                                 \
+        }                                                                    \
+    } while (0)
+
+static inline int test_result(void)
+{
+    return test_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static inline uint32_t test_rand(uint64_t *state)
+{
+    /* xorshift64* keeps data reproducible between runs and platforms */
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+
+    return (uint32_t)((*state * 0x2545F4914F6CDD1Dull) >> 32);
+}
+
+/*
+ * Fills buffer with text-like data, which repeats words of a small
+ * vocabulary and occasionally inserts a random byte
+ */
+static inline void test_fill_text(uint8_t *buf, size_t len, uint64_t seed)
+{
+    static const char *words[] = {
+        "segment ", "suffix ", "array ", "factor ", "offset ", "length ",
+        "literal ", "history ", "restart ", "{\"id\": ", "\n",
+    };
+    uint64_t state = seed | 1;
+    size_t pos = 0;
+
+    while (pos < len) {
+        uint32_t r = test_rand(&state);
+
+        if (r % 16 == 0) {
+            buf[pos++] = (uint8_t)(r >> 8);
+            continue;
+        }
+
+        for (const char *w = words[r % (sizeof(words) / sizeof(words[0]))];
+             *w && pos < len; w++)
+            buf[pos++] = (uint8_t)*w;
+    }
+}
+
+/* Fills buffer with random bytes, which don't compress */
+static inline void test_fill_random(uint8_t *buf, size_t len, uint64_t seed)
+{
+    uint64_t state = seed | 1;
+
+    for (size_t pos = 0; pos < len; pos++)
+        buf[pos] = (uint8_t)test_rand(&state);
+}
+
+#endif /* !SALZ_TEST_H */
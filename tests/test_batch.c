@@ -0,0 +1,119 @@
+/*
+ * test_batch.c - Encoding and decoding batches of segments
+ *
+ * Copyright (c) 2021-2023 Aki Utoslahti. All rights reserved.
+ *
+ * This work is distributed under terms of the MIT license.
+ * See file LICENSE or a copy at <https://opensource.org/licenses/MIT>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "salz.h"
+#include "test.h"
+
+#define ITEMS_CNT (40)
+
+static const size_t item_lens[] = { 0, 9, 100, 1000, 5000, 70000 };
+#define ITEM_LENS_CNT (sizeof(item_lens) / sizeof(*item_lens))
+
+struct item_bufs {
+    uint8_t *plain;
+    uint8_t *enc;
+    uint8_t *dec;
+    size_t len;
+};
+
+static void batch(unsigned threads)
+{
+    struct item_bufs bufs[ITEMS_CNT];
+    struct salz_batch_item items[ITEMS_CNT];
+
+    for (size_t i = 0; i < ITEMS_CNT; i++) {
+        size_t len = item_lens[i % ITEM_LENS_CNT];
+
+        bufs[i].len = len;
+        bufs[i].plain = malloc(len + 1);
+        bufs[i].enc = malloc(salz_encoded_len_max(len));
+        bufs[i].dec = malloc(len + 1);
+        if (bufs[i].plain == NULL || bufs[i].enc == NULL ||
+            bufs[i].dec == NULL) {
+            check(false, "out of memory");
+            return;
+        }
+
+        if (i % 3 == 2)
+            test_fill_random(bufs[i].plain, len, i);
+        else
+            test_fill_text(bufs[i].plain, len, i);
+
+        items[i] = (struct salz_batch_item){
+            .src = bufs[i].plain,
+            .src_len = len,
+            .dst = bufs[i].enc,
+            .dst_len = salz_encoded_len_max(len),
+        };
+    }
+
+    check(salz_encode_batch(items, ITEMS_CNT, threads) == 0,
+          "encoding batch with %u threads", threads);
+
+    for (size_t i = 0; i < ITEMS_CNT; i++) {
+        uint8_t *single = malloc(salz_encoded_len_max(bufs[i].len));
+        size_t single_len = salz_encoded_len_max(bufs[i].len);
+
+        /* Batch encodes each item as it would be encoded on its own */
+        check(single != NULL &&
+              salz_encode_safe(bufs[i].plain, bufs[i].len, single,
+                               &single_len) == 0 &&
+              items[i].ret == 0 && items[i].dst_len == single_len &&
+              !memcmp(items[i].dst, single, single_len),
+              "%u threads: item %zu encoded differently", threads, i);
+        free(single);
+
+        items[i] = (struct salz_batch_item){
+            .src = bufs[i].enc,
+            .src_len = items[i].dst_len,
+            .dst = bufs[i].dec,
+            .dst_len = bufs[i].len,
+        };
+    }
+
+    check(salz_decode_batch(items, ITEMS_CNT, threads) == 0,
+          "decoding batch with %u threads", threads);
+
+    for (size_t i = 0; i < ITEMS_CNT; i++) {
+        check(items[i].ret == 0 && items[i].dst_len == bufs[i].len &&
+              !memcmp(bufs[i].dec, bufs[i].plain, bufs[i].len),
+              "%u threads: item %zu decoded differently", threads, i);
+    }
+
+    /* Item, which doesn't fit, fails on its own */
+    items[4].dst_len = bufs[4].len / 2;
+    check(salz_decode_batch(items, ITEMS_CNT, threads) == -1,
+          "%u threads: decoding batch with item too long", threads);
+    for (size_t i = 0; i < ITEMS_CNT; i++) {
+        check(items[i].ret == (i == 4 ? -1 : 0),
+              "%u threads: item %zu returned %d", threads, i, items[i].ret);
+    }
+
+    for (size_t i = 0; i < ITEMS_CNT; i++) {
+        free(bufs[i].plain);
+        free(bufs[i].enc);
+        free(bufs[i].dec);
+    }
+}
+
+int main(void)
+{
+    batch(0);
+    batch(1);
+    batch(4);
+    batch(SALZ_BATCH_THREADS_MAX + 1);
+
+    return test_result();
+}
@@ -0,0 +1,125 @@
+/*
+ * test_dict.c - Training dictionaries and encoding with them
+ *
+ * Copyright (c) 2021-2023 Aki Utoslahti. All rights reserved.
+ *
+ * This work is distributed under terms of the MIT license.
+ * See file LICENSE or a copy at <https://opensource.org/licenses/MIT>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "salz.h"
+#include "test.h"
+
+#define SAMPLES_CNT  (400)
+#define SAMPLE_CAP   (256)
+#define DICT_CAP     (4096)
+/* Records following samples, which are encoded with the dictionary */
+#define RECORDS_CNT  (100)
+
+static uint8_t samples[(SAMPLES_CNT + RECORDS_CNT) * SAMPLE_CAP];
+static size_t sample_lens[SAMPLES_CNT + RECORDS_CNT];
+
+/* Fills samples with records, which share keys and values */
+static size_t fill_records(void)
+{
+    static const char *statuses[] = { "active", "suspended", "pending" };
+    uint64_t state = 1;
+    size_t len = 0;
+
+    for (size_t i = 0; i < SAMPLES_CNT + RECORDS_CNT; i++) {
+        uint32_t r = test_rand(&state);
+        int n = snprintf((char *)samples + len, SAMPLE_CAP,
+                         "{\"id\": %zu, \"name\": \"user%u\", \"status\": "
+                         "\"%s\", \"tags\": [\"alpha\", \"beta\"], "
+                         "\"score\": %u, \"region\": \"eu-north-1\"}\n", i,
+                         r % 10000, statuses[r % 3], (r >> 16) % 1000);
+
+        sample_lens[i] = (size_t)n;
+        len += (size_t)n;
+    }
+
+    return len;
+}
+
+int main(void)
+{
+    uint8_t dict_buf[DICT_CAP];
+    size_t dict_len = sizeof(dict_buf);
+    size_t samples_len = fill_records();
+    size_t plain_total = 0;
+    size_t dict_total = 0;
+    const uint8_t *record = samples;
+    salz_dict *dict;
+
+    for (size_t i = 0; i < SAMPLES_CNT; i++)
+        record += sample_lens[i];
+
+    check(salz_dict_train(samples, sample_lens, SAMPLES_CNT, dict_buf,
+                          &dict_len) == 0,
+          "training dictionary from %zu bytes", samples_len);
+    check(dict_len > 0 && dict_len <= sizeof(dict_buf),
+          "dictionary of %zu bytes", dict_len);
+
+    /* Dictionary too short for a single segment of samples */
+    {
+        size_t short_len = 16;
+
+        check(salz_dict_train(samples, sample_lens, SAMPLES_CNT, dict_buf,
+                              &short_len) == -1,
+              "training dictionary of 16 bytes");
+    }
+
+    if ((dict = salz_dict_create(dict_buf, dict_len)) == NULL) {
+        check(false, "creating dictionary of %zu bytes", dict_len);
+        return test_result();
+    }
+
+    for (size_t i = SAMPLES_CNT; i < SAMPLES_CNT + RECORDS_CNT; i++) {
+        size_t len = sample_lens[i];
+        uint8_t enc[2 * SAMPLE_CAP];
+        uint8_t dec[SAMPLE_CAP];
+        size_t enc_len = sizeof(enc);
+        size_t plain_len = sizeof(enc);
+        size_t dec_len = sizeof(dec);
+
+        check(salz_encode_dict_safe(dict, record, len, enc, &enc_len) == 0,
+              "encoding record %zu with dictionary", i);
+        check(salz_decode_dict_safe(dict, enc, enc_len, dec, &dec_len) == 0 &&
+              dec_len == len && !memcmp(dec, record, len),
+              "record %zu decoded differently", i);
+
+        check(salz_encode_safe(record, len, enc, &plain_len) == 0,
+              "encoding record %zu", i);
+
+        dict_total += enc_len;
+        plain_total += plain_len;
+        record += len;
+    }
+
+    /* Missing length is refused instead of read */
+    {
+        uint8_t enc[2 * SAMPLE_CAP];
+        uint8_t dec[SAMPLE_CAP];
+
+        check(salz_encode_dict_safe(dict, samples, sample_lens[0], enc,
+                                    NULL) == -1,
+              "encoding with dictionary without output length");
+        check(salz_decode_dict_safe(dict, enc, sizeof(enc), dec, NULL) == -1,
+              "decoding with dictionary without output length");
+    }
+
+    /* Records are too short to compress well on their own */
+    check(2 * dict_total < plain_total,
+          "records encoded to %zu bytes with dictionary, %zu without",
+          dict_total, plain_total);
+
+    salz_dict_destroy(dict);
+
+    return test_result();
+}
@@ -0,0 +1,166 @@
+/*
+ * test_encode.c - Round trips of segments and estimates of encoded length
+ *
+ * Copyright (c) 2021-2023 Aki Utoslahti. All rights reserved.
+ *
+ * This work is distributed under terms of the MIT license.
+ * See file LICENSE or a copy at <https://opensource.org/licenses/MIT>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "salz.h"
+#include "test.h"
+
+/* Longest stream header, which plain stream is never longer than (in bytes) */
+#define STREAM_HDR_LEN_MAX (8)
+
+enum fill {
+    FILL_ZEROS,
+    FILL_TEXT,
+    FILL_RANDOM,
+    FILL_MAX,
+};
+
+static const char *fill_names[FILL_MAX] = { "zeros", "text", "random" };
+
+static void fill(enum fill kind, uint8_t *buf, size_t len, uint64_t seed)
+{
+    switch (kind) {
+        case FILL_ZEROS:
+            memset(buf, 0, len);
+            break;
+        case FILL_TEXT:
+            test_fill_text(buf, len, seed);
+            break;
+        default:
+            test_fill_random(buf, len, seed);
+            break;
+    }
+}
+
+/*
+ * Encodes segment after history, checks that estimate matches the encoded
+ * length and that segment decodes back to itself
+ */
+static void round_trip(enum fill kind, size_t prefix_len, size_t src_len)
+{
+    size_t buf_len = prefix_len + src_len;
+    uint8_t *src = malloc(buf_len + 1);
+    uint8_t *dec = malloc(buf_len + 1);
+    size_t enc_cap = salz_encoded_len_max(src_len);
+    uint8_t *enc = malloc(enc_cap);
+    size_t enc_len = enc_cap;
+    size_t estimate_len = 0;
+    size_t dec_len = src_len;
+
+    if (src == NULL || dec == NULL || enc == NULL) {
+        check(false, "out of memory");
+        goto out;
+    }
+
+    fill(kind, src, buf_len, buf_len);
+
+    check(salz_encode_prefix_safe(src, prefix_len, src_len, enc,
+                                  &enc_len) == 0,
+          "%s: encoding %zu + %zu bytes", fill_names[kind], prefix_len,
+          src_len);
+    check(salz_estimate_encoded_len(src, prefix_len, src_len,
+                                    &estimate_len) == 0,
+          "%s: estimating %zu + %zu bytes", fill_names[kind], prefix_len,
+          src_len);
+    check(estimate_len == enc_len,
+          "%s: %zu + %zu bytes estimated %zu, encoded %zu", fill_names[kind],
+          prefix_len, src_len, estimate_len, enc_len);
+    check(enc_len <= STREAM_HDR_LEN_MAX + src_len,
+          "%s: %zu + %zu bytes expanded to %zu", fill_names[kind], prefix_len,
+          src_len, enc_len);
+
+    memcpy(dec, src, prefix_len);
+    check(salz_decode_prefix_safe(enc, enc_len, dec, prefix_len,
+                                  &dec_len) == 0,
+          "%s: decoding %zu + %zu bytes", fill_names[kind], prefix_len,
+          src_len);
+    check(dec_len == src_len && !memcmp(dec, src, buf_len),
+          "%s: %zu + %zu bytes decoded differently", fill_names[kind],
+          prefix_len, src_len);
+
+out:
+    free(enc);
+    free(dec);
+    free(src);
+}
+
+/* Encodes runs and text at every effort, which must all compress them */
+static void efforts_round_trip(void)
+{
+    size_t src_len = 65536;
+    uint8_t *src = malloc(src_len);
+    uint8_t *dec = malloc(src_len);
+    size_t enc_cap = salz_encoded_len_max(src_len);
+    uint8_t *enc = malloc(enc_cap);
+
+    if (src == NULL || dec == NULL || enc == NULL) {
+        check(false, "out of memory");
+        goto out;
+    }
+
+    for (enum fill kind = FILL_ZEROS; kind <= FILL_TEXT; kind++) {
+        fill(kind, src, src_len, 1);
+
+        for (uint32_t effort = SALZ_EFFORT_MIN; effort <= SALZ_EFFORT_MAX;
+             effort++) {
+            struct salz_encode_opts opts = {
+                .plain_entropy_min = SALZ_PLAIN_ENTROPY_MIN_DEFAULT,
+                .effort = effort,
+            };
+            size_t enc_len = enc_cap;
+            size_t dec_len = src_len;
+
+            check(salz_encode_opts_safe(src, 0, src_len, enc, &enc_len,
+                                        &opts) == 0,
+                  "%s: encoding at effort %u", fill_names[kind], effort);
+            check(enc_len < src_len / 2,
+                  "%s: effort %u encoded %zu bytes to %zu", fill_names[kind],
+                  effort, src_len, enc_len);
+            check(salz_decode_safe(enc, enc_len, dec, &dec_len) == 0 &&
+                  dec_len == src_len && !memcmp(dec, src, src_len),
+                  "%s: effort %u decoded differently", fill_names[kind],
+                  effort);
+        }
+    }
+
+out:
+    free(enc);
+    free(dec);
+    free(src);
+}
+
+int main(void)
+{
+    static const size_t prefix_lens[] = { 0, 1, 9, 100, 4096 };
+    static const size_t src_lens[] = {
+        100, 1000, SALZ_SMALL_SEGMENT_LEN_MAX, SALZ_SMALL_SEGMENT_LEN_MAX + 1,
+        5000, 70000,
+    };
+
+    for (enum fill kind = 0; kind < FILL_MAX; kind++) {
+        for (size_t i = 0; i < sizeof(prefix_lens) / sizeof(*prefix_lens);
+             i++) {
+            /* Segments around the shortest one, which isn't stored plain */
+            for (size_t src_len = 0; src_len <= 16; src_len++)
+                round_trip(kind, prefix_lens[i], src_len);
+
+            for (size_t j = 0; j < sizeof(src_lens) / sizeof(*src_lens); j++)
+                round_trip(kind, prefix_lens[i], src_lens[j]);
+        }
+    }
+
+    efforts_round_trip();
+
+    return test_result();
+}
@@ -0,0 +1,179 @@
+/*
+ * test_range.c - Decoding ranges and beginnings of segments
+ *
+ * Copyright (c) 2021-2023 Aki Utoslahti. All rights reserved.
+ *
+ * This work is distributed under terms of the MIT license.
+ * See file LICENSE or a copy at <https://opensource.org/licenses/MIT>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "salz.h"
+#include "test.h"
+
+#define SEGMENT_LEN (5 * SALZ_RESTART_LEN_MIN + 123)
+
+static uint8_t plain[SEGMENT_LEN];
+static uint8_t enc[SEGMENT_LEN + SEGMENT_LEN / 8 + 64];
+static uint8_t dec[SEGMENT_LEN];
+
+/* Distance between restart points of segment being checked */
+static size_t restart_len;
+
+static size_t encode(uint32_t len)
+{
+    struct salz_encode_opts opts = {
+        .plain_entropy_min = SALZ_PLAIN_ENTROPY_MIN_DEFAULT,
+        .restart_len = len,
+    };
+    size_t enc_len = sizeof(enc);
+
+    restart_len = len;
+
+    check(salz_encode_opts_safe(plain, 0, sizeof(plain), enc, &enc_len,
+                                &opts) == 0,
+          "encoding with restart points every %u bytes", len);
+
+    return enc_len;
+}
+
+/* Decodes range using space of exactly the length asked for */
+static void check_range_buf(const char *name, size_t enc_len, size_t offs,
+    size_t len, size_t expected)
+{
+    size_t buf_len = salz_decode_range_buf_len(enc, enc_len, offs, len);
+    uint8_t *buf = malloc(buf_len + 1);
+    size_t dst_len = len;
+
+    if (buf == NULL) {
+        check(false, "out of memory");
+        return;
+    }
+
+    check(buf_len <= restart_len,
+          "%s: %zu bytes at %zu need %zu bytes of space", name, len, offs,
+          buf_len);
+
+    memset(dec, 0, sizeof(dec));
+    check(salz_decode_range_buf_safe(enc, enc_len, offs, dec, &dst_len, buf,
+                                     buf_len) == 0 &&
+          dst_len == expected && !memcmp(dec, plain + offs, expected),
+          "%s: %zu bytes at %zu decoded differently with space of %zu bytes",
+          name, len, offs, buf_len);
+
+    /* Space shorter than asked for is refused */
+    if (buf_len) {
+        dst_len = len;
+        check(salz_decode_range_buf_safe(enc, enc_len, offs, dec, &dst_len,
+                                         buf, buf_len - 1) == -1,
+              "%s: %zu bytes at %zu decoded with space of %zu bytes", name,
+              len, offs, buf_len - 1);
+    }
+
+    free(buf);
+}
+
+/* Decodes ranges around restart points and at both ends of segment */
+static void check_ranges(const char *name, size_t enc_len)
+{
+    static const size_t lens[] = { 1, 100, SALZ_RESTART_LEN_MIN, 10000 };
+    size_t full_len = sizeof(dec);
+
+    check(salz_decode_safe(enc, enc_len, dec, &full_len) == 0 &&
+          full_len == sizeof(plain) && !memcmp(dec, plain, sizeof(plain)),
+          "%s: whole segment decoded differently", name);
+
+    for (size_t offs = 0; offs < sizeof(plain) + 2;
+         offs += SALZ_RESTART_LEN_MIN / 2 - 1) {
+        for (size_t i = 0; i < sizeof(lens) / sizeof(*lens); i++) {
+            size_t expected = offs < sizeof(plain) ?
+                              min(lens[i], sizeof(plain) - offs) : 0;
+            size_t dst_len = lens[i];
+
+            memset(dec, 0, sizeof(dec));
+            check(salz_decode_range_safe(enc, enc_len, offs, dec,
+                                         &dst_len) == 0,
+                  "%s: decoding %zu bytes at %zu", name, lens[i], offs);
+            check(dst_len == expected && !memcmp(dec, plain + offs, expected),
+                  "%s: %zu bytes at %zu decoded differently", name, lens[i],
+                  offs);
+
+            check_range_buf(name, enc_len, offs, lens[i], expected);
+        }
+    }
+}
+
+/* Decodes beginnings of segment, also from encoding cut short after them */
+static void check_partial(const char *name, size_t enc_len)
+{
+    static const size_t lens[] = {
+        0, 1, 8, 9, 1000, SALZ_RESTART_LEN_MIN + 1, SEGMENT_LEN - 1,
+        SEGMENT_LEN, SEGMENT_LEN + 1,
+    };
+
+    for (size_t i = 0; i < sizeof(lens) / sizeof(*lens); i++) {
+        size_t expected = min(lens[i], sizeof(plain));
+        size_t dst_len = lens[i];
+        size_t src_used = 0;
+        uint8_t *buf = malloc(lens[i] + 1);
+
+        if (buf == NULL) {
+            check(false, "out of memory");
+            return;
+        }
+
+        check(salz_decode_partial_safe(enc, enc_len, buf, &dst_len,
+                                       &src_used) == 0,
+              "%s: decoding first %zu bytes", name, lens[i]);
+        check(dst_len == expected && !memcmp(buf, plain, expected),
+              "%s: first %zu bytes decoded differently", name, lens[i]);
+        check(src_used <= enc_len, "%s: first %zu bytes read %zu of %zu",
+              name, lens[i], src_used, enc_len);
+
+        /* Rest of encoding isn't needed */
+        dst_len = lens[i];
+        memset(buf, 0, lens[i]);
+        check(salz_decode_partial_safe(enc, src_used, buf, &dst_len,
+                                       &src_used) == 0 &&
+              dst_len == expected && !memcmp(buf, plain, expected),
+              "%s: first %zu bytes need more than they read", name, lens[i]);
+
+        free(buf);
+    }
+}
+
+int main(void)
+{
+    size_t enc_len;
+    size_t dst_len = 100;
+
+    test_fill_text(plain, sizeof(plain), 1);
+
+    enc_len = encode(SALZ_RESTART_LEN_MIN);
+    check_ranges("restarts", enc_len);
+    check_partial("restarts", enc_len);
+
+    enc_len = encode(3 * SALZ_RESTART_LEN_MIN);
+    check_ranges("sparse restarts", enc_len);
+
+    /* Ranges of segments without restart points are refused */
+    enc_len = encode(0);
+    check_partial("no restarts", enc_len);
+    check(salz_decode_range_safe(enc, enc_len, 1000, dec, &dst_len) == -1,
+          "range of segment without restart points decoded");
+
+    /* Plain segments have a restart point at every byte */
+    test_fill_random(plain, sizeof(plain), 1);
+    enc_len = encode(SALZ_RESTART_LEN_MIN);
+    check(enc_len <= sizeof(plain) + 8, "random data encoded to %zu bytes",
+          enc_len);
+    check_ranges("plain", enc_len);
+    check_partial("plain", enc_len);
+
+    return test_result();
+}
@@ -0,0 +1,253 @@
+/*
+ * test_reader.c - Random access reads of SALZ files
+ *
+ * Copyright (c) 2021-2023 Aki Utoslahti. All rights reserved.
+ *
+ * This work is distributed under terms of the MIT license.
+ * See file LICENSE or a copy at <https://opensource.org/licenses/MIT>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "salz.h"
+#include "test.h"
+
+#define BLOCK_LEN (16 * 1024)
+/* Plain length of file, whose last segment is shorter than others */
+#define FILE_LEN  (7 * BLOCK_LEN + 1234)
+
+static uint8_t plain[FILE_LEN];
+
+static void put_u32(uint8_t *buf, uint32_t val)
+{
+    memcpy(buf, &val, sizeof(val));
+}
+
+static void put_u64(uint8_t *buf, uint64_t val)
+{
+    memcpy(buf, &val, sizeof(val));
+}
+
+/*
+ * Writes plain data into a temporary file as salzcli would, optionally
+ * with seek table and restart points
+ */
+static FILE *write_file(bool seek_table, bool restarts)
+{
+    struct salz_encode_opts opts = {
+        .plain_entropy_min = SALZ_PLAIN_ENTROPY_MIN_DEFAULT,
+        .restart_len = restarts ? SALZ_RESTART_LEN_MIN : 0,
+    };
+    size_t segs_cnt = divup(FILE_LEN, BLOCK_LEN);
+    uint8_t hdr[SALZ_FILE_HDR_LEN] = { 0 };
+    uint8_t *enc = malloc(salz_encoded_len_max(BLOCK_LEN));
+    uint8_t *table = calloc(segs_cnt, SALZ_SEEK_ENTRY_LEN);
+    uint8_t footer[SALZ_SEEK_FOOTER_LEN] = { 0 };
+    uint64_t pos = SALZ_FILE_HDR_LEN;
+    FILE *file = tmpfile();
+
+    if (enc == NULL || table == NULL || file == NULL) {
+        check(false, "couldn't create file");
+        goto fail;
+    }
+
+    put_u32(hdr + 0, SALZ_FILE_MAGIC);
+    hdr[4] = SALZ_FILE_VERSION;
+    hdr[5] = (seek_table ? SALZ_FILE_FLAG_SEEK_TABLE : 0) |
+             (restarts ? SALZ_FILE_FLAG_RESTARTS : 0);
+    put_u32(hdr + 8, BLOCK_LEN);
+    put_u64(hdr + 16, FILE_LEN);
+    fwrite(hdr, 1, sizeof(hdr), file);
+
+    for (size_t i = 0; i < segs_cnt; i++) {
+        size_t plain_len = min(BLOCK_LEN, FILE_LEN - i * BLOCK_LEN);
+        size_t enc_len = salz_encoded_len_max(BLOCK_LEN);
+        uint8_t frame_hdr[SALZ_FRAME_HDR_LEN];
+
+        if (salz_encode_opts_safe(plain + i * BLOCK_LEN, 0, plain_len, enc,
+                                  &enc_len, &opts) != 0) {
+            check(false, "couldn't encode segment %zu", i);
+            goto fail;
+        }
+
+        put_u32(frame_hdr + 0, (uint32_t)enc_len);
+        put_u32(frame_hdr + 4, (uint32_t)plain_len);
+        fwrite(frame_hdr, 1, sizeof(frame_hdr), file);
+        fwrite(enc, 1, enc_len, file);
+
+        put_u64(table + i * SALZ_SEEK_ENTRY_LEN + 0, pos + SALZ_FRAME_HDR_LEN);
+        put_u32(table + i * SALZ_SEEK_ENTRY_LEN + 8, (uint32_t)enc_len);
+        put_u32(table + i * SALZ_SEEK_ENTRY_LEN + 12, (uint32_t)plain_len);
+        pos += SALZ_FRAME_HDR_LEN + enc_len;
+    }
+
+    if (seek_table) {
+        put_u64(footer + 0, segs_cnt);
+        put_u32(footer + 8, SALZ_SEEK_MAGIC);
+        fwrite(table, SALZ_SEEK_ENTRY_LEN, segs_cnt, file);
+        fwrite(footer, 1, sizeof(footer), file);
+    }
+
+    if (fflush(file) != 0) {
+        check(false, "couldn't write file");
+        goto fail;
+    }
+
+    free(table);
+    free(enc);
+    return file;
+
+fail:
+    if (file != NULL)
+        fclose(file);
+    free(table);
+    free(enc);
+    return NULL;
+}
+
+static void check_read(salz_reader *reader, const char *name, uint64_t offs,
+    size_t len)
+{
+    static uint8_t buf[FILE_LEN + 1];
+    size_t expected = offs < FILE_LEN ? min(len, FILE_LEN - offs) : 0;
+    size_t dst_len = len;
+
+    memset(buf, 0, expected);
+    check(salz_reader_pread(reader, buf, &dst_len, offs) == 0,
+          "%s: reading %zu bytes at %llu", name, len,
+          (unsigned long long)offs);
+    check(dst_len == expected && !memcmp(buf, plain + offs, expected),
+          "%s: %zu bytes at %llu read differently", name, len,
+          (unsigned long long)offs);
+}
+
+/* Waits for background decoding, which has no other way to be observed */
+static bool wait_prefetches(salz_reader *reader, uint64_t cnt)
+{
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = 1000000 };
+    struct salz_reader_stats stats;
+
+    for (int i = 0; i < 5000; i++) {
+        salz_reader_stats_get(reader, &stats);
+        if (stats.prefetches >= cnt)
+            return true;
+        nanosleep(&ts, NULL);
+    }
+
+    return false;
+}
+
+static void read_file(const char *name, FILE *file,
+    const struct salz_reader_opts *opts)
+{
+    salz_reader *reader = salz_reader_open_opts(fileno(file), opts);
+    struct salz_reader_stats stats;
+    uint64_t state = 1;
+
+    if (reader == NULL) {
+        check(false, "%s: opening reader", name);
+        return;
+    }
+
+    check(salz_reader_len(reader) == FILE_LEN, "%s: length %llu", name,
+          (unsigned long long)salz_reader_len(reader));
+
+    /* Sequential reads in chunks, which don't align with segments */
+    for (uint64_t offs = 0; offs < FILE_LEN; offs += 1000)
+        check_read(reader, name, offs, 1000);
+
+    salz_reader_stats_get(reader, &stats);
+    if (opts->cache_len >= BLOCK_LEN)
+        check(stats.hits > 0, "%s: sequential reads hit cache %llu times",
+              name, (unsigned long long)stats.hits);
+    else
+        check(stats.hits == 0, "%s: reads hit disabled cache %llu times",
+              name, (unsigned long long)stats.hits);
+
+    /* Whole file, reads crossing segments and reads past its end */
+    check_read(reader, name, 0, FILE_LEN);
+    check_read(reader, name, BLOCK_LEN - 10, 20);
+    check_read(reader, name, BLOCK_LEN - 10, 2 * BLOCK_LEN + 20);
+    check_read(reader, name, FILE_LEN - 5, 100);
+    check_read(reader, name, FILE_LEN, 100);
+    check_read(reader, name, FILE_LEN + 100, 100);
+
+    /* Out of sequence reads, which begin within segments */
+    for (int i = 0; i < 200; i++) {
+        uint64_t offs = test_rand(&state) % FILE_LEN;
+        size_t len = test_rand(&state) % (BLOCK_LEN + 1);
+
+        check_read(reader, name, offs, len);
+    }
+
+    salz_reader_close(reader);
+}
+
+static void prefetch_file(const char *name, FILE *file)
+{
+    struct salz_reader_opts opts = {
+        .cache_len = 4 * BLOCK_LEN,
+        .prefetch = true,
+    };
+    salz_reader *reader = salz_reader_open_opts(fileno(file), &opts);
+
+    if (reader == NULL) {
+        check(false, "%s: opening reader with prefetching", name);
+        return;
+    }
+
+    /* Reading from start of file asks for next segment in background */
+    check_read(reader, name, 0, 100);
+    check(wait_prefetches(reader, 1), "%s: next segment not prefetched",
+          name);
+
+    for (uint64_t offs = 100; offs < FILE_LEN; offs += 777)
+        check_read(reader, name, offs, 777);
+
+    salz_reader_close(reader);
+}
+
+int main(void)
+{
+    static const struct salz_reader_opts cache_opts[] = {
+        { .cache_len = 0 },
+        { .cache_len = BLOCK_LEN },
+        { .cache_len = SALZ_READER_CACHE_LEN_DEFAULT },
+    };
+    static const char *names[] = { "frames", "seek table" };
+
+    test_fill_text(plain, FILE_LEN, 1);
+    /* Segment, which is stored plain */
+    test_fill_random(plain + 2 * BLOCK_LEN, BLOCK_LEN, 2);
+
+    for (int restarts = 0; restarts < 2; restarts++) {
+        for (int seek_table = 0; seek_table < 2; seek_table++) {
+            FILE *file = write_file(seek_table, restarts);
+            char name[64];
+
+            if (file == NULL)
+                continue;
+
+            for (size_t i = 0; i < sizeof(cache_opts) / sizeof(*cache_opts);
+                 i++) {
+                snprintf(name, sizeof(name), "%s%s, cache %zu",
+                         names[seek_table], restarts ? ", restarts" : "",
+                         cache_opts[i].cache_len);
+                read_file(name, file, &cache_opts[i]);
+            }
+
+            snprintf(name, sizeof(name), "%s%s, prefetch", names[seek_table],
+                     restarts ? ", restarts" : "");
+            prefetch_file(name, file);
+
+            fclose(file);
+        }
+    }
+
+    return test_result();
+}